@@ -7,7 +7,7 @@
 * Author: Arash Partow - 2002                                             *
 * URL: http://partow.net/programming/bitmap/index.html                    *
 *                                                                         *
-* Note: This library only supports 24-bits per pixel bitmap format files. *
+* Note: This library supports 24 and 32-bits per pixel bitmap files.      *
 *                                                                         *
 * Copyright notice:                                                       *
 * Free use of the Platform Independent Bitmap Image Reader Writer Library *
@@ -23,1820 +23,8845 @@
 #define INCLUDE_BITMAP_IMAGE_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cmath>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <iterator>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+   #define BITMAP_IMAGE_POSIX_IO
+   #include <fcntl.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+   #include <unistd.h>
+#endif
+
+#if !defined(BITMAP_IMAGE_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   #define BITMAP_IMAGE_X86_SIMD
+   #include <immintrin.h>
+#endif
 
 
-class bitmap_image
+class bitmap_allocator
 {
 public:
 
-   enum channel_mode {
-                        rgb_mode = 0,
-                        bgr_mode = 1
-                     };
-
-   enum color_plane {
-                       blue_plane  = 0,
-                       green_plane = 1,
-                       red_plane   = 2
-                    };
+   /*
+      Source of pixel storage for bitmap_image. Buffers are always
+      returned with the same size they were allocated with, and must
+      start on a buffer_alignment byte boundary.
+   */
 
+   enum { buffer_alignment = 64 };
 
-   bitmap_image()
-   : file_name_(""),
-     data_  (0),
-     length_(0),
-     width_ (0),
-     height_(0),
-     row_increment_(0),
-     bytes_per_pixel_(3),
-     channel_mode_(bgr_mode)
+   virtual ~bitmap_allocator()
    {}
 
-   bitmap_image(const std::string& filename)
-   : file_name_(filename),
-     data_  (0),
-     length_(0),
-     width_ (0),
-     height_(0),
-     row_increment_(0),
-     bytes_per_pixel_(0),
-     channel_mode_(bgr_mode)
+   virtual unsigned char* allocate(const std::size_t size) = 0;
+
+   virtual void deallocate(unsigned char* data, const std::size_t size) = 0;
+
+protected:
+
+   static inline unsigned char* aligned_new(const std::size_t size)
    {
-      load_bitmap();
+      // Over-allocate and keep the original pointer just before the aligned block.
+      unsigned char* raw = new unsigned char[size + buffer_alignment + sizeof(unsigned char*)];
+
+      const std::size_t address = reinterpret_cast<std::size_t>(raw + sizeof(unsigned char*));
+      const std::size_t aligned = (address + buffer_alignment - 1) & ~static_cast<std::size_t>(buffer_alignment - 1);
+
+      unsigned char* data = raw + (aligned - reinterpret_cast<std::size_t>(raw));
+
+      std::memcpy(data - sizeof(unsigned char*),&raw,sizeof(unsigned char*));
+
+      return data;
    }
 
-   bitmap_image(const unsigned int width, const unsigned int height)
-   : file_name_(""),
-     data_  (0),
-     length_(0),
-     width_(width),
-     height_(height),
-     row_increment_(0),
-     bytes_per_pixel_(3),
-     channel_mode_(bgr_mode)
+   static inline void aligned_delete(unsigned char* data)
    {
-     create_bitmap();
+      if (0 == data)
+         return;
+
+      unsigned char* raw = 0;
+
+      std::memcpy(&raw,data - sizeof(unsigned char*),sizeof(unsigned char*));
+
+      delete[] raw;
    }
+};
 
-   bitmap_image(const bitmap_image& image)
-   : file_name_(image.file_name_),
-     data_(0),
-     width_(image.width_),
-     height_(image.height_),
-     row_increment_(0),
-     bytes_per_pixel_(3),
-     channel_mode_(bgr_mode)
+class heap_bitmap_allocator : public bitmap_allocator
+{
+public:
+
+   unsigned char* allocate(const std::size_t size)
    {
-      create_bitmap();
-      std::copy(image.data_, image.data_ + image.length_, data_);
+      return aligned_new(size);
    }
 
-  ~bitmap_image()
+   void deallocate(unsigned char* data, const std::size_t)
    {
-      delete [] data_;
+      aligned_delete(data);
    }
+};
 
-   bitmap_image& operator=(const bitmap_image& image)
+inline bitmap_allocator& default_bitmap_allocator()
+{
+   static heap_bitmap_allocator allocator;
+   return allocator;
+}
+
+class pooled_bitmap_allocator : public bitmap_allocator
+{
+public:
+
+   /*
+      Recycles released pixel buffers by size class so that images of
+      the same (or similar) dimensions reuse each other's storage. Up
+      to max_cached_bytes of released buffers are retained. The pool
+      is thread-safe and must outlive every image that uses it.
+   */
+
+   pooled_bitmap_allocator(const std::size_t max_cached_bytes = 256 * 1024 * 1024)
+   : max_cached_bytes_(max_cached_bytes),
+     cached_bytes_(0)
+   {}
+
+  ~pooled_bitmap_allocator()
    {
-      if (this != &image)
+      trim();
+   }
+
+   unsigned char* allocate(const std::size_t size)
+   {
+      const std::size_t class_size = size_class(size);
+
       {
-         file_name_       = image.file_name_;
-         bytes_per_pixel_ = image.bytes_per_pixel_;
-         width_           = image.width_;
-         height_          = image.height_;
-         row_increment_   = 0;
-         channel_mode_    = image.channel_mode_;
-         create_bitmap();
-         std::copy(image.data_, image.data_ + image.length_, data_);
+         std::lock_guard<std::mutex> lock(mutex_);
+
+         free_list_map_t::iterator itr = free_lists_.find(class_size);
+
+         if ((free_lists_.end() != itr) && !itr->second.empty())
+         {
+            unsigned char* data = itr->second.back();
+            itr->second.pop_back();
+            cached_bytes_ -= class_size;
+
+            return data;
+         }
       }
 
-      return *this;
+      return aligned_new(class_size);
    }
 
-   inline bool operator!()
+   void deallocate(unsigned char* data, const std::size_t size)
    {
-      return (data_         == 0) ||
-             (length_       == 0) ||
-             (width_        == 0) ||
-             (height_       == 0) ||
-             (row_increment_== 0);
-   }
+      if (0 == data)
+         return;
 
-   inline void clear(const unsigned char v = 0x00)
-   {
-      std::fill(data_,data_ + length_,v);
+      const std::size_t class_size = size_class(size);
+
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+
+         if ((cached_bytes_ + class_size) <= max_cached_bytes_)
+         {
+            free_lists_[class_size].push_back(data);
+            cached_bytes_ += class_size;
+
+            return;
+         }
+      }
+
+      aligned_delete(data);
    }
 
-   inline unsigned char red_channel(const unsigned int x, const unsigned int y) const
+   inline std::size_t cached_bytes()
    {
-      return data_[(y * row_increment_) + (x * bytes_per_pixel_ + 2)];
+      std::lock_guard<std::mutex> lock(mutex_);
+      return cached_bytes_;
    }
 
-   inline unsigned char green_channel(const unsigned int x, const unsigned int y) const
+   inline void trim()
    {
-      return data_[(y * row_increment_) + (x * bytes_per_pixel_ + 1)];
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      for (free_list_map_t::iterator itr = free_lists_.begin(); itr != free_lists_.end(); ++itr)
+      {
+         for (std::size_t i = 0; i < itr->second.size(); ++i)
+         {
+            aligned_delete(itr->second[i]);
+         }
+      }
+
+      free_lists_.clear();
+      cached_bytes_ = 0;
    }
 
-   inline unsigned char blue_channel (const unsigned int x, const unsigned int y) const
+   static inline std::size_t size_class(const std::size_t size)
    {
-      return data_[(y * row_increment_) + (x * bytes_per_pixel_ + 0)];
+      // 64 byte granularity for small buffers, four classes per power of two beyond.
+      if (size <= 4096)
+      {
+         return (0 == size) ? 64 : ((size + 63) & ~static_cast<std::size_t>(63));
+      }
+
+      std::size_t power = 4096;
+
+      while ((power << 1) <= size)
+      {
+         power <<= 1;
+      }
+
+      const std::size_t step = power >> 2;
+
+      return ((size + step - 1) / step) * step;
    }
 
-   inline void red_channel(const unsigned int x, const unsigned int y, const unsigned char value)
+private:
+
+   pooled_bitmap_allocator(const pooled_bitmap_allocator&);
+   pooled_bitmap_allocator& operator=(const pooled_bitmap_allocator&);
+
+   typedef std::map<std::size_t,std::vector<unsigned char*> > free_list_map_t;
+
+   std::mutex       mutex_;
+   free_list_map_t  free_lists_;
+   std::size_t      max_cached_bytes_;
+   std::size_t      cached_bytes_;
+};
+
+namespace bitmap_details
+{
+   /*
+      Vectorised pixel kernels. Each kernel is compiled for its own
+      instruction set and selected at run-time from what the CPU
+      supports, so the library still builds without any -m flags. A
+      kernel processes as many whole iterations as fit the row and
+      returns the number of pixels it handled, the scalar loop of the
+      caller finishes the rest. Defining BITMAP_IMAGE_NO_SIMD leaves
+      only the scalar paths.
+   */
+
+   enum simd_level {
+                      simd_none  = 0,
+                      simd_sse2  = 1,
+                      simd_ssse3 = 2,
+                      simd_sse41 = 3,
+                      simd_avx2  = 4
+                   };
+
+   inline simd_level detected_simd_level()
    {
-      data_[(y * row_increment_) + (x * bytes_per_pixel_ + 2)] = value;
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      __builtin_cpu_init();
+
+      if (__builtin_cpu_supports("avx2"))
+         return simd_avx2;
+      else if (__builtin_cpu_supports("sse4.1"))
+         return simd_sse41;
+      else if (__builtin_cpu_supports("ssse3"))
+         return simd_ssse3;
+      else if (__builtin_cpu_supports("sse2"))
+         return simd_sse2;
+      #endif
+
+      return simd_none;
    }
 
-   inline void green_channel(const unsigned int x, const unsigned int y, const unsigned char value)
+   inline simd_level& simd_limit()
    {
-      data_[(y * row_increment_) + (x * bytes_per_pixel_ + 1)] = value;
+      static simd_level limit = simd_avx2;
+      return limit;
    }
 
-   inline void blue_channel (const unsigned int x, const unsigned int y, const unsigned char value)
+   inline simd_level active_simd_level()
    {
-      data_[(y * row_increment_) + (x * bytes_per_pixel_ + 0)] = value;
+      static const simd_level detected = detected_simd_level();
+      return std::min(detected,simd_limit());
    }
 
-   inline unsigned char* row(unsigned int row_index) const
+   // Caps the kernels used from here on, simd_none forces the scalar paths.
+   inline void set_simd_limit(const simd_level level)
    {
-      return data_ + (row_index * row_increment_);
+      simd_limit() = level;
    }
 
-   inline void get_pixel(const unsigned int x, const unsigned int y,
-                         unsigned char& red,
-                         unsigned char& green,
-                         unsigned char& blue)
+   // Q15 luma weights (0.299, 0.587, 0.114), they sum to exactly 1 << 15.
+   enum gray_weights {
+                        gray_weight_red   =  9798,
+                        gray_weight_green = 19235,
+                        gray_weight_blue  =  3735
+                     };
+
+   struct ycbcr_coefficients
    {
-      const unsigned int y_offset = y * row_increment_;
-      const unsigned int x_offset = x * bytes_per_pixel_;
-      blue  = data_[y_offset + x_offset + 0];
-      green = data_[y_offset + x_offset + 1];
-      red   = data_[y_offset + x_offset + 2];
-   }
+      /*
+         Q15 weights per pixel byte (not per colour) for limited range
+         Y, Cb and Cr. The chroma weights sum to zero, the luma weights
+         to 219/255, so grey maps to Cb = Cr = 128 and white to Y = 235.
+      */
 
-   inline void set_pixel(const unsigned int x, const unsigned int y,
-                         const unsigned char red,
-                         const unsigned char green,
-                         const unsigned char blue)
+      int luma[3];
+      int cb  [3];
+      int cr  [3];
+   };
+
+   #ifdef BITMAP_IMAGE_X86_SIMD
+   __attribute__((target("ssse3")))
+   inline __m128i gray_quad_ssse3(const unsigned char* src,
+                                  const __m128i& pair_shuffle, const __m128i& pair_weights,
+                                  const __m128i& last_shuffle, const __m128i& last_weights)
    {
-      const unsigned int y_offset = y * row_increment_;
-      const unsigned int x_offset = x * bytes_per_pixel_;
-      data_[y_offset + x_offset + 0] = blue;
-      data_[y_offset + x_offset + 1] = green;
-      data_[y_offset + x_offset + 2] = red;
+      // Four pixels: channels 0,1 are paired for one madd, channel 2 (with a zero) for another.
+      const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+
+      const __m128i sum = _mm_add_epi32(_mm_madd_epi16(_mm_shuffle_epi8(pixels,pair_shuffle),pair_weights),
+                                        _mm_madd_epi16(_mm_shuffle_epi8(pixels,last_shuffle),last_weights));
+
+      return _mm_srli_epi32(_mm_add_epi32(sum,_mm_set1_epi32(1 << 14)),15);
    }
 
-   inline bool copy_from(const bitmap_image& image)
+   __attribute__((target("ssse3")))
+   inline unsigned int gray_row_ssse3(const unsigned char* src, unsigned char* gray,
+                                      const unsigned int width, const unsigned int bpp,
+                                      const int w0, const int w1, const int w2)
    {
-      if (
-           (image.height_ != height_) ||
-           (image.width_  != width_ )
-         )
+      const char b = static_cast<char>(bpp);
+
+      const __m128i pair_shuffle = _mm_setr_epi8(0,-1,1,-1,b,-1,b + 1,-1,2 * b,-1,2 * b + 1,-1,3 * b,-1,3 * b + 1,-1);
+      const __m128i last_shuffle = _mm_setr_epi8(2,-1,-1,-1,b + 2,-1,-1,-1,2 * b + 2,-1,-1,-1,3 * b + 2,-1,-1,-1);
+      const __m128i pair_weights = _mm_set1_epi32(w0 | (w1 << 16));
+      const __m128i last_weights = _mm_set1_epi32(w2);
+
+      // 16 pixels per iteration, the last 16 byte load must stay inside the row.
+      const std::size_t row_bytes = static_cast<std::size_t>(width) * bpp;
+
+      unsigned int x = 0;
+
+      for ( ; (static_cast<std::size_t>(x + 12) * bpp + 16) <= row_bytes; x += 16)
       {
-         return false;
+         const unsigned char* itr = src + static_cast<std::size_t>(x) * bpp;
+
+         const __m128i q0 = gray_quad_ssse3(itr            ,pair_shuffle,pair_weights,last_shuffle,last_weights);
+         const __m128i q1 = gray_quad_ssse3(itr +  4 * bpp ,pair_shuffle,pair_weights,last_shuffle,last_weights);
+         const __m128i q2 = gray_quad_ssse3(itr +  8 * bpp ,pair_shuffle,pair_weights,last_shuffle,last_weights);
+         const __m128i q3 = gray_quad_ssse3(itr + 12 * bpp ,pair_shuffle,pair_weights,last_shuffle,last_weights);
+
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(gray + x),
+                          _mm_packus_epi16(_mm_packs_epi32(q0,q1),_mm_packs_epi32(q2,q3)));
       }
 
-      std::copy(image.data_,image.data_ + image.length_,data_);
-      return true;
+      return x;
    }
 
-   inline bool copy_from(const bitmap_image& source_image,
-                         const unsigned int& x_offset,
-                         const unsigned int& y_offset)
+   __attribute__((target("avx2")))
+   inline __m256i gray_octet_avx2(const unsigned char* src, const unsigned int bpp,
+                                  const __m256i& pair_shuffle, const __m256i& pair_weights,
+                                  const __m256i& last_shuffle, const __m256i& last_weights)
    {
-      if ((x_offset + source_image.width_ ) > width_ ) { return false; }
-      if ((y_offset + source_image.height_) > height_) { return false; }
+      // Pixels 0-3 go to the low lane and 4-7 to the high lane, so the in-lane shuffles line up.
+      const __m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))),
+                                                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * bpp)),1);
 
-      for (unsigned int y = 0; y < source_image.height_; ++y)
-      {
-         unsigned char* itr1           = row(y + y_offset) + x_offset * bytes_per_pixel_;
-         const unsigned char* itr2     = source_image.row(y);
-         const unsigned char* itr2_end = itr2 + source_image.width_ * bytes_per_pixel_;
-         std::copy(itr2,itr2_end,itr1);
-      }
-      return true;
+      const __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(_mm256_shuffle_epi8(pixels,pair_shuffle),pair_weights),
+                                           _mm256_madd_epi16(_mm256_shuffle_epi8(pixels,last_shuffle),last_weights));
+
+      return _mm256_srli_epi32(_mm256_add_epi32(sum,_mm256_set1_epi32(1 << 14)),15);
    }
 
-   inline bool region(const unsigned int& x,
-                      const unsigned int& y,
-                      const unsigned int& width,
-                      const unsigned int& height,
-                      bitmap_image& dest_image)
+   __attribute__((target("avx2")))
+   inline unsigned int gray_row_avx2(const unsigned char* src, unsigned char* gray,
+                                     const unsigned int width, const unsigned int bpp,
+                                     const int w0, const int w1, const int w2)
    {
-      if ((x + width ) > width_ ) { return false; }
-      if ((y + height) > height_) { return false; }
+      const char b = static_cast<char>(bpp);
 
-      if (
-           (dest_image.width_  < width_ ) ||
-           (dest_image.height_ < height_)
-         )
-      {
-         dest_image.setwidth_height(width,height);
-      }
+      const __m256i pair_shuffle = _mm256_setr_epi8(0,-1,1,-1,b,-1,b + 1,-1,2 * b,-1,2 * b + 1,-1,3 * b,-1,3 * b + 1,-1,
+                                                    0,-1,1,-1,b,-1,b + 1,-1,2 * b,-1,2 * b + 1,-1,3 * b,-1,3 * b + 1,-1);
+      const __m256i last_shuffle = _mm256_setr_epi8(2,-1,-1,-1,b + 2,-1,-1,-1,2 * b + 2,-1,-1,-1,3 * b + 2,-1,-1,-1,
+                                                    2,-1,-1,-1,b + 2,-1,-1,-1,2 * b + 2,-1,-1,-1,3 * b + 2,-1,-1,-1);
+      const __m256i pair_weights = _mm256_set1_epi32(w0 | (w1 << 16));
+      const __m256i last_weights = _mm256_set1_epi32(w2);
 
-      for (unsigned int r = 0; r < height; ++r)
-      {
-         unsigned char* itr1     = row(r + y) + x * bytes_per_pixel_;
-         unsigned char* itr1_end = itr1 + (width * bytes_per_pixel_);
-         unsigned char* itr2     = dest_image.row(r);
-         std::copy(itr1,itr1_end,itr2);
-      }
+      // The packs interleave the lanes, this puts the groups of four pixels back in order.
+      const __m256i order = _mm256_setr_epi32(0,4,1,5,2,6,3,7);
 
-      return true;
-   }
+      // 32 pixels per iteration, the last 16 byte load must stay inside the row.
+      const std::size_t row_bytes = static_cast<std::size_t>(width) * bpp;
 
-   inline bool set_region(const unsigned int& x,
-                          const unsigned int& y,
-                          const unsigned int& width,
-                          const unsigned int& height,
-                          const unsigned char& value)
-   {
-      if ((x + width) > width_)   { return false; }
-      if ((y + height) > height_) { return false; }
+      unsigned int x = 0;
 
-      for (unsigned int r = 0; r < height; ++r)
+      for ( ; (static_cast<std::size_t>(x + 28) * bpp + 16) <= row_bytes; x += 32)
       {
-         unsigned char* itr     = row(r + y) + x * bytes_per_pixel_;
-         unsigned char* itr_end = itr + (width * bytes_per_pixel_);
-         std::fill(itr,itr_end,value);
+         const unsigned char* itr = src + static_cast<std::size_t>(x) * bpp;
+
+         const __m256i o0 = gray_octet_avx2(itr            ,bpp,pair_shuffle,pair_weights,last_shuffle,last_weights);
+         const __m256i o1 = gray_octet_avx2(itr +  8 * bpp ,bpp,pair_shuffle,pair_weights,last_shuffle,last_weights);
+         const __m256i o2 = gray_octet_avx2(itr + 16 * bpp ,bpp,pair_shuffle,pair_weights,last_shuffle,last_weights);
+         const __m256i o3 = gray_octet_avx2(itr + 24 * bpp ,bpp,pair_shuffle,pair_weights,last_shuffle,last_weights);
+
+         const __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(o0,o1),_mm256_packs_epi32(o2,o3));
+
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(gray + x),_mm256_permutevar8x32_epi32(packed,order));
       }
 
-      return true;
+      return x;
    }
 
-   inline bool set_region(const unsigned int& x,
-                          const unsigned int& y,
-                          const unsigned int& width,
-                          const unsigned int& height,
-                          const color_plane color,
-                          const unsigned char& value)
+   __attribute__((target("ssse3")))
+   inline unsigned int expand_gray_row_ssse3(const unsigned char* gray, unsigned char* dst,
+                                             const unsigned int width, const unsigned int bpp)
    {
-      if ((x + width) > width_)   { return false; }
-      if ((y + height) > height_) { return false; }
-
-      const unsigned int color_plane_offset = offset(color);
+      unsigned int x = 0;
 
-      for (unsigned int r = 0; r < height; ++r)
+      if (3 == bpp)
       {
-         unsigned char* itr     = row(r + y) + x * bytes_per_pixel_ + color_plane_offset;
-         unsigned char* itr_end = itr + (width * bytes_per_pixel_);
+         const __m128i spread0 = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+         const __m128i spread1 = _mm_setr_epi8( 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10);
+         const __m128i spread2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
 
-         while (itr != itr_end)
+         for ( ; (x + 16) <= width; x += 16)
          {
-            *itr  = value;
-             itr += bytes_per_pixel_;
+            const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gray + x));
+
+            __m128i* itr = reinterpret_cast<__m128i*>(dst + 3 * static_cast<std::size_t>(x));
+
+            _mm_storeu_si128(itr + 0,_mm_shuffle_epi8(g,spread0));
+            _mm_storeu_si128(itr + 1,_mm_shuffle_epi8(g,spread1));
+            _mm_storeu_si128(itr + 2,_mm_shuffle_epi8(g,spread2));
          }
       }
+      else if (4 == bpp)
+      {
+         // The fourth byte of every pixel is kept as-is.
+         const __m128i keep = _mm_set1_epi32(static_cast<int>(0xFF000000));
 
-      return true;
-   }
+         for ( ; (x + 16) <= width; x += 16)
+         {
+            const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gray + x));
 
-   inline bool set_region(const unsigned int& x,
-                          const unsigned int& y,
-                          const unsigned int& width,
-                          const unsigned int& height,
-                          const unsigned char& red,
-                          const unsigned char& green,
-                          const unsigned char& blue)
-   {
-      if ((x +  width) >  width_) { return false; }
-      if ((y + height) > height_) { return false; }
+            __m128i* itr = reinterpret_cast<__m128i*>(dst + 4 * static_cast<std::size_t>(x));
 
-      for (unsigned int r = 0; r < height; ++r)
-      {
-         unsigned char* itr     = row(r + y) + x * bytes_per_pixel_;
-         unsigned char* itr_end = itr + (width * bytes_per_pixel_);
+            for (int i = 0; i < 4; ++i)
+            {
+               const char k = static_cast<char>(4 * i);
 
-         while (itr != itr_end)
-         {
-            *(itr++) = blue;
-            *(itr++) = green;
-            *(itr++) = red;
+               const __m128i spread = _mm_setr_epi8(k,k,k,-1,k + 1,k + 1,k + 1,-1,k + 2,k + 2,k + 2,-1,k + 3,k + 3,k + 3,-1);
+               const __m128i pixels = _mm_loadu_si128(itr + i);
+
+               _mm_storeu_si128(itr + i,_mm_or_si128(_mm_shuffle_epi8(g,spread),_mm_and_si128(pixels,keep)));
+            }
          }
       }
 
-      return true;
+      return x;
    }
 
-   void reflective_image(bitmap_image& image)
+   /*
+      Blend kernels compute (a * src + (256 - a) * dst) >> 8 per byte
+      in 16-bit lanes, a being 0..256. Per-byte alpha is given as 0..255
+      and widened with a = m + (m >> 7) so that 255 is fully opaque.
+   */
+
+   __attribute__((target("sse2")))
+   inline __m128i blend_epi16_sse2(const __m128i& s, const __m128i& d, const __m128i& a)
    {
-      image.setwidth_height(3 * width_, 3 * height_,true);
-      image.copy_from(*this,width_,height_);
-      vertical_flip();
-      image.copy_from(*this,width_,0);
-      image.copy_from(*this,width_,2 * height_);
-      vertical_flip();
-      horizontal_flip();
-      image.copy_from(*this,0,height_);
-      image.copy_from(*this,2 * width_,height_);
-      horizontal_flip();
-   }
-
-   inline unsigned int width() const
-   {
-      return width_;
-   }
+      const __m128i a_compliment = _mm_sub_epi16(_mm_set1_epi16(256),a);
 
-   inline unsigned int height() const
-   {
-      return height_;
+      return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(s,a),_mm_mullo_epi16(d,a_compliment)),8);
    }
 
-   inline unsigned int bytes_per_pixel() const
+   __attribute__((target("sse2")))
+   inline std::size_t blend_row_sse2(unsigned char* dst, const unsigned char* src,
+                                     const std::size_t length, const int alpha)
    {
-      return bytes_per_pixel_;
-   }
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i a    = _mm_set1_epi16(static_cast<short>(alpha));
 
-   inline unsigned int pixel_count() const
-   {
-      return width_ *  height_;
-   }
+      std::size_t i = 0;
 
-   inline void setwidth_height(const unsigned int width,
-                               const unsigned int height,
-                               const bool clear = false)
-   {
-      delete[] data_;
-      data_   = 0;
-      width_  = width;
-      height_ = height;
+      for ( ; (i + 16) <= length; i += 16)
+      {
+         const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+         const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
 
-      create_bitmap();
+         const __m128i lo = blend_epi16_sse2(_mm_unpacklo_epi8(s,zero),_mm_unpacklo_epi8(d,zero),a);
+         const __m128i hi = blend_epi16_sse2(_mm_unpackhi_epi8(s,zero),_mm_unpackhi_epi8(d,zero),a);
 
-      if (clear)
-      {
-         std::fill(data_,data_ + length_,0x00);
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),_mm_packus_epi16(lo,hi));
       }
+
+      return i;
    }
 
-   void save_image(const std::string& file_name)
+   __attribute__((target("sse2")))
+   inline std::size_t blend_row_sse2(unsigned char* dst, const unsigned char* src,
+                                     const unsigned char* alpha, const std::size_t length)
    {
-      std::ofstream stream(file_name.c_str(),std::ios::binary);
-
-      if (!stream)
-      {
-         std::cout << "bitmap_image::save_image(): Error - Could not open file "  << file_name << " for writing!" << std::endl;
-         return;
-      }
+      const __m128i zero = _mm_setzero_si128();
 
-      bitmap_file_header bfh;
-      bitmap_information_header bih;
-
-      bih.width            = width_;
-      bih.height           = height_;
-      bih.bit_count        = static_cast<unsigned short>(bytes_per_pixel_ << 3);
-      bih.clr_important    =  0;
-      bih.clr_used         =  0;
-      bih.compression      =  0;
-      bih.planes           =  1;
-      bih.size             = 40;
-      bih.x_pels_per_meter =  0;
-      bih.y_pels_per_meter =  0;
-      bih.size_image       = (((bih.width * bytes_per_pixel_) + 3) & 0x0000FFFC) * bih.height;
+      std::size_t i = 0;
 
-      bfh.type      = 19778;
-      bfh.size      = 55 + bih.size_image;
-      bfh.reserved1 = 0;
-      bfh.reserved2 = 0;
-      bfh.off_bits  = bih.struct_size() + bfh.struct_size();
+      for ( ; (i + 16) <= length; i += 16)
+      {
+         const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src   + i));
+         const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst   + i));
+         const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(alpha + i));
 
-      write_bfh(stream,bfh);
-      write_bih(stream,bih);
+         const __m128i m_lo = _mm_unpacklo_epi8(m,zero);
+         const __m128i m_hi = _mm_unpackhi_epi8(m,zero);
 
-      unsigned int padding = (4 - ((3 * width_) % 4)) % 4;
-      char padding_data[4] = {0x0,0x0,0x0,0x0};
+         const __m128i lo = blend_epi16_sse2(_mm_unpacklo_epi8(s,zero),_mm_unpacklo_epi8(d,zero),_mm_add_epi16(m_lo,_mm_srli_epi16(m_lo,7)));
+         const __m128i hi = blend_epi16_sse2(_mm_unpackhi_epi8(s,zero),_mm_unpackhi_epi8(d,zero),_mm_add_epi16(m_hi,_mm_srli_epi16(m_hi,7)));
 
-      for (unsigned int i = 0; i < height_; ++i)
-      {
-         unsigned char* data_ptr = data_ + (row_increment_ * (height_ - i - 1));
-         stream.write(reinterpret_cast<char*>(data_ptr),sizeof(unsigned char) * bytes_per_pixel_ * width_);
-         stream.write(padding_data,padding);
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),_mm_packus_epi16(lo,hi));
       }
 
-      stream.close();
+      return i;
    }
 
-   inline void set_all_ith_bits_low(const unsigned int bitr_index)
+   __attribute__((target("avx2")))
+   inline __m256i blend_epi16_avx2(const __m256i& s, const __m256i& d, const __m256i& a)
    {
-      unsigned char mask = static_cast<unsigned char>(~(1 << bitr_index));
+      const __m256i a_compliment = _mm256_sub_epi16(_mm256_set1_epi16(256),a);
 
-      for (unsigned char* itr = data_; itr != data_ + length_; ++itr)
-      {
-         *itr &= mask;
-      }
+      return _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s,a),_mm256_mullo_epi16(d,a_compliment)),8);
    }
 
-   inline void set_all_ith_bits_high(const unsigned int bitr_index)
+   __attribute__((target("avx2")))
+   inline std::size_t blend_row_avx2(unsigned char* dst, const unsigned char* src,
+                                     const std::size_t length, const int alpha)
    {
-      unsigned char mask = static_cast<unsigned char>(1 << bitr_index);
+      // The unpacks and the pack all work within 128-bit lanes, so no reordering is needed.
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i a    = _mm256_set1_epi16(static_cast<short>(alpha));
 
-      for (unsigned char* itr = data_; itr != data_ + length_; ++itr)
-      {
-         *itr |= mask;
-      }
-   }
+      std::size_t i = 0;
 
-   inline void set_all_ith_channels(const unsigned int& channel, const unsigned char& value)
-   {
-      for (unsigned char* itr = (data_ + channel); itr < (data_ + length_); itr += bytes_per_pixel_)
+      for ( ; (i + 32) <= length; i += 32)
       {
-         *itr = value;
-      }
-   }
+         const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+         const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
 
-   inline void set_channel(const color_plane color,const unsigned char& value)
-   {
-      for (unsigned char* itr = (data_ + offset(color)); itr < (data_ + length_); itr += bytes_per_pixel_)
-      {
-         *itr = value;
-      }
-   }
+         const __m256i lo = blend_epi16_avx2(_mm256_unpacklo_epi8(s,zero),_mm256_unpacklo_epi8(d,zero),a);
+         const __m256i hi = blend_epi16_avx2(_mm256_unpackhi_epi8(s,zero),_mm256_unpackhi_epi8(d,zero),a);
 
-   inline void ror_channel(const color_plane color, const unsigned int& ror)
-   {
-      for (unsigned char* itr = (data_ + offset(color)); itr < (data_ + length_); itr += bytes_per_pixel_)
-      {
-         *itr = static_cast<unsigned char>(((*itr) >> ror) | ((*itr) << (8 - ror)));
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),_mm256_packus_epi16(lo,hi));
       }
-   }
 
-   inline void set_all_channels(const unsigned char& value)
-   {
-      for (unsigned char* itr = data_; itr < (data_ + length_); )
-      {
-         *(itr++) = value;
-      }
+      return i;
    }
 
-   inline void set_all_channels(const unsigned char& r_value,
-                                const unsigned char& g_value,
-                                const unsigned char& b_value)
+   __attribute__((target("avx2")))
+   inline std::size_t blend_row_avx2(unsigned char* dst, const unsigned char* src,
+                                     const unsigned char* alpha, const std::size_t length)
    {
-      for (unsigned char* itr = (data_ + 0); itr < (data_ + length_); itr += bytes_per_pixel_)
+      const __m256i zero = _mm256_setzero_si256();
+
+      std::size_t i = 0;
+
+      for ( ; (i + 32) <= length; i += 32)
       {
-         *(itr + 0) = b_value;
-         *(itr + 1) = g_value;
-         *(itr + 2) = r_value;
-      }
-   }
+         const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src   + i));
+         const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst   + i));
+         const __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(alpha + i));
 
-   inline void invert_color_planes()
-   {
-      for (unsigned char* itr = data_; itr < (data_ + length_); *itr = ~(*itr), ++itr);
-   }
+         const __m256i m_lo = _mm256_unpacklo_epi8(m,zero);
+         const __m256i m_hi = _mm256_unpackhi_epi8(m,zero);
 
-   inline void add_to_color_plane(const color_plane color,const unsigned char& value)
-   {
-      for (unsigned char* itr = (data_ + offset(color)); itr < (data_ + length_); (*itr) += value, itr += bytes_per_pixel_);
+         const __m256i lo = blend_epi16_avx2(_mm256_unpacklo_epi8(s,zero),_mm256_unpacklo_epi8(d,zero),_mm256_add_epi16(m_lo,_mm256_srli_epi16(m_lo,7)));
+         const __m256i hi = blend_epi16_avx2(_mm256_unpackhi_epi8(s,zero),_mm256_unpackhi_epi8(d,zero),_mm256_add_epi16(m_hi,_mm256_srli_epi16(m_hi,7)));
+
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),_mm256_packus_epi16(lo,hi));
+      }
+
+      return i;
    }
 
-   inline void convert_to_grayscale()
+   __attribute__((target("ssse3")))
+   inline unsigned int spread_alpha_row_ssse3(const unsigned char* mask, unsigned char* alpha,
+                                              const unsigned int width, const unsigned int bpp)
    {
-      double r_scaler = 0.299;
-      double g_scaler = 0.587;
-      double b_scaler = 0.114;
+      unsigned int x = 0;
 
-      if (rgb_mode == channel_mode_)
+      if (3 == bpp)
       {
-         double tmp = r_scaler;
-         r_scaler = b_scaler;
-         b_scaler = tmp;
-      }
+         const __m128i spread0 = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+         const __m128i spread1 = _mm_setr_epi8( 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10);
+         const __m128i spread2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); )
-      {
-         unsigned char gray_value = static_cast<unsigned char>((r_scaler * (*(itr + 2))) +
-                                                               (g_scaler * (*(itr + 1))) +
-                                                               (b_scaler * (*(itr + 0))) );
-         *(itr++) = gray_value;
-         *(itr++) = gray_value;
-         *(itr++) = gray_value;
-      }
-   }
+         for ( ; (x + 16) <= width; x += 16)
+         {
+            const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + x));
 
-   inline const unsigned char* data()
-   {
-      return data_;
-   }
+            __m128i* itr = reinterpret_cast<__m128i*>(alpha + 3 * static_cast<std::size_t>(x));
 
-   inline void bgr_to_rgb()
-   {
-      if ((bgr_mode == channel_mode_) && (3 == bytes_per_pixel_))
+            _mm_storeu_si128(itr + 0,_mm_shuffle_epi8(m,spread0));
+            _mm_storeu_si128(itr + 1,_mm_shuffle_epi8(m,spread1));
+            _mm_storeu_si128(itr + 2,_mm_shuffle_epi8(m,spread2));
+         }
+      }
+      else if (4 == bpp)
       {
-         reverse_channels();
-         channel_mode_ = rgb_mode;
+         for ( ; (x + 16) <= width; x += 16)
+         {
+            const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + x));
+
+            __m128i* itr = reinterpret_cast<__m128i*>(alpha + 4 * static_cast<std::size_t>(x));
+
+            const __m128i lo = _mm_unpacklo_epi8(m,m);
+            const __m128i hi = _mm_unpackhi_epi8(m,m);
+
+            _mm_storeu_si128(itr + 0,_mm_unpacklo_epi16(lo,lo));
+            _mm_storeu_si128(itr + 1,_mm_unpackhi_epi16(lo,lo));
+            _mm_storeu_si128(itr + 2,_mm_unpacklo_epi16(hi,hi));
+            _mm_storeu_si128(itr + 3,_mm_unpackhi_epi16(hi,hi));
+         }
       }
+
+      return x;
    }
 
-   inline void rgb_to_bgr()
+   __attribute__((target("ssse3")))
+   inline unsigned int split_bgra_row_ssse3(const unsigned char* src, unsigned char* color,
+                                            unsigned char* alpha, const unsigned int width,
+                                            const unsigned int bpp)
    {
-      if ((rgb_mode == channel_mode_) && (3 == bytes_per_pixel_))
+      // Four pixels per step. The 3 byte layout writes 12 bytes per 16 byte store, the buffers carry the slack.
+      const __m128i color_shuffle = (3 == bpp) ?
+                                    _mm_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1) :
+                                    _mm_setr_epi8(0,1,2,-1,4,5,6,-1,8,9,10,-1,12,13,14,-1);
+      const __m128i alpha_shuffle = (3 == bpp) ?
+                                    _mm_setr_epi8(3,3,3,7,7,7,11,11,11,15,15,15,-1,-1,-1,-1) :
+                                    _mm_setr_epi8(3,3,3,3,7,7,7,7,11,11,11,11,15,15,15,15);
+      const __m128i opaque        = (3 == bpp) ?
+                                    _mm_setzero_si128() :
+                                    _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+      unsigned int x = 0;
+
+      for ( ; (x + 4) <= width; x += 4)
       {
-         reverse_channels();
-         channel_mode_ = bgr_mode;
+         const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * static_cast<std::size_t>(x)));
+
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(color + bpp * static_cast<std::size_t>(x)),
+                          _mm_or_si128(_mm_shuffle_epi8(pixels,color_shuffle),opaque));
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(alpha + bpp * static_cast<std::size_t>(x)),
+                          _mm_shuffle_epi8(pixels,alpha_shuffle));
       }
+
+      return x;
    }
 
-   inline void reverse()
+   __attribute__((target("ssse3")))
+   inline unsigned int deinterleave_row_ssse3(const unsigned char* src, unsigned char* const planes[],
+                                              const unsigned int bpp, const unsigned int width)
    {
-      unsigned char* itr1 = data_;
-      unsigned char* itr2 = (data_ + length_) - bytes_per_pixel_;
+      // Sixteen pixels per step, 3 or 4 bytes each.
+      unsigned int x = 0;
 
-      while (itr1 < itr2)
+      if (3 == bpp)
       {
-         for (std::size_t i = 0; i < bytes_per_pixel_; ++i)
+         const __m128i m00 = _mm_setr_epi8( 0, 3, 6, 9,12,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+         const __m128i m01 = _mm_setr_epi8(-1,-1,-1,-1,-1,-1, 2, 5, 8,11,14,-1,-1,-1,-1,-1);
+         const __m128i m02 = _mm_setr_epi8(-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, 1, 4, 7,10,13);
+         const __m128i m10 = _mm_setr_epi8( 1, 4, 7,10,13,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+         const __m128i m11 = _mm_setr_epi8(-1,-1,-1,-1,-1, 0, 3, 6, 9,12,15,-1,-1,-1,-1,-1);
+         const __m128i m12 = _mm_setr_epi8(-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, 2, 5, 8,11,14);
+         const __m128i m20 = _mm_setr_epi8( 2, 5, 8,11,14,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+         const __m128i m21 = _mm_setr_epi8(-1,-1,-1,-1,-1, 1, 4, 7,10,13,-1,-1,-1,-1,-1,-1);
+         const __m128i m22 = _mm_setr_epi8(-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, 0, 3, 6, 9,12,15);
+
+         for ( ; (x + 16) <= width; x += 16, src += 48)
          {
-            unsigned char* citr1 = itr1 + i;
-            unsigned char* citr2 = itr2 + i;
-            unsigned char tmp = *citr1;
-            *citr1 = *citr2;
-            *citr2 = tmp;
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src +  0));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[0] + x),
+                             _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a,m00),_mm_shuffle_epi8(b,m01)),_mm_shuffle_epi8(c,m02)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[1] + x),
+                             _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a,m10),_mm_shuffle_epi8(b,m11)),_mm_shuffle_epi8(c,m12)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[2] + x),
+                             _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a,m20),_mm_shuffle_epi8(b,m21)),_mm_shuffle_epi8(c,m22)));
          }
-
-         itr1 += bytes_per_pixel_;
-         itr2 -= bytes_per_pixel_;
       }
-   }
-
-   inline void horizontal_flip()
-   {
-      for (unsigned int y = 0; y < height_; ++y)
+      else if (4 == bpp)
       {
-         unsigned char* itr1 = row(y);
-         unsigned char* itr2 = itr1 + row_increment_ - bytes_per_pixel_;
+         // Group each pixel's bytes by channel, then transpose the 32-bit groups.
+         const __m128i group = _mm_setr_epi8(0,4,8,12,1,5,9,13,2,6,10,14,3,7,11,15);
 
-         while (itr1 < itr2)
+         for ( ; (x + 16) <= width; x += 16, src += 64)
          {
-            for (unsigned int i = 0; i < bytes_per_pixel_; ++i)
-            {
-               unsigned char* p1 = (itr1 + i);
-               unsigned char* p2 = (itr2 + i);
-               unsigned char tmp = *p1;
-               *p1 = *p2;
-               *p2 = tmp;
-            }
-
-            itr1 += bytes_per_pixel_;
-            itr2 -= bytes_per_pixel_;
+            const __m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src +  0)),group);
+            const __m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16)),group);
+            const __m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32)),group);
+            const __m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48)),group);
+
+            const __m128i t0 = _mm_unpacklo_epi32(v0,v1);
+            const __m128i t1 = _mm_unpackhi_epi32(v0,v1);
+            const __m128i t2 = _mm_unpacklo_epi32(v2,v3);
+            const __m128i t3 = _mm_unpackhi_epi32(v2,v3);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[0] + x),_mm_unpacklo_epi64(t0,t2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[1] + x),_mm_unpackhi_epi64(t0,t2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[2] + x),_mm_unpacklo_epi64(t1,t3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[3] + x),_mm_unpackhi_epi64(t1,t3));
          }
       }
+
+      return x;
    }
 
-   inline void vertical_flip()
+   __attribute__((target("ssse3")))
+   inline unsigned int interleave_row_ssse3(const unsigned char* const planes[], unsigned char* dst,
+                                            const unsigned int bpp, const unsigned int width)
    {
-      for (unsigned int y = 0; y < (height_ / 2); ++y)
-      {
-         unsigned char* itr1 = row(y);
-         unsigned char* itr2 = row(height_ - y - 1);
+      unsigned int x = 0;
 
-         for (std::size_t x = 0; x < row_increment_; ++x)
+      if (3 == bpp)
+      {
+         const __m128i m00 = _mm_setr_epi8( 0,-1,-1, 1,-1,-1, 2,-1,-1, 3,-1,-1, 4,-1,-1, 5);
+         const __m128i m01 = _mm_setr_epi8(-1, 0,-1,-1, 1,-1,-1, 2,-1,-1, 3,-1,-1, 4,-1,-1);
+         const __m128i m02 = _mm_setr_epi8(-1,-1, 0,-1,-1, 1,-1,-1, 2,-1,-1, 3,-1,-1, 4,-1);
+         const __m128i m10 = _mm_setr_epi8(-1,-1, 6,-1,-1, 7,-1,-1, 8,-1,-1, 9,-1,-1,10,-1);
+         const __m128i m11 = _mm_setr_epi8( 5,-1,-1, 6,-1,-1, 7,-1,-1, 8,-1,-1, 9,-1,-1,10);
+         const __m128i m12 = _mm_setr_epi8(-1, 5,-1,-1, 6,-1,-1, 7,-1,-1, 8,-1,-1, 9,-1,-1);
+         const __m128i m20 = _mm_setr_epi8(-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1,-1);
+         const __m128i m21 = _mm_setr_epi8(-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1);
+         const __m128i m22 = _mm_setr_epi8(10,-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15);
+
+         for ( ; (x + 16) <= width; x += 16, dst += 48)
          {
-            unsigned char tmp = *(itr1 + x);
-            *(itr1 + x) = *(itr2 + x);
-            *(itr2 + x) = tmp;
+            const __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[0] + x));
+            const __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[1] + x));
+            const __m128i c2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[2] + x));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst +  0),
+                             _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(c0,m00),_mm_shuffle_epi8(c1,m01)),_mm_shuffle_epi8(c2,m02)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16),
+                             _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(c0,m10),_mm_shuffle_epi8(c1,m11)),_mm_shuffle_epi8(c2,m12)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32),
+                             _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(c0,m20),_mm_shuffle_epi8(c1,m21)),_mm_shuffle_epi8(c2,m22)));
          }
       }
-   }
-
-   inline void export_color_plane(const color_plane color, unsigned char* image)
-   {
-      for (unsigned char* itr = (data_ + offset(color)); itr < (data_ + length_); ++image, itr += bytes_per_pixel_)
+      else if (4 == bpp)
       {
-         (*image) = (*itr);
+         for ( ; (x + 16) <= width; x += 16, dst += 64)
+         {
+            const __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[0] + x));
+            const __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[1] + x));
+            const __m128i c2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[2] + x));
+            const __m128i c3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[3] + x));
+
+            const __m128i t0 = _mm_unpacklo_epi8(c0,c1);
+            const __m128i t1 = _mm_unpackhi_epi8(c0,c1);
+            const __m128i t2 = _mm_unpacklo_epi8(c2,c3);
+            const __m128i t3 = _mm_unpackhi_epi8(c2,c3);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst +  0),_mm_unpacklo_epi16(t0,t2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16),_mm_unpackhi_epi16(t0,t2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32),_mm_unpacklo_epi16(t1,t3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 48),_mm_unpackhi_epi16(t1,t3));
+         }
       }
+
+      return x;
    }
 
-   inline void export_color_plane(const color_plane color, bitmap_image& image)
+   /*
+      Channel conversion kernels, eight pixels per step. The first three
+      bytes of each 3 or 4 byte pixel are gathered into one 8 byte group
+      per channel (and scattered back, a fourth byte being kept), then
+      widened to float or double and scaled, or scaled, biased, clamped
+      and truncated on the way back. Truncation keeps the low byte of
+      the 32-bit integer, as a scalar cast does.
+   */
+
+   __attribute__((target("ssse3")))
+   inline void load_channels8(const unsigned char* src, const unsigned int bpp, __m128i channels[3])
    {
-      if (
-           (width_  != image.width_ ) ||
-           (height_ != image.height_)
-         )
+      const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+
+      if (3 == bpp)
       {
-         image.setwidth_height(width_,height_);
+         const __m128i hi = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 16));
+
+         channels[0] = _mm_or_si128(_mm_shuffle_epi8(lo,_mm_setr_epi8( 0, 3, 6, 9,12,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1)),
+                                    _mm_shuffle_epi8(hi,_mm_setr_epi8(-1,-1,-1,-1,-1,-1, 2, 5,-1,-1,-1,-1,-1,-1,-1,-1)));
+         channels[1] = _mm_or_si128(_mm_shuffle_epi8(lo,_mm_setr_epi8( 1, 4, 7,10,13,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1)),
+                                    _mm_shuffle_epi8(hi,_mm_setr_epi8(-1,-1,-1,-1,-1, 0, 3, 6,-1,-1,-1,-1,-1,-1,-1,-1)));
+         channels[2] = _mm_or_si128(_mm_shuffle_epi8(lo,_mm_setr_epi8( 2, 5, 8,11,14,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1)),
+                                    _mm_shuffle_epi8(hi,_mm_setr_epi8(-1,-1,-1,-1,-1, 1, 4, 7,-1,-1,-1,-1,-1,-1,-1,-1)));
       }
+      else
+      {
+         const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
 
-      image.clear();
+         const __m128i group = _mm_setr_epi8(0,4,8,12,1,5,9,13,2,6,10,14,3,7,11,15);
 
-      unsigned char* itr1     = (data_ + offset(color));
-      unsigned char* itr1_end = (data_ + length_);
-      unsigned char* itr2     = (image.data_ + offset(color));
+         // Both halves grouped by channel, 4 bytes each, then paired up.
+         const __m128i a = _mm_shuffle_epi8(lo,group);
+         const __m128i b = _mm_shuffle_epi8(hi,group);
 
-      while (itr1 < itr1_end)
-      {
-         (*itr2) = (*itr1);
-         itr1 += bytes_per_pixel_;
-         itr2 += bytes_per_pixel_;
+         channels[0] = _mm_unpacklo_epi32(a,b);
+         channels[1] = _mm_srli_si128(channels[0],8);
+         channels[2] = _mm_unpackhi_epi32(a,b);
       }
    }
 
-   inline void export_response_image(const color_plane color, double* response_image)
+   __attribute__((target("ssse3")))
+   inline void store_channels8(const __m128i channels[3], unsigned char* dst, const unsigned int bpp)
    {
-      for (unsigned char* itr = (data_ + offset(color)); itr < (data_ + length_); ++response_image, itr += bytes_per_pixel_)
+      const __m128i x = _mm_unpacklo_epi64(channels[0],channels[1]);
+      const __m128i y = channels[2];
+
+      if (3 == bpp)
       {
-         (*response_image) = (1.0 * (*itr)) / 256.0;
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                          _mm_or_si128(_mm_shuffle_epi8(x,_mm_setr_epi8( 0, 8,-1, 1, 9,-1, 2,10,-1, 3,11,-1, 4,12,-1, 5)),
+                                       _mm_shuffle_epi8(y,_mm_setr_epi8(-1,-1, 0,-1,-1, 1,-1,-1, 2,-1,-1, 3,-1,-1, 4,-1))));
+         _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 16),
+                          _mm_or_si128(_mm_shuffle_epi8(x,_mm_setr_epi8(13,-1, 6,14,-1, 7,15,-1,-1,-1,-1,-1,-1,-1,-1,-1)),
+                                       _mm_shuffle_epi8(y,_mm_setr_epi8(-1, 5,-1,-1, 6,-1,-1, 7,-1,-1,-1,-1,-1,-1,-1,-1))));
       }
-   }
-
-   inline void export_gray_scale_response_image(double* response_image)
-   {
-      for (unsigned char* itr = data_; itr < (data_ + length_); itr += bytes_per_pixel_)
+      else
       {
-         unsigned char gray_value = static_cast<unsigned char>((0.299 * (*(itr + 2))) +
-                                                               (0.587 * (*(itr + 1))) +
-                                                               (0.114 * (*(itr + 0))));
-         (*response_image) = (1.0 * gray_value) / 256.0;
+         const __m128i keep = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+         __m128i* itr = reinterpret_cast<__m128i*>(dst);
+
+         _mm_storeu_si128(itr,
+                          _mm_or_si128(_mm_and_si128(_mm_loadu_si128(itr),keep),
+                                       _mm_or_si128(_mm_shuffle_epi8(x,_mm_setr_epi8( 0, 8,-1,-1, 1, 9,-1,-1, 2,10,-1,-1, 3,11,-1,-1)),
+                                                    _mm_shuffle_epi8(y,_mm_setr_epi8(-1,-1, 0,-1,-1,-1, 1,-1,-1,-1, 2,-1,-1,-1, 3,-1)))));
+         _mm_storeu_si128(itr + 1,
+                          _mm_or_si128(_mm_and_si128(_mm_loadu_si128(itr + 1),keep),
+                                       _mm_or_si128(_mm_shuffle_epi8(x,_mm_setr_epi8( 4,12,-1,-1, 5,13,-1,-1, 6,14,-1,-1, 7,15,-1,-1)),
+                                                    _mm_shuffle_epi8(y,_mm_setr_epi8(-1,-1, 4,-1,-1,-1, 5,-1,-1,-1, 6,-1,-1,-1, 7,-1)))));
       }
    }
 
-   inline void export_rgb(double* red, double* green, double* blue) const
+   __attribute__((target("ssse3")))
+   inline unsigned int bytes_to_planes_ssse3(const unsigned char* src, const unsigned int bpp, const unsigned int width,
+                                             unsigned char* const planes[3])
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      unsigned int x = 0;
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
+      for ( ; (x + 8) <= width; x += 8, src += 8 * bpp)
       {
-         (*blue)  = (1.0 * (*(itr++))) / 256.0;
-         (*green) = (1.0 * (*(itr++))) / 256.0;
-         (*red)   = (1.0 * (*(itr++))) / 256.0;
-      }
-   }
+         __m128i channels[3];
 
-   inline void export_rgb(float* red, float* green, float* blue) const
-   {
-      if (bgr_mode != channel_mode_)
-         return;
+         load_channels8(src,bpp,channels);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
-      {
-         (*blue)  = (1.0f * (*(itr++))) / 256.0f;
-         (*green) = (1.0f * (*(itr++))) / 256.0f;
-         (*red)   = (1.0f * (*(itr++))) / 256.0f;
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(planes[c] + x),channels[c]);
+         }
       }
+
+      return x;
    }
 
-   inline void export_rgb(unsigned char* red, unsigned char* green, unsigned char* blue) const
+   __attribute__((target("ssse3")))
+   inline unsigned int planes_to_bytes_ssse3(const unsigned char* const planes[3], unsigned char* dst,
+                                             const unsigned int bpp, const unsigned int width)
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      unsigned int x = 0;
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
+      for ( ; (x + 8) <= width; x += 8, dst += 8 * bpp)
       {
-         (*blue)  = *(itr++);
-         (*green) = *(itr++);
-         (*red)   = *(itr++);
+         __m128i channels[3];
+
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            channels[c] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(planes[c] + x));
+         }
+
+         store_channels8(channels,dst,bpp);
       }
+
+      return x;
    }
 
-   inline void export_ycbcr(double* y, double* cb, double* cr)
+   __attribute__((target("sse4.1")))
+   inline unsigned int bytes_to_planes_sse41(const unsigned char* src, const unsigned int bpp, const unsigned int width,
+                                             float* const planes[3], const float scale)
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      const __m128 s = _mm_set1_ps(scale);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++y, ++cb, ++cr)
+      unsigned int x = 0;
+
+      for ( ; (x + 8) <= width; x += 8, src += 8 * bpp)
       {
-         double blue  = (1.0 * (*(itr++)));
-         double green = (1.0 * (*(itr++)));
-         double red   = (1.0 * (*(itr++)));
+         __m128i channels[3];
+
+         load_channels8(src,bpp,channels);
 
-         ( *y) = clamp<double>( 16.0 + (1.0/256.0) * (  65.738 * red + 129.057 * green +  25.064 * blue),1.0,254);
-         (*cb) = clamp<double>(128.0 + (1.0/256.0) * (- 37.945 * red -  74.494 * green + 112.439 * blue),1.0,254);
-         (*cr) = clamp<double>(128.0 + (1.0/256.0) * ( 112.439 * red -  94.154 * green -  18.285 * blue),1.0,254);
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            _mm_storeu_ps(planes[c] + x    ,_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(channels[c]                 )),s));
+            _mm_storeu_ps(planes[c] + x + 4,_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(channels[c],4))),s));
+         }
       }
+
+      return x;
    }
 
-   inline void export_rgb_normal(double* red, double* green, double* blue) const
+   __attribute__((target("sse4.1")))
+   inline unsigned int bytes_to_planes_sse41(const unsigned char* src, const unsigned int bpp, const unsigned int width,
+                                             double* const planes[3], const double scale)
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      const __m128d s = _mm_set1_pd(scale);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
+      unsigned int x = 0;
+
+      for ( ; (x + 8) <= width; x += 8, src += 8 * bpp)
       {
-         (*blue)  = (1.0 * (*(itr++)));
-         (*green) = (1.0 * (*(itr++)));
-         (*red)   = (1.0 * (*(itr++)));
-      }
-   }
+         __m128i channels[3];
 
-   inline void export_rgb_normal(float* red, float* green, float* blue) const
-   {
-      if (bgr_mode != channel_mode_)
-         return;
+         load_channels8(src,bpp,channels);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
-      {
-         (*blue)  = (1.0f * (*(itr++)));
-         (*green) = (1.0f * (*(itr++)));
-         (*red)   = (1.0f * (*(itr++)));
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            const __m128i lo = _mm_cvtepu8_epi32(channels[c]);
+            const __m128i hi = _mm_cvtepu8_epi32(_mm_srli_si128(channels[c],4));
+
+            _mm_storeu_pd(planes[c] + x    ,_mm_mul_pd(_mm_cvtepi32_pd(lo                  ),s));
+            _mm_storeu_pd(planes[c] + x + 2,_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(lo,8)),s));
+            _mm_storeu_pd(planes[c] + x + 4,_mm_mul_pd(_mm_cvtepi32_pd(hi                  ),s));
+            _mm_storeu_pd(planes[c] + x + 6,_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(hi,8)),s));
+         }
       }
+
+      return x;
    }
 
-   inline void import_rgb(double* red, double* green, double* blue)
+   __attribute__((target("avx2")))
+   inline unsigned int bytes_to_planes_avx2(const unsigned char* src, const unsigned int bpp, const unsigned int width,
+                                            float* const planes[3], const float scale)
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      const __m256 s = _mm256_set1_ps(scale);
+
+      unsigned int x = 0;
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
+      for ( ; (x + 8) <= width; x += 8, src += 8 * bpp)
       {
-         *(itr++) = static_cast<unsigned char>(256.0 * (*blue ));
-         *(itr++) = static_cast<unsigned char>(256.0 * (*green));
-         *(itr++) = static_cast<unsigned char>(256.0 * (*red  ));
-      }
-   }
+         __m128i channels[3];
 
-   inline void import_rgb(float* red, float* green, float* blue)
-   {
-      if (bgr_mode != channel_mode_)
-         return;
+         load_channels8(src,bpp,channels);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
-      {
-         *(itr++) = static_cast<unsigned char>(256.0f * (*blue ));
-         *(itr++) = static_cast<unsigned char>(256.0f * (*green));
-         *(itr++) = static_cast<unsigned char>(256.0f * (*red  ));
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            _mm256_storeu_ps(planes[c] + x,_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(channels[c])),s));
+         }
       }
+
+      return x;
    }
 
-   inline void import_rgb(unsigned char* red, unsigned char* green, unsigned char* blue)
+   __attribute__((target("avx2")))
+   inline unsigned int bytes_to_planes_avx2(const unsigned char* src, const unsigned int bpp, const unsigned int width,
+                                            double* const planes[3], const double scale)
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      const __m256d s = _mm256_set1_pd(scale);
+
+      unsigned int x = 0;
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
+      for ( ; (x + 8) <= width; x += 8, src += 8 * bpp)
       {
-         *(itr++) = (*blue );
-         *(itr++) = (*green);
-         *(itr++) = (*red  );
+         __m128i channels[3];
+
+         load_channels8(src,bpp,channels);
+
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            _mm256_storeu_pd(planes[c] + x    ,_mm256_mul_pd(_mm256_cvtepi32_pd(_mm_cvtepu8_epi32(channels[c]                 )),s));
+            _mm256_storeu_pd(planes[c] + x + 4,_mm256_mul_pd(_mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(channels[c],4))),s));
+         }
       }
+
+      return x;
    }
 
-   inline void import_ycbcr(double* y, double* cb, double* cr)
+   __attribute__((target("sse4.1")))
+   inline unsigned int planes_to_bytes_sse41(const float* const planes[3], unsigned char* dst,
+                                             const unsigned int bpp, const unsigned int width,
+                                             const float scale, const float bias, const bool clamp)
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      const __m128  s    = _mm_set1_ps(scale);
+      const __m128  b    = _mm_set1_ps(bias );
+      const __m128  lo   = _mm_setzero_ps();
+      const __m128  hi   = _mm_set1_ps(255.0f);
+      const __m128i mask = _mm_set1_epi32(0xFF);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++y, ++cb, ++cr)
+      unsigned int x = 0;
+
+      for ( ; (x + 8) <= width; x += 8, dst += 8 * bpp)
       {
-         double y_  =  (*y);
-         double cb_ = (*cb);
-         double cr_ = (*cr);
+         __m128i channels[3];
+
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            __m128 v0 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(planes[c] + x    ),s),b);
+            __m128 v1 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(planes[c] + x + 4),s),b);
+
+            if (clamp)
+            {
+               v0 = _mm_min_ps(_mm_max_ps(v0,lo),hi);
+               v1 = _mm_min_ps(_mm_max_ps(v1,lo),hi);
+            }
+
+            const __m128i i0 = _mm_and_si128(_mm_cvttps_epi32(v0),mask);
+            const __m128i i1 = _mm_and_si128(_mm_cvttps_epi32(v1),mask);
+
+            const __m128i i16 = _mm_packus_epi32(i0,i1);
 
-         *(itr++) = static_cast<unsigned char>(clamp((298.082 * y_ + 516.412 * cb_                 ) / 256.0 - 276.836,0.0,255.0));
-         *(itr++) = static_cast<unsigned char>(clamp((298.082 * y_ - 100.291 * cb_ - 208.120 * cr_ ) / 256.0 + 135.576,0.0,255.0));
-         *(itr++) = static_cast<unsigned char>(clamp((298.082 * y_                 + 408.583 * cr_ ) / 256.0 - 222.921,0.0,255.0));
+            channels[c] = _mm_packus_epi16(i16,i16);
+         }
+
+         store_channels8(channels,dst,bpp);
       }
+
+      return x;
    }
 
-   inline void import_rgb_clamped(double* red, double* green, double* blue)
+   __attribute__((target("sse4.1")))
+   inline unsigned int planes_to_bytes_sse41(const double* const planes[3], unsigned char* dst,
+                                             const unsigned int bpp, const unsigned int width,
+                                             const double scale, const double bias, const bool clamp)
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      const __m128d s    = _mm_set1_pd(scale);
+      const __m128d b    = _mm_set1_pd(bias );
+      const __m128d lo   = _mm_setzero_pd();
+      const __m128d hi   = _mm_set1_pd(255.0);
+      const __m128i mask = _mm_set1_epi32(0xFF);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
+      unsigned int x = 0;
+
+      for ( ; (x + 8) <= width; x += 8, dst += 8 * bpp)
       {
-         *(itr++) = static_cast<unsigned char>(clamp<double>(256.0 * (*blue ),0.0,255.0));
-         *(itr++) = static_cast<unsigned char>(clamp<double>(256.0 * (*green),0.0,255.0));
-         *(itr++) = static_cast<unsigned char>(clamp<double>(256.0 * (*red  ),0.0,255.0));
-      }
-   }
+         __m128i channels[3];
 
-   inline void import_rgb_clamped(float* red, float* green, float* blue)
-   {
-      if (bgr_mode != channel_mode_)
-         return;
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            __m128i quarters[4];
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
-      {
-         *(itr++) = static_cast<unsigned char>(clamp<double>(256.0f * (*blue ),0.0,255.0));
-         *(itr++) = static_cast<unsigned char>(clamp<double>(256.0f * (*green),0.0,255.0));
-         *(itr++) = static_cast<unsigned char>(clamp<double>(256.0f * (*red  ),0.0,255.0));
-      }
-   }
+            for (unsigned int q = 0; q < 4; ++q)
+            {
+               __m128d v = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(planes[c] + x + 2 * q),s),b);
 
-   inline void import_rgb_normal(double* red, double* green, double* blue)
-   {
-      if (bgr_mode != channel_mode_)
-         return;
+               if (clamp)
+               {
+                  v = _mm_min_pd(_mm_max_pd(v,lo),hi);
+               }
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
-      {
-         *(itr++) = static_cast<unsigned char>(*blue );
-         *(itr++) = static_cast<unsigned char>(*green);
-         *(itr++) = static_cast<unsigned char>(*red  );
+               quarters[q] = _mm_cvttpd_epi32(v);
+            }
+
+            const __m128i i0 = _mm_and_si128(_mm_unpacklo_epi64(quarters[0],quarters[1]),mask);
+            const __m128i i1 = _mm_and_si128(_mm_unpacklo_epi64(quarters[2],quarters[3]),mask);
+
+            const __m128i i16 = _mm_packus_epi32(i0,i1);
+
+            channels[c] = _mm_packus_epi16(i16,i16);
+         }
+
+         store_channels8(channels,dst,bpp);
       }
+
+      return x;
    }
 
-   inline void import_rgb_normal(float* red, float* green, float* blue)
+   __attribute__((target("avx2")))
+   inline unsigned int planes_to_bytes_avx2(const float* const planes[3], unsigned char* dst,
+                                            const unsigned int bpp, const unsigned int width,
+                                            const float scale, const float bias, const bool clamp)
    {
-      if (bgr_mode != channel_mode_)
-         return;
+      const __m256  s    = _mm256_set1_ps(scale);
+      const __m256  b    = _mm256_set1_ps(bias );
+      const __m256  lo   = _mm256_setzero_ps();
+      const __m256  hi   = _mm256_set1_ps(255.0f);
+      const __m256i mask = _mm256_set1_epi32(0xFF);
+
+      unsigned int x = 0;
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); ++red, ++green, ++blue)
+      for ( ; (x + 8) <= width; x += 8, dst += 8 * bpp)
       {
-         *(itr++) = static_cast<unsigned char>(*blue );
-         *(itr++) = static_cast<unsigned char>(*green);
-         *(itr++) = static_cast<unsigned char>(*red  );
+         __m128i channels[3];
+
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(planes[c] + x),s),b);
+
+            if (clamp)
+            {
+               v = _mm256_min_ps(_mm256_max_ps(v,lo),hi);
+            }
+
+            const __m256i i32 = _mm256_and_si256(_mm256_cvttps_epi32(v),mask);
+            const __m128i i16 = _mm_packus_epi32(_mm256_castsi256_si128(i32),_mm256_extracti128_si256(i32,1));
+
+            channels[c] = _mm_packus_epi16(i16,i16);
+         }
+
+         store_channels8(channels,dst,bpp);
       }
+
+      return x;
    }
 
-   inline void subsample(bitmap_image& dest)
+   __attribute__((target("avx2")))
+   inline unsigned int planes_to_bytes_avx2(const double* const planes[3], unsigned char* dst,
+                                            const unsigned int bpp, const unsigned int width,
+                                            const double scale, const double bias, const bool clamp)
    {
-      /*
-         Half sub-sample of original image.
-      */
-      unsigned int w = 0;
-      unsigned int h = 0;
+      const __m256d s    = _mm256_set1_pd(scale);
+      const __m256d b    = _mm256_set1_pd(bias );
+      const __m256d lo   = _mm256_setzero_pd();
+      const __m256d hi   = _mm256_set1_pd(255.0);
+      const __m128i mask = _mm_set1_epi32(0xFF);
 
-      bool odd_width = false;
-      bool odd_height = false;
+      unsigned int x = 0;
 
-      if (0 == (width_ % 2))
-         w = width_ / 2;
-      else
+      for ( ; (x + 8) <= width; x += 8, dst += 8 * bpp)
       {
-         w = 1 + (width_ / 2);
-         odd_width = true;
-      }
+         __m128i channels[3];
 
-      if (0 == (height_ % 2))
-         h = height_ / 2;
-      else
-      {
-         h = 1 + (height_ / 2);
-         odd_height = true;
-      }
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            __m256d v0 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(planes[c] + x    ),s),b);
+            __m256d v1 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(planes[c] + x + 4),s),b);
+
+            if (clamp)
+            {
+               v0 = _mm256_min_pd(_mm256_max_pd(v0,lo),hi);
+               v1 = _mm256_min_pd(_mm256_max_pd(v1,lo),hi);
+            }
 
-      unsigned int horizontal_upper = (odd_width)  ? (w - 1) : w;
-      unsigned int vertical_upper   = (odd_height) ? (h - 1) : h;
+            const __m128i i0 = _mm_and_si128(_mm256_cvttpd_epi32(v0),mask);
+            const __m128i i1 = _mm_and_si128(_mm256_cvttpd_epi32(v1),mask);
 
-      dest.setwidth_height(w,h);
-      dest.clear();
+            const __m128i i16 = _mm_packus_epi32(i0,i1);
+
+            channels[c] = _mm_packus_epi16(i16,i16);
+         }
+
+         store_channels8(channels,dst,bpp);
+      }
 
-            unsigned char* s_itr[3];
-      const unsigned char*  itr1[3];
-      const unsigned char*  itr2[3];
+      return x;
+   }
 
-      s_itr[0] = dest.data_ + 0;
-      s_itr[1] = dest.data_ + 1;
-      s_itr[2] = dest.data_ + 2;
+   __attribute__((target("sse4.1")))
+   inline __m128i ycbcr_weigh_sse41(const __m128i c0, const __m128i c1, const __m128i c2,
+                                    const int weights[3], const __m128i bias, const int shift)
+   {
+      // Eight 16-bit lanes per channel, returns the eight results as epi16.
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i w01  = _mm_set1_epi32(static_cast<int>((static_cast<unsigned int>(weights[0]) & 0xFFFF) | (static_cast<unsigned int>(weights[1]) << 16)));
+      const __m128i w2   = _mm_set1_epi32(weights[2] & 0xFFFF);
+      const __m128i count = _mm_cvtsi32_si128(shift);
+
+      const __m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c0,c1),w01),
+                                                     _mm_madd_epi16(_mm_unpacklo_epi16(c2,zero),w2)),bias);
+      const __m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c0,c1),w01),
+                                                     _mm_madd_epi16(_mm_unpackhi_epi16(c2,zero),w2)),bias);
+
+      return _mm_packs_epi32(_mm_sra_epi32(lo,count),_mm_sra_epi32(hi,count));
+   }
 
-      itr1[0] = data_ + 0;
-      itr1[1] = data_ + 1;
-      itr1[2] = data_ + 2;
+   __attribute__((target("sse4.1")))
+   inline unsigned int ycbcr_row_pair_sse41(const unsigned char* row0, const unsigned char* row1,
+                                            const unsigned int bpp, const unsigned int width,
+                                            unsigned char* luma0, unsigned char* luma1,
+                                            unsigned char* cb, unsigned char* cr,
+                                            const ycbcr_coefficients& k, const bool paired)
+   {
+      const int chroma_shift = paired ? 17 : 16;
 
-      itr2[0] = data_ + row_increment_ + 0;
-      itr2[1] = data_ + row_increment_ + 1;
-      itr2[2] = data_ + row_increment_ + 2;
+      const __m128i luma_bias   = _mm_set1_epi32((16 << 15) + (1 << 14));
+      const __m128i chroma_bias = _mm_set1_epi32((128 << chroma_shift) + (1 << (chroma_shift - 1)));
 
-      unsigned int total = 0;
+      unsigned int x = 0;
 
-      for (unsigned int j = 0; j < vertical_upper; ++j)
+      for ( ; (x + 8) <= width; x += 8)
       {
-         for (unsigned int i = 0; i < horizontal_upper; ++i)
+         __m128i p0[3];
+         __m128i p1[3];
+
+         load_channels8(row0 + x * bpp,bpp,p0);
+         load_channels8(row1 + x * bpp,bpp,p1);
+
+         __m128i s[3];
+
+         for (unsigned int c = 0; c < 3; ++c)
          {
-            for (unsigned int k = 0; k < bytes_per_pixel_; s_itr[k] += bytes_per_pixel_, ++k)
-            {
-               total = 0;
-               total += *(itr1[k]); itr1[k] += bytes_per_pixel_;
-               total += *(itr1[k]); itr1[k] += bytes_per_pixel_;
-               total += *(itr2[k]); itr2[k] += bytes_per_pixel_;
-               total += *(itr2[k]); itr2[k] += bytes_per_pixel_;
+            p0[c] = _mm_cvtepu8_epi16(p0[c]);
+            p1[c] = _mm_cvtepu8_epi16(p1[c]);
+            s [c] = _mm_add_epi16(p0[c],p1[c]);
 
-               *(s_itr[k]) = static_cast<unsigned char>(total >> 2);
+            if (paired)
+            {
+               s[c] = _mm_hadd_epi16(s[c],s[c]);
             }
          }
 
-         if (odd_width)
+         const __m128i y0 = ycbcr_weigh_sse41(p0[0],p0[1],p0[2],k.luma,luma_bias,15);
+
+         _mm_storel_epi64(reinterpret_cast<__m128i*>(luma0 + x),_mm_packus_epi16(y0,y0));
+
+         if (luma1)
          {
-            for (unsigned int k = 0; k < bytes_per_pixel_; s_itr[k] += bytes_per_pixel_, ++k)
-            {
-               total = 0;
-               total += *(itr1[k]); itr1[k] += bytes_per_pixel_;
-               total += *(itr2[k]); itr2[k] += bytes_per_pixel_;
+            const __m128i y1 = ycbcr_weigh_sse41(p1[0],p1[1],p1[2],k.luma,luma_bias,15);
 
-               *(s_itr[k]) = static_cast<unsigned char>(total >> 1);
-            }
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(luma1 + x),_mm_packus_epi16(y1,y1));
          }
 
-         for (unsigned int k = 0; k < bytes_per_pixel_; itr1[k] += row_increment_, ++k);
+         const __m128i vb = ycbcr_weigh_sse41(s[0],s[1],s[2],k.cb,chroma_bias,chroma_shift);
+         const __m128i vr = ycbcr_weigh_sse41(s[0],s[1],s[2],k.cr,chroma_bias,chroma_shift);
 
-         if (j != (vertical_upper - 1))
+         const __m128i b8 = _mm_packus_epi16(vb,vb);
+         const __m128i r8 = _mm_packus_epi16(vr,vr);
+
+         if (paired)
+         {
+            const int b4 = _mm_cvtsi128_si32(b8);
+            const int r4 = _mm_cvtsi128_si32(r8);
+
+            std::memcpy(cb + x / 2,&b4,4);
+            std::memcpy(cr + x / 2,&r4,4);
+         }
+         else
          {
-            for (unsigned int k = 0; k < bytes_per_pixel_; itr2[k] += row_increment_, ++k);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(cb + x),b8);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(cr + x),r8);
          }
       }
 
-      if (odd_height)
+      return x;
+   }
+
+   /*
+      Squared difference kernels. Every byte position of a 48 (SSE2)
+      or 96 (AVX2) byte block has its own 32-bit lane, both block sizes
+      are multiples of 3 and 4 so a lane always sees the same channel.
+      Squares are widened with pmaddwd against a zero interleave and
+      the lanes are folded into 64-bit per-channel sums before they
+      can overflow.
+   */
+
+   enum { ssd_flush_interval = 32768 };
+
+   __attribute__((target("sse2")))
+   inline void ssd_accumulate_sse2(const __m128i& a, const __m128i& b, __m128i acc[4])
+   {
+      const __m128i zero = _mm_setzero_si128();
+
+      const __m128i d_lo = _mm_sub_epi16(_mm_unpacklo_epi8(a,zero),_mm_unpacklo_epi8(b,zero));
+      const __m128i d_hi = _mm_sub_epi16(_mm_unpackhi_epi8(a,zero),_mm_unpackhi_epi8(b,zero));
+
+      const __m128i d0 = _mm_unpacklo_epi16(d_lo,zero);
+      const __m128i d1 = _mm_unpackhi_epi16(d_lo,zero);
+      const __m128i d2 = _mm_unpacklo_epi16(d_hi,zero);
+      const __m128i d3 = _mm_unpackhi_epi16(d_hi,zero);
+
+      acc[0] = _mm_add_epi32(acc[0],_mm_madd_epi16(d0,d0));
+      acc[1] = _mm_add_epi32(acc[1],_mm_madd_epi16(d1,d1));
+      acc[2] = _mm_add_epi32(acc[2],_mm_madd_epi16(d2,d2));
+      acc[3] = _mm_add_epi32(acc[3],_mm_madd_epi16(d3,d3));
+   }
+
+   __attribute__((target("sse2")))
+   inline std::size_t channel_ssd_sse2(const unsigned char* a, const unsigned char* b,
+                                       const std::size_t length, const unsigned int bpp,
+                                       unsigned long long sums[4])
+   {
+      std::size_t i = 0;
+
+      while ((i + 48) <= length)
       {
-         for (unsigned int i = 0; i < horizontal_upper; ++i)
-         {
-            for (unsigned int k = 0; k < bytes_per_pixel_; s_itr[k] += bytes_per_pixel_, ++k)
-            {
-               total = 0;
-               total += *(itr1[k]); itr1[k] += bytes_per_pixel_;
-               total += *(itr2[k]); itr2[k] += bytes_per_pixel_;
+         __m128i acc[12];
 
-               *(s_itr[k]) = static_cast<unsigned char>(total >> 1);
-            }
+         for (int k = 0; k < 12; ++k)
+         {
+            acc[k] = _mm_setzero_si128();
          }
 
-         if (odd_width)
+         for (std::size_t n = 0; ((i + 48) <= length) && (n < ssd_flush_interval); i += 48, ++n)
          {
-            for (unsigned int k = 0; k < bytes_per_pixel_; ++k)
+            for (int k = 0; k < 3; ++k)
             {
-               (*(s_itr[k])) = *(itr1[k]);
+               ssd_accumulate_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 16 * k)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 16 * k)),
+                                   acc + 4 * k);
             }
          }
+
+         // acc[4k + j] lane l holds byte position 16k + 4j + l of the block.
+         unsigned int lanes[48];
+
+         for (int k = 0; k < 12; ++k)
+         {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 4 * k),acc[k]);
+         }
+
+         for (unsigned int p = 0; p < 48; ++p)
+         {
+            sums[p % bpp] += lanes[p];
+         }
       }
+
+      return i;
    }
 
-   inline void upsample(bitmap_image& dest)
+   __attribute__((target("avx2")))
+   inline void ssd_accumulate_avx2(const __m256i& a, const __m256i& b, __m256i acc[4])
    {
-      /*
-         2x up-sample of original image.
-      */
-
-      dest.setwidth_height(2 * width_ ,2 * height_);
-      dest.clear();
+      const __m256i zero = _mm256_setzero_si256();
 
-      const unsigned char* s_itr[3];
-            unsigned char*  itr1[3];
-            unsigned char*  itr2[3];
+      const __m256i d_lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(a,zero),_mm256_unpacklo_epi8(b,zero));
+      const __m256i d_hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(a,zero),_mm256_unpackhi_epi8(b,zero));
 
-      s_itr[0] = data_ + 0;
-      s_itr[1] = data_ + 1;
-      s_itr[2] = data_ + 2;
+      const __m256i d0 = _mm256_unpacklo_epi16(d_lo,zero);
+      const __m256i d1 = _mm256_unpackhi_epi16(d_lo,zero);
+      const __m256i d2 = _mm256_unpacklo_epi16(d_hi,zero);
+      const __m256i d3 = _mm256_unpackhi_epi16(d_hi,zero);
 
-      itr1[0] = dest.data_ + 0;
-      itr1[1] = dest.data_ + 1;
-      itr1[2] = dest.data_ + 2;
+      acc[0] = _mm256_add_epi32(acc[0],_mm256_madd_epi16(d0,d0));
+      acc[1] = _mm256_add_epi32(acc[1],_mm256_madd_epi16(d1,d1));
+      acc[2] = _mm256_add_epi32(acc[2],_mm256_madd_epi16(d2,d2));
+      acc[3] = _mm256_add_epi32(acc[3],_mm256_madd_epi16(d3,d3));
+   }
 
-      itr2[0] = dest.data_ + dest.row_increment_ + 0;
-      itr2[1] = dest.data_ + dest.row_increment_ + 1;
-      itr2[2] = dest.data_ + dest.row_increment_ + 2;
+   __attribute__((target("avx2")))
+   inline std::size_t channel_ssd_avx2(const unsigned char* a, const unsigned char* b,
+                                       const std::size_t length, const unsigned int bpp,
+                                       unsigned long long sums[4])
+   {
+      std::size_t i = 0;
 
-      for (unsigned int j = 0; j < height_; ++j)
+      while ((i + 96) <= length)
       {
-         for (unsigned int i = 0; i < width_; ++i)
+         __m256i acc[12];
+
+         for (int k = 0; k < 12; ++k)
          {
-            for (unsigned int k = 0; k < bytes_per_pixel_; s_itr[k] += bytes_per_pixel_, ++k)
-            {
-               *(itr1[k]) = *(s_itr[k]); itr1[k] += bytes_per_pixel_;
-               *(itr1[k]) = *(s_itr[k]); itr1[k] += bytes_per_pixel_;
+            acc[k] = _mm256_setzero_si256();
+         }
 
-               *(itr2[k]) = *(s_itr[k]); itr2[k] += bytes_per_pixel_;
-               *(itr2[k]) = *(s_itr[k]); itr2[k] += bytes_per_pixel_;
+         for (std::size_t n = 0; ((i + 96) <= length) && (n < ssd_flush_interval); i += 96, ++n)
+         {
+            for (int k = 0; k < 3; ++k)
+            {
+               ssd_accumulate_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 32 * k)),
+                                   _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 32 * k)),
+                                   acc + 4 * k);
             }
          }
 
-         for (unsigned int k = 0; k < bytes_per_pixel_; ++k)
+         // acc[4k + j] lane l holds byte position 32k + 4j + l, plus 12 for the high 128-bit lane.
+         unsigned int lanes[96];
+
+         for (int k = 0; k < 12; ++k)
+         {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 8 * k),acc[k]);
+         }
+
+         for (unsigned int k = 0; k < 3; ++k)
          {
-            itr1[k] += dest.row_increment_;
-            itr2[k] += dest.row_increment_;
+            for (unsigned int j = 0; j < 4; ++j)
+            {
+               for (unsigned int l = 0; l < 8; ++l)
+               {
+                  const unsigned int p = 32 * k + 4 * j + ((l < 4) ? l : (12 + l));
+
+                  sums[p % bpp] += lanes[32 * k + 8 * j + l];
+               }
+            }
          }
       }
+
+      return i;
    }
 
-   inline void alpha_blend(const double& alpha, const bitmap_image& image)
+   __attribute__((target("sse2")))
+   inline std::size_t accumulate_squares_sse2(const unsigned char* a, const unsigned char* b,
+                                              unsigned int* sums, const std::size_t length)
    {
-      if (
-           (image.width_  != width_ ) ||
-           (image.height_ != height_)
-         )
-      {
-         return;
-      }
+      const __m128i zero = _mm_setzero_si128();
 
-      if ((alpha < 0.0) || (alpha > 1.0))
+      std::size_t i = 0;
+
+      for ( ; (i + 16) <= length; i += 16)
       {
-         return;
+         const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+         const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+
+         // |a - b| squared fits an unsigned 16-bit lane.
+         const __m128i d    = _mm_or_si128(_mm_subs_epu8(va,vb),_mm_subs_epu8(vb,va));
+         const __m128i d_lo = _mm_unpacklo_epi8(d,zero);
+         const __m128i d_hi = _mm_unpackhi_epi8(d,zero);
+         const __m128i s_lo = _mm_mullo_epi16(d_lo,d_lo);
+         const __m128i s_hi = _mm_mullo_epi16(d_hi,d_hi);
+
+         __m128i* itr = reinterpret_cast<__m128i*>(sums + i);
+
+         _mm_storeu_si128(itr + 0,_mm_add_epi32(_mm_loadu_si128(itr + 0),_mm_unpacklo_epi16(s_lo,zero)));
+         _mm_storeu_si128(itr + 1,_mm_add_epi32(_mm_loadu_si128(itr + 1),_mm_unpackhi_epi16(s_lo,zero)));
+         _mm_storeu_si128(itr + 2,_mm_add_epi32(_mm_loadu_si128(itr + 2),_mm_unpacklo_epi16(s_hi,zero)));
+         _mm_storeu_si128(itr + 3,_mm_add_epi32(_mm_loadu_si128(itr + 3),_mm_unpackhi_epi16(s_hi,zero)));
       }
 
-      unsigned char* itr1     = data_;
-      unsigned char* itr1_end = data_ + length_;
-      unsigned char* itr2     = image.data_;
+      return i;
+   }
 
-      double alpha_compliment = 1.0 - alpha;
+   __attribute__((target("avx2")))
+   inline std::size_t accumulate_squares_avx2(const unsigned char* a, const unsigned char* b,
+                                              unsigned int* sums, const std::size_t length)
+   {
+      std::size_t i = 0;
 
-      while (itr1 != itr1_end)
+      for ( ; (i + 16) <= length; i += 16)
       {
-         *(itr1) = static_cast<unsigned char>((alpha * (*itr2)) + (alpha_compliment * (*itr1)));
-         ++itr1;
-         ++itr2;
+         const __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+         const __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+         const __m256i d  = _mm256_sub_epi16(va,vb);
+         const __m256i sq = _mm256_mullo_epi16(d,d);
+
+         __m256i* itr = reinterpret_cast<__m256i*>(sums + i);
+
+         _mm256_storeu_si256(itr + 0,_mm256_add_epi32(_mm256_loadu_si256(itr + 0),_mm256_cvtepu16_epi32(_mm256_castsi256_si128(sq))));
+         _mm256_storeu_si256(itr + 1,_mm256_add_epi32(_mm256_loadu_si256(itr + 1),_mm256_cvtepu16_epi32(_mm256_extracti128_si256(sq,1))));
       }
+
+      return i;
    }
 
-   inline double psnr(const bitmap_image& image)
+   __attribute__((target("avx2")))
+   inline std::size_t convolve_row_avx2(const unsigned char* src, int* dst, const std::size_t length,
+                                        const unsigned int stride, const int* weights, const unsigned int taps)
    {
-      if (
-           (image.width_  != width_ ) ||
-           (image.height_ != height_)
-         )
+      std::size_t i = 0;
+
+      for ( ; (i + 8) <= length; i += 8)
       {
-         return 0.0;
+         __m256i acc = _mm256_set1_epi32(1 << 9);
+
+         for (unsigned int k = 0; k < taps; ++k)
+         {
+            const __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i + k * stride)));
+
+            acc = _mm256_add_epi32(acc,_mm256_mullo_epi32(v,_mm256_set1_epi32(weights[k])));
+         }
+
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),_mm256_srai_epi32(acc,10));
       }
 
-      unsigned char* itr1 = data_;
-      unsigned char* itr2 = image.data_;
+      return i;
+   }
+
+   __attribute__((target("avx2")))
+   inline std::size_t convolve_column_avx2(const int* const* rows, unsigned char* dst, const std::size_t length,
+                                           const int* weights, const unsigned int taps)
+   {
+      const __m256i order = _mm256_setr_epi32(0,4,0,0,0,0,0,0);
 
-      double mse = 0.0;
+      std::size_t i = 0;
 
-      while (itr1 != (data_ + length_))
+      for ( ; (i + 8) <= length; i += 8)
       {
-         double v = (static_cast<double>(*itr1) - static_cast<double>(*itr2));
+         __m256i acc = _mm256_set1_epi32(1 << 17);
 
-         mse += v * v;
-         ++itr1;
-         ++itr2;
-      }
+         for (unsigned int k = 0; k < taps; ++k)
+         {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[k] + i));
 
-      if (mse <= 0.0000001)
-      {
-         return 1000000.0;
-      }
-      else
-      {
-         mse /= (3.0 * width_ * height_);
-         return 20.0 * std::log10(255.0 / std::sqrt(mse));
+            acc = _mm256_add_epi32(acc,_mm256_mullo_epi32(v,_mm256_set1_epi32(weights[k])));
+         }
+
+         // Saturating packs clamp to 0..255, each 128-bit lane then holds four results in its first dword.
+         const __m256i v16 = _mm256_packs_epi32(_mm256_srai_epi32(acc,18),_mm256_setzero_si256());
+         const __m256i v8  = _mm256_packus_epi16(v16,_mm256_setzero_si256());
+
+         _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i),_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(v8,order)));
       }
+
+      return i;
    }
 
-   inline double psnr(const unsigned int& x,
-                      const unsigned int& y,
-                      const bitmap_image& image)
+   __attribute__((target("ssse3")))
+   inline unsigned int halve_pixels_ssse3(const unsigned char* itr1, const unsigned char* itr2,
+                                          unsigned char* dest, const unsigned int bpp,
+                                          const unsigned int count)
    {
-      if ((x + image.width()) > width_)   { return 0.0; }
-      if ((y + image.height()) > height_) { return 0.0; }
+      /*
+         Four output pixels per step. The even and odd source pixels of
+         each row are gathered apart, then all four are summed as 16-bit
+         lanes. Returns the number of pixels written.
+      */
+
+      const bool rgb = (3 == bpp);
+
+      // Even pixels from bytes [0,16) and [16,32), then the odd pixels.
+      const __m128i even_lo = rgb ? _mm_setr_epi8(0,1,2,6,7,8,12,13,14,-1,-1,-1,-1,-1,-1,-1) : _mm_setr_epi8(0,1,2,3,8,9,10,11,-1,-1,-1,-1,-1,-1,-1,-1);
+      const __m128i even_hi = rgb ? _mm_setr_epi8(-1,-1,-1,-1,-1,-1,-1,-1,-1,2,3,4,-1,-1,-1,-1) : _mm_setr_epi8(-1,-1,-1,-1,-1,-1,-1,-1,0,1,2,3,8,9,10,11);
+      const __m128i odd_lo  = rgb ? _mm_setr_epi8(3,4,5,9,10,11,15,-1,-1,-1,-1,-1,-1,-1,-1,-1) : _mm_setr_epi8(4,5,6,7,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1);
+      const __m128i odd_hi  = rgb ? _mm_setr_epi8(-1,-1,-1,-1,-1,-1,-1,0,1,5,6,7,-1,-1,-1,-1) : _mm_setr_epi8(-1,-1,-1,-1,-1,-1,-1,-1,4,5,6,7,12,13,14,15);
 
-      double mse = 0.0;
+      const __m128i zero = _mm_setzero_si128();
 
-      const unsigned int height = image.height();
-      const unsigned int width  = image.width();
+      const unsigned int step = 8 * bpp;
 
-      for (unsigned int r = 0; r < height; ++r)
+      unsigned int i = 0;
+
+      for (; (i + 4) <= count; i += 4, itr1 += step, itr2 += step, dest += 4 * bpp)
       {
-         unsigned char* itr1       = row(r + y) + x * bytes_per_pixel_;
-         unsigned char* itr1_end   = itr1 + (width * bytes_per_pixel_);
-         const unsigned char* itr2 = image.row(r);
+         const __m128i lo1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr1));
+         const __m128i lo2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr2));
+         const __m128i hi1 = rgb ? _mm_loadl_epi64(reinterpret_cast<const __m128i*>(itr1 + 16)) : _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr1 + 16));
+         const __m128i hi2 = rgb ? _mm_loadl_epi64(reinterpret_cast<const __m128i*>(itr2 + 16)) : _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr2 + 16));
+
+         const __m128i even1 = _mm_or_si128(_mm_shuffle_epi8(lo1,even_lo),_mm_shuffle_epi8(hi1,even_hi));
+         const __m128i even2 = _mm_or_si128(_mm_shuffle_epi8(lo2,even_lo),_mm_shuffle_epi8(hi2,even_hi));
+         const __m128i odd1  = _mm_or_si128(_mm_shuffle_epi8(lo1,odd_lo ),_mm_shuffle_epi8(hi1,odd_hi ));
+         const __m128i odd2  = _mm_or_si128(_mm_shuffle_epi8(lo2,odd_lo ),_mm_shuffle_epi8(hi2,odd_hi ));
+
+         const __m128i sum_lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(even1,zero),_mm_unpacklo_epi8(odd1,zero)),
+                                              _mm_add_epi16(_mm_unpacklo_epi8(even2,zero),_mm_unpacklo_epi8(odd2,zero)));
+         const __m128i sum_hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(even1,zero),_mm_unpackhi_epi8(odd1,zero)),
+                                              _mm_add_epi16(_mm_unpackhi_epi8(even2,zero),_mm_unpackhi_epi8(odd2,zero)));
+
+         const __m128i v = _mm_packus_epi16(_mm_srli_epi16(sum_lo,2),_mm_srli_epi16(sum_hi,2));
 
-         while (itr1 != itr1_end)
+         if (rgb)
          {
-            double v = (static_cast<double>(*itr1) - static_cast<double>(*itr2));
-            mse += v * v;
-            ++itr1;
-            ++itr2;
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dest),v);
+
+            const int tail = _mm_cvtsi128_si32(_mm_srli_si128(v,8));
+
+            std::memcpy(dest + 8,&tail,4);
          }
+         else
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest),v);
       }
 
-      if (mse <= 0.0000001)
+      return i;
+   }
+
+   __attribute__((target("ssse3")))
+   inline void resample_row_ssse3(const unsigned char* src, unsigned char* dst,
+                                  const unsigned int bpp, const unsigned int count,
+                                  const unsigned int* start, const short* weights, const unsigned int taps)
+   {
+      // Two taps per step, the channels of both pixels paired as 16-bit lanes for madd.
+      const __m128i order = (3 == bpp) ?
+                            _mm_setr_epi8(0,-1,3,-1,1,-1,4,-1,2,-1,5,-1,-1,-1,-1,-1) :
+                            _mm_setr_epi8(0,-1,4,-1,1,-1,5,-1,2,-1,6,-1,3,-1,7,-1);
+
+      for (unsigned int x = 0; x < count; ++x, dst += bpp, weights += taps)
       {
-         return 1000000.0;
+         const unsigned char* itr = src + start[x] * bpp;
+
+         __m128i acc = _mm_set1_epi32(1 << 13);
+
+         for (unsigned int k = 0; k < taps; k += 2, itr += 2 * bpp)
+         {
+            const __m128i pair = _mm_shuffle_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(itr)),order);
+            const __m128i w    = _mm_set1_epi32(static_cast<int>(static_cast<unsigned short>(weights[k]) |
+                                                           (static_cast<unsigned int>(static_cast<unsigned short>(weights[k + 1])) << 16)));
+
+            acc = _mm_add_epi32(acc,_mm_madd_epi16(pair,w));
+         }
+
+         const __m128i v16 = _mm_packs_epi32(_mm_srai_epi32(acc,14),acc);
+         const int     v   = _mm_cvtsi128_si32(_mm_packus_epi16(v16,v16));
+
+         std::memcpy(dst,&v,bpp);
       }
-      else
+   }
+   #endif
+
+   inline void gray_row(const unsigned char* src, unsigned char* gray,
+                        const unsigned int width, const unsigned int bpp,
+                        const int w0, const int w1, const int w2)
+   {
+      // gray = (w0 * c0 + w1 * c1 + w2 * c2 + 0.5) >> 15 over the first three bytes of each pixel.
+      unsigned int x = 0;
+
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         x = gray_row_avx2(src,gray,width,bpp,w0,w1,w2);
+      else if (simd_ssse3 <= active_simd_level())
+         x = gray_row_ssse3(src,gray,width,bpp,w0,w1,w2);
+      #endif
+
+      for (const unsigned char* itr = src + static_cast<std::size_t>(x) * bpp; x < width; ++x, itr += bpp)
       {
-         mse /= (3.0 * image.width() * image.height());
-         return 20.0 * std::log10(255.0 / std::sqrt(mse));
+         gray[x] = static_cast<unsigned char>((w0 * itr[0] + w1 * itr[1] + w2 * itr[2] + (1 << 14)) >> 15);
       }
    }
 
-   inline void histogram(const color_plane color, double hist[256])
+   inline void expand_gray_row(const unsigned char* gray, unsigned char* dst,
+                               const unsigned int width, const unsigned int bpp)
    {
-      std::fill(hist,hist + 256,0.0);
+      unsigned int x = 0;
+
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_ssse3 <= active_simd_level())
+         x = expand_gray_row_ssse3(gray,dst,width,bpp);
+      #endif
 
-      for (unsigned char* itr = (data_ + offset(color)); itr < (data_ + length_); itr += bytes_per_pixel_)
+      for (unsigned char* itr = dst + static_cast<std::size_t>(x) * bpp; x < width; ++x, itr += bpp)
       {
-         ++hist[(*itr)];
+         itr[0] = gray[x];
+         itr[1] = gray[x];
+         itr[2] = gray[x];
       }
    }
 
-   inline void histogram_normalized(const color_plane color, double hist[256])
+   inline void blend_row(unsigned char* dst, const unsigned char* src,
+                         const std::size_t length, const int alpha)
    {
-      histogram(color,hist);
+      std::size_t i = 0;
 
-      double* h_itr = hist;
-      const double* h_end = hist + 256;
-      const double pixel_count = static_cast<double>(width_ * height_);
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         i = blend_row_avx2(dst,src,length,alpha);
+      else if (simd_sse2 <= active_simd_level())
+         i = blend_row_sse2(dst,src,length,alpha);
+      #endif
 
-      while (h_end != h_itr)
+      for ( ; i < length; ++i)
       {
-         *(h_itr++) /= pixel_count;
+         dst[i] = static_cast<unsigned char>((alpha * src[i] + (256 - alpha) * dst[i]) >> 8);
       }
    }
 
-   inline unsigned int offset(const color_plane color)
+   inline void blend_row(unsigned char* dst, const unsigned char* src,
+                         const unsigned char* alpha, const std::size_t length)
    {
-      switch (channel_mode_)
-      {
-         case rgb_mode : {
-                            switch (color)
-                            {
-                               case red_plane   : return 0;
-                               case green_plane : return 1;
-                               case blue_plane  : return 2;
-                               default          : return std::numeric_limits<unsigned int>::max();
-                            }
-                         }
+      std::size_t i = 0;
 
-         case bgr_mode : {
-                            switch (color)
-                            {
-                               case red_plane   : return 2;
-                               case green_plane : return 1;
-                               case blue_plane  : return 0;
-                               default          : return std::numeric_limits<unsigned int>::max();
-                            }
-                         }
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         i = blend_row_avx2(dst,src,alpha,length);
+      else if (simd_sse2 <= active_simd_level())
+         i = blend_row_sse2(dst,src,alpha,length);
+      #endif
 
-         default       : return std::numeric_limits<unsigned int>::max();
+      for ( ; i < length; ++i)
+      {
+         const int a = alpha[i] + (alpha[i] >> 7);
+
+         dst[i] = static_cast<unsigned char>((a * src[i] + (256 - a) * dst[i]) >> 8);
       }
    }
 
-   inline void incremental()
+   inline void channel_ssd(const unsigned char* a, const unsigned char* b,
+                           const std::size_t length, const unsigned int bpp,
+                           unsigned long long sums[4])
    {
-      unsigned char current_color = 0;
+      // Adds the squared differences of each channel (byte position modulo bpp) to sums.
+      std::size_t i = 0;
+
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         i = channel_ssd_avx2(a,b,length,bpp,sums);
+      else if (simd_sse2 <= active_simd_level())
+         i = channel_ssd_sse2(a,b,length,bpp,sums);
+      #endif
 
-      for (unsigned char* itr = data_; itr < (data_ + length_);)
+      for (unsigned int c = 0; i < length; ++i, c = (c + 1 == bpp) ? 0 : c + 1)
       {
-         (*itr++) = (current_color);
-         (*itr++) = (current_color);
-         (*itr++) = (current_color);
+         const int d = static_cast<int>(a[i]) - static_cast<int>(b[i]);
 
-         ++current_color;
+         sums[c] += static_cast<unsigned int>(d * d);
       }
    }
 
-private:
-
-   struct bitmap_file_header
+   inline void accumulate_squares(const unsigned char* a, const unsigned char* b,
+                                  unsigned int* sums, const std::size_t length)
    {
-      unsigned short type;
-      unsigned int   size;
-      unsigned short reserved1;
-      unsigned short reserved2;
-      unsigned int   off_bits;
+      // sums[i] += (a[i] - b[i])^2, callers bound the number of rows accumulated.
+      std::size_t i = 0;
 
-      unsigned int struct_size()
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         i = accumulate_squares_avx2(a,b,sums,length);
+      else if (simd_sse2 <= active_simd_level())
+         i = accumulate_squares_sse2(a,b,sums,length);
+      #endif
+
+      for ( ; i < length; ++i)
       {
-         return sizeof(type)      +
-                sizeof(size)      +
-                sizeof(reserved1) +
-                sizeof(reserved2) +
-                sizeof(off_bits);
+         const int d = static_cast<int>(a[i]) - static_cast<int>(b[i]);
+
+         sums[i] += static_cast<unsigned int>(d * d);
       }
-   };
+   }
 
-   struct bitmap_information_header
+   /*
+      Fixed-point convolution with Q14 weights in two steps: rows of
+      bytes to Q4 intermediates, then columns of those back to bytes.
+      Tap k of a row reads src[i + k * stride], stride being the pixel
+      size, so interleaved channels are filtered independently.
+   */
+
+   inline void convolve_row(const unsigned char* src, int* dst, const std::size_t length,
+                            const unsigned int stride, const int* weights, const unsigned int taps)
    {
-      unsigned int   size;
-      unsigned int   width;
-      unsigned int   height;
-      unsigned short planes;
-      unsigned short bit_count;
-      unsigned int   compression;
-      unsigned int   size_image;
-      unsigned int   x_pels_per_meter;
-      unsigned int   y_pels_per_meter;
-      unsigned int   clr_used;
-      unsigned int   clr_important;
+      std::size_t i = 0;
 
-      unsigned int struct_size()
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         i = convolve_row_avx2(src,dst,length,stride,weights,taps);
+      #endif
+
+      for ( ; i < length; ++i)
       {
-         return sizeof(size)             +
-                sizeof(width)            +
-                sizeof(height)           +
-                sizeof(planes)           +
-                sizeof(bit_count)        +
-                sizeof(compression)      +
-                sizeof(size_image)       +
-                sizeof(x_pels_per_meter) +
-                sizeof(y_pels_per_meter) +
-                sizeof(clr_used)         +
-                sizeof(clr_important);
+         int acc = 1 << 9;
+
+         for (unsigned int k = 0; k < taps; ++k)
+         {
+            acc += weights[k] * src[i + k * stride];
+         }
+
+         dst[i] = acc >> 10;
       }
-   };
+   }
 
-   inline bool big_endian()
+   inline void convolve_column(const int* const* rows, unsigned char* dst, const std::size_t length,
+                               const int* weights, const unsigned int taps)
    {
-      unsigned int v = 0x01;
+      std::size_t i = 0;
 
-      return (1 != reinterpret_cast<char*>(&v)[0]);
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         i = convolve_column_avx2(rows,dst,length,weights,taps);
+      #endif
+
+      for ( ; i < length; ++i)
+      {
+         int acc = 1 << 17;
+
+         for (unsigned int k = 0; k < taps; ++k)
+         {
+            acc += weights[k] * rows[k][i];
+         }
+
+         dst[i] = static_cast<unsigned char>(std::min(255,std::max(0,acc >> 18)));
+      }
    }
 
-   inline unsigned short flip(const unsigned short& v)
+   inline void convolve_row(const unsigned char* src, float* dst, const std::size_t length,
+                            const unsigned int stride, const float* weights, const unsigned int taps)
    {
-      return ((v >> 8) | (v << 8));
+      for (std::size_t i = 0; i < length; ++i)
+      {
+         float acc = 0.0f;
+
+         for (unsigned int k = 0; k < taps; ++k)
+         {
+            acc += weights[k] * src[i + k * stride];
+         }
+
+         dst[i] = acc;
+      }
    }
 
-   inline unsigned int flip(const unsigned int& v)
+   inline void convolve_column(const float* const* rows, unsigned char* dst, const std::size_t length,
+                               const float* weights, const unsigned int taps)
    {
-      return (((v & 0xFF000000) >> 0x18) |
-              ((v & 0x000000FF) << 0x18) |
-              ((v & 0x00FF0000) >> 0x08) |
-              ((v & 0x0000FF00) << 0x08));
+      for (std::size_t i = 0; i < length; ++i)
+      {
+         float acc = 0.5f;
+
+         for (unsigned int k = 0; k < taps; ++k)
+         {
+            acc += weights[k] * rows[k][i];
+         }
+
+         dst[i] = static_cast<unsigned char>(std::min(255.0f,std::max(0.0f,acc)));
+      }
    }
 
-   template<typename T>
-   inline void read_from_stream(std::ifstream& stream,T& t)
+   struct resample_table
+   {
+      /*
+         Output pixel i of a resampled line is the sum over k < taps of
+         weights[i * taps + k] * source[start[i] + k], the weights being
+         Q14 and taps even. Sources need taps + 2 pixels of zeros after
+         their end.
+      */
+
+      unsigned int              taps;
+      std::vector<unsigned int> start;
+      std::vector<short>        weights;
+   };
+
+   inline double bilinear_weight(double x)
    {
-      stream.read(reinterpret_cast<char*>(&t),sizeof(T));
+      x = std::fabs(x);
+
+      return (x < 1.0) ? (1.0 - x) : 0.0;
    }
 
-   template<typename T>
-   inline void write_to_stream(std::ofstream& stream,const T& t)
+   inline double bicubic_weight(double x)
    {
-      stream.write(reinterpret_cast<const char*>(&t),sizeof(T));
+      // Keys cubic with a = -0.5
+      const double a = -0.5;
+
+      x = std::fabs(x);
+
+      if (x < 1.0)
+         return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+      else if (x < 2.0)
+         return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+      else
+         return 0.0;
    }
 
-   inline void read_bfh(std::ifstream& stream, bitmap_file_header& bfh)
+   inline double lanczos_weight(double x)
    {
-      read_from_stream(stream,bfh.type);
-      read_from_stream(stream,bfh.size);
-      read_from_stream(stream,bfh.reserved1);
-      read_from_stream(stream,bfh.reserved2);
-      read_from_stream(stream,bfh.off_bits);
+      // Three lobes
+      const double pi = 3.14159265358979323846;
 
-      if (big_endian())
-      {
-         bfh.type      = flip(bfh.type);
-         bfh.size      = flip(bfh.size);
-         bfh.reserved1 = flip(bfh.reserved1);
-         bfh.reserved2 = flip(bfh.reserved2);
-         bfh.off_bits  = flip(bfh.off_bits);
-      }
+      x = std::fabs(x);
+
+      if (x < 1e-8)
+         return 1.0;
+      else if (x >= 3.0)
+         return 0.0;
+
+      return (3.0 * std::sin(pi * x) * std::sin(pi * x / 3.0)) / (pi * pi * x * x);
    }
 
-   inline void write_bfh(std::ofstream& stream, const bitmap_file_header& bfh)
+   inline void build_resample_table(const unsigned int in_size, const unsigned int out_size,
+                                    const double support, double (*kernel)(double),
+                                    resample_table& table)
    {
-      if (big_endian())
-      {
-         write_to_stream(stream,flip(bfh.type     ));
-         write_to_stream(stream,flip(bfh.size     ));
-         write_to_stream(stream,flip(bfh.reserved1));
-         write_to_stream(stream,flip(bfh.reserved2));
-         write_to_stream(stream,flip(bfh.off_bits ));
-      }
-      else
+      // Downscaling widens the kernel by the scale factor, which band-limits the source.
+      const double scale        = static_cast<double>(in_size) / out_size;
+      const double filter_scale = std::max(scale,1.0);
+      const double reach        = support * filter_scale;
+
+      table.taps = 2 * static_cast<unsigned int>(std::ceil(reach)) + 2;
+      table.start.resize(out_size);
+      table.weights.assign(static_cast<std::size_t>(out_size) * table.taps,0);
+
+      std::vector<double> w(table.taps);
+
+      for (unsigned int i = 0; i < out_size; ++i)
       {
-         write_to_stream(stream,bfh.type     );
-         write_to_stream(stream,bfh.size     );
-         write_to_stream(stream,bfh.reserved1);
-         write_to_stream(stream,bfh.reserved2);
-         write_to_stream(stream,bfh.off_bits );
+         const double center = (i + 0.5) * scale;
+
+         const int first = std::max(static_cast<int>(std::floor(center - reach + 0.5)),0);
+         const int last  = std::min(static_cast<int>(std::floor(center + reach + 0.5)),static_cast<int>(in_size));
+         const int count = std::min(last - first,static_cast<int>(table.taps));
+
+         double sum = 0.0;
+
+         for (int k = 0; k < count; ++k)
+         {
+            w[k] = kernel((first + k - center + 0.5) / filter_scale);
+            sum += w[k];
+         }
+
+         short* weights = &table.weights[static_cast<std::size_t>(i) * table.taps];
+
+         int fixed_sum = 0;
+         int largest   = 0;
+
+         for (int k = 0; k < count; ++k)
+         {
+            weights[k] = static_cast<short>(std::floor(((sum != 0.0) ? w[k] / sum : 0.0) * 16384.0 + 0.5));
+
+            fixed_sum += weights[k];
+
+            if (weights[k] > weights[largest])
+               largest = k;
+         }
+
+         // Rounding error goes to the largest weight, flat areas then stay exact.
+         weights[largest] = static_cast<short>(weights[largest] + 16384 - fixed_sum);
+
+         table.start[i] = static_cast<unsigned int>(first);
       }
    }
 
-   inline void read_bih(std::ifstream& stream,bitmap_information_header& bih)
+   inline void resample_row(const unsigned char* src, unsigned char* dst,
+                            const unsigned int bpp, const resample_table& table)
    {
-      read_from_stream(stream,bih.size  );
-      read_from_stream(stream,bih.width );
-      read_from_stream(stream,bih.height);
-      read_from_stream(stream,bih.planes);
-      read_from_stream(stream,bih.bit_count);
-      read_from_stream(stream,bih.compression);
-      read_from_stream(stream,bih.size_image);
-      read_from_stream(stream,bih.x_pels_per_meter);
-      read_from_stream(stream,bih.y_pels_per_meter);
-      read_from_stream(stream,bih.clr_used);
-      read_from_stream(stream,bih.clr_important);
+      const unsigned int count = static_cast<unsigned int>(table.start.size());
 
-      if (big_endian())
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if ((simd_ssse3 <= active_simd_level()) && ((3 == bpp) || (4 == bpp)))
       {
-         bih.size        = flip(bih.size     );
-         bih.width       = flip(bih.width    );
-         bih.height      = flip(bih.height   );
-         bih.planes      = flip(bih.planes   );
-         bih.bit_count   = flip(bih.bit_count);
-         bih.compression = flip(bih.compression);
-         bih.size_image  = flip(bih.size_image);
-         bih.x_pels_per_meter = flip(bih.x_pels_per_meter);
-         bih.y_pels_per_meter = flip(bih.y_pels_per_meter);
-         bih.clr_used = flip(bih.clr_used);
-         bih.clr_important = flip(bih.clr_important);
+         resample_row_ssse3(src,dst,bpp,count,&table.start[0],&table.weights[0],table.taps);
+         return;
+      }
+      #endif
+
+      const short* weights = &table.weights[0];
+
+      for (unsigned int x = 0; x < count; ++x, weights += table.taps)
+      {
+         const unsigned char* itr = src + table.start[x] * bpp;
+
+         for (unsigned int c = 0; c < bpp; ++c, ++dst)
+         {
+            int acc = 1 << 13;
+
+            for (unsigned int k = 0; k < table.taps; ++k)
+            {
+               acc += weights[k] * itr[k * bpp + c];
+            }
+
+            (*dst) = static_cast<unsigned char>(std::min(255,std::max(0,acc >> 14)));
+         }
       }
    }
 
-   inline void write_bih(std::ofstream& stream, const bitmap_information_header& bih)
+   inline void halve_row(const unsigned char* row1, const unsigned char* row2,
+                         unsigned char* dest, const unsigned int bpp,
+                         const unsigned int first, const unsigned int last,
+                         const unsigned int source_width)
    {
-      if (big_endian())
+      /*
+         Pixels [first,last) of the half sized row made from row1 and row2,
+         row2 being null when row1 is the unpaired last row. A trailing
+         unpaired column is averaged vertically only.
+      */
+
+      const unsigned int paired = std::min(last,source_width / 2);
+
+      unsigned int i = first;
+
+      const unsigned char* itr1 = row1 + 2 * i * bpp;
+            unsigned char* itr  = dest +     i * bpp;
+
+      if (row2)
       {
-         write_to_stream(stream,flip(bih.size));
-         write_to_stream(stream,flip(bih.width));
-         write_to_stream(stream,flip(bih.height));
-         write_to_stream(stream,flip(bih.planes));
-         write_to_stream(stream,flip(bih.bit_count));
-         write_to_stream(stream,flip(bih.compression));
-         write_to_stream(stream,flip(bih.size_image));
-         write_to_stream(stream,flip(bih.x_pels_per_meter));
-         write_to_stream(stream,flip(bih.y_pels_per_meter));
-         write_to_stream(stream,flip(bih.clr_used));
-         write_to_stream(stream,flip(bih.clr_important));
+         const unsigned char* itr2 = row2 + 2 * i * bpp;
+
+         #ifdef BITMAP_IMAGE_X86_SIMD
+         if ((simd_ssse3 <= active_simd_level()) && ((3 == bpp) || (4 == bpp)) && (i < paired))
+         {
+            const unsigned int done = halve_pixels_ssse3(itr1,itr2,itr,bpp,paired - i);
+
+            itr1 += 2 * done * bpp;
+            itr2 += 2 * done * bpp;
+            itr  +=     done * bpp;
+            i    +=     done;
+         }
+         #endif
+
+         for (; i < paired; ++i, itr1 += 2 * bpp, itr2 += 2 * bpp)
+         {
+            for (unsigned int k = 0; k < bpp; ++k, ++itr)
+            {
+               (*itr) = static_cast<unsigned char>((itr1[k] + itr1[k + bpp] + itr2[k] + itr2[k + bpp]) >> 2);
+            }
+         }
+
+         if (i < last)
+         {
+            for (unsigned int k = 0; k < bpp; ++k, ++itr)
+            {
+               (*itr) = static_cast<unsigned char>((itr1[k] + itr2[k]) >> 1);
+            }
+         }
       }
       else
       {
-         write_to_stream(stream,bih.size);
-         write_to_stream(stream,bih.width);
-         write_to_stream(stream,bih.height);
-         write_to_stream(stream,bih.planes);
-         write_to_stream(stream,bih.bit_count);
-         write_to_stream(stream,bih.compression);
-         write_to_stream(stream,bih.size_image);
-         write_to_stream(stream,bih.x_pels_per_meter);
-         write_to_stream(stream,bih.y_pels_per_meter);
-         write_to_stream(stream,bih.clr_used);
-         write_to_stream(stream,bih.clr_important);
+         for (; i < paired; ++i, itr1 += 2 * bpp)
+         {
+            for (unsigned int k = 0; k < bpp; ++k, ++itr)
+            {
+               (*itr) = static_cast<unsigned char>((itr1[k] + itr1[k + bpp]) >> 1);
+            }
+         }
+
+         if (i < last)
+         {
+            std::copy(itr1,itr1 + bpp,itr);
+         }
       }
    }
 
-   void create_bitmap()
+   inline void region_ssd(const unsigned char* image1, const std::size_t row_increment1, const unsigned int bpp1,
+                          const unsigned char* image2, const std::size_t row_increment2, const unsigned int bpp2,
+                          const unsigned int width, const unsigned int height,
+                          unsigned long long sums[4])
    {
-      length_        = width_ * height_ * bytes_per_pixel_;
-      row_increment_ = width_ * bytes_per_pixel_;
-
-      if (0 != data_)
+      // Per-channel squared error of two equally sized regions, either may be 24 or 32-bit.
+      for (unsigned int y = 0; y < height; ++y, image1 += row_increment1, image2 += row_increment2)
       {
-         delete[] data_;
+         if (bpp1 == bpp2)
+         {
+            channel_ssd(image1,image2,static_cast<std::size_t>(width) * bpp1,bpp1,sums);
+            continue;
+         }
+
+         const unsigned char* itr1 = image1;
+         const unsigned char* itr2 = image2;
+
+         for (unsigned int x = 0; x < width; ++x, itr1 += bpp1, itr2 += bpp2)
+         {
+            for (unsigned int k = 0; k < 3; ++k)
+            {
+               const int d = static_cast<int>(itr1[k]) - static_cast<int>(itr2[k]);
+
+               sums[k] += static_cast<unsigned int>(d * d);
+            }
+         }
       }
+   }
 
-      data_ = new unsigned char[length_];
+   inline double ssd_to_psnr(const unsigned long long ssd, const double samples)
+   {
+      // Identical inputs report 1000000 rather than infinity.
+      if (0 == ssd)
+         return 1000000.0;
+
+      return 10.0 * std::log10((255.0 * 255.0 * samples) / static_cast<double>(ssd));
    }
 
-   void load_bitmap()
+   struct ssim_sums
    {
-      std::ifstream stream(file_name_.c_str(),std::ios::binary);
+      unsigned int s1;
+      unsigned int s2;
+      unsigned int s11;
+      unsigned int s22;
+      unsigned int s12;
+   };
 
-      if (!stream)
-      {
-         std::cerr << "bitmap_image::load_bitmap() ERROR: bitmap_image - file " << file_name_ << " not found!" << std::endl;
-         return;
-      }
+   inline void ssim_window(const double s1,  const double s2,
+                           const double s11, const double s22,
+                           const double s12, const double n,
+                           double& ssim, double& contrast_structure)
+   {
+      const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+      const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
 
-      bitmap_file_header bfh;
-      bitmap_information_header bih;
+      const double mu1   = s1 / n;
+      const double mu2   = s2 / n;
+      const double var1  = s11 / n - mu1 * mu1;
+      const double var2  = s22 / n - mu2 * mu2;
+      const double covar = s12 / n - mu1 * mu2;
 
-      read_bfh(stream,bfh);
-      read_bih(stream,bih);
+      contrast_structure = (2.0 * covar + c2) / (var1 + var2 + c2);
+      ssim               = contrast_structure * (2.0 * mu1 * mu2 + c1) / (mu1 * mu1 + mu2 * mu2 + c1);
+   }
 
-      if (bfh.type != 19778)
+   inline void ssim_plane(const unsigned char* plane1, const unsigned char* plane2,
+                          const unsigned int width, const unsigned int height,
+                          double& ssim, double& contrast_structure)
+   {
+      /*
+         Mean SSIM and contrast-structure term over 8x8 windows placed
+         every 4 pixels. The pixels are read once, into sums of 4x4
+         blocks, and each window adds up its 2x2 blocks. Planes smaller
+         than a window are treated as a single window.
+      */
+
+      const unsigned int block_width  = width  / 4;
+      const unsigned int block_height = height / 4;
+
+      if ((block_width < 2) || (block_height < 2))
       {
-         stream.close();
-         std::cerr << "bitmap_image::load_bitmap() ERROR: bitmap_image - Invalid type value " << bfh.type << " expected 19778." << std::endl;
+         double s1 = 0.0, s2 = 0.0, s11 = 0.0, s22 = 0.0, s12 = 0.0;
+
+         for (std::size_t i = 0; i < static_cast<std::size_t>(width) * height; ++i)
+         {
+            s1  += plane1[i];
+            s2  += plane2[i];
+            s11 += plane1[i] * plane1[i];
+            s22 += plane2[i] * plane2[i];
+            s12 += plane1[i] * plane2[i];
+         }
+
+         ssim_window(s1,s2,s11,s22,s12,std::max(1.0,static_cast<double>(width) * height),ssim,contrast_structure);
+
          return;
       }
 
-      if (bih.bit_count != 24)
+      std::vector<ssim_sums> previous(block_width);
+      std::vector<ssim_sums> current (block_width);
+
+      double ssim_total = 0.0;
+      double cs_total   = 0.0;
+
+      for (unsigned int by = 0; by < block_height; ++by)
       {
-         stream.close();
-         std::cerr << "bitmap_image::load_bitmap() ERROR: bitmap_image - Invalid bit depth " << bih.bit_count << " expected 24." << std::endl;
+         for (unsigned int bx = 0; bx < block_width; ++bx)
+         {
+            ssim_sums& b = current[bx];
 
-         return;
-      }
+            b.s1 = b.s2 = b.s11 = b.s22 = b.s12 = 0;
+
+            for (unsigned int y = 4 * by; y < (4 * by + 4); ++y)
+            {
+               const unsigned char* itr1 = plane1 + static_cast<std::size_t>(y) * width + 4 * bx;
+               const unsigned char* itr2 = plane2 + static_cast<std::size_t>(y) * width + 4 * bx;
+
+               for (unsigned int x = 0; x < 4; ++x)
+               {
+                  b.s1  += itr1[x];
+                  b.s2  += itr2[x];
+                  b.s11 += itr1[x] * itr1[x];
+                  b.s22 += itr2[x] * itr2[x];
+                  b.s12 += itr1[x] * itr2[x];
+               }
+            }
+         }
 
-      height_ = bih.height;
-      width_  = bih.width;
+         if (by > 0)
+         {
+            for (unsigned int bx = 0; bx + 1 < block_width; ++bx)
+            {
+               const ssim_sums* blocks[] = { &previous[bx], &previous[bx + 1], &current[bx], &current[bx + 1] };
 
-      bytes_per_pixel_ = bih.bit_count >> 3;
+               ssim_sums w = { 0, 0, 0, 0, 0 };
 
-      unsigned int padding = (4 - ((3 * width_) % 4)) % 4;
-      char padding_data[4] = {0,0,0,0};
+               for (int k = 0; k < 4; ++k)
+               {
+                  w.s1  += blocks[k]->s1;
+                  w.s2  += blocks[k]->s2;
+                  w.s11 += blocks[k]->s11;
+                  w.s22 += blocks[k]->s22;
+                  w.s12 += blocks[k]->s12;
+               }
 
-      create_bitmap();
+               double window_ssim = 0.0;
+               double window_cs   = 0.0;
 
-      for (unsigned int i = 0; i < height_; ++i)
-      {
-         unsigned char* data_ptr = row(height_ - i - 1); // read in inverted row order
+               ssim_window(w.s1,w.s2,w.s11,w.s22,w.s12,64.0,window_ssim,window_cs);
 
-         stream.read(reinterpret_cast<char*>(data_ptr),sizeof(char) * bytes_per_pixel_ * width_);
-         stream.read(padding_data,padding);
+               ssim_total += window_ssim;
+               cs_total   += window_cs;
+            }
+         }
+
+         previous.swap(current);
       }
+
+      const double windows = static_cast<double>(block_width - 1) * (block_height - 1);
+
+      ssim               = ssim_total / windows;
+      contrast_structure = cs_total   / windows;
    }
 
-   inline void reverse_channels()
+   inline void half_plane(const unsigned char* plane, const unsigned int width, const unsigned int height,
+                          std::vector<unsigned char>& half)
    {
-      if (3 != bytes_per_pixel_)
-         return;
+      // 2x2 box average, an odd last row or column is dropped.
+      const unsigned int half_width  = width  / 2;
+      const unsigned int half_height = height / 2;
+
+      half.resize(static_cast<std::size_t>(half_width) * half_height);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); itr += bytes_per_pixel_)
+      for (unsigned int y = 0; y < half_height; ++y)
       {
-         unsigned char tmp = *(itr + 0);
+         const unsigned char* itr1 = plane + static_cast<std::size_t>(2 * y) * width;
+         const unsigned char* itr2 = itr1 + width;
+               unsigned char* itr  = &half[0] + static_cast<std::size_t>(y) * half_width;
 
-         *(itr + 0) = *(itr + 2);
-         *(itr + 2) = tmp;
+         for (unsigned int x = 0; x < half_width; ++x, itr1 += 2, itr2 += 2)
+         {
+            itr[x] = static_cast<unsigned char>((itr1[0] + itr1[1] + itr2[0] + itr2[1] + 2) >> 2);
+         }
       }
    }
 
-   template<typename T>
-   inline T clamp(const T& v, const T& lower_range, const T& upper_range)
+   inline void spread_alpha_row(const unsigned char* mask, unsigned char* alpha,
+                                const unsigned int width, const unsigned int bpp)
    {
-      if (v < lower_range)
-          return lower_range;
-      else if (v >  upper_range)
-         return upper_range;
-      else
-         return v;
+      // Repeats each pixel's mask value over all of its bytes.
+      unsigned int x = 0;
+
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_ssse3 <= active_simd_level())
+         x = spread_alpha_row_ssse3(mask,alpha,width,bpp);
+      #endif
+
+      for (unsigned char* itr = alpha + static_cast<std::size_t>(x) * bpp; x < width; ++x)
+      {
+         for (unsigned int k = 0; k < bpp; ++k)
+         {
+            *(itr++) = mask[x];
+         }
+      }
    }
 
-   std::string    file_name_;
-   unsigned char* data_;
-   unsigned int   length_;
-   unsigned int   width_;
-   unsigned int   height_;
-   unsigned int   row_increment_;
-   unsigned int   bytes_per_pixel_;
-   channel_mode   channel_mode_;
-};
+   inline void split_bgra_row(const unsigned char* src, unsigned char* color,
+                              unsigned char* alpha, const unsigned int width,
+                              const unsigned int bpp)
+   {
+      /*
+         Splits 32-bit BGRA pixels into colour bytes laid out for a
+         bpp byte destination (a fourth byte becomes 0xFF) and the
+         pixel's alpha repeated over each of those bytes. Both outputs
+         need 16 bytes of slack past width * bpp.
+      */
+      unsigned int x = 0;
 
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_ssse3 <= active_simd_level())
+         x = split_bgra_row_ssse3(src,color,alpha,width,bpp);
+      #endif
 
-struct rgb_store
-{
-   unsigned char red;
-   unsigned char green;
-   unsigned char blue;
-};
+      for ( ; x < width; ++x)
+      {
+         const unsigned char* itr = src + 4 * static_cast<std::size_t>(x);
 
-inline void rgb_to_ycbcr(const unsigned int& length, double* red, double* green, double* blue,
-                                                     double* y,   double* cb,    double* cr)
-{
-   unsigned int i = 0;
+         for (unsigned int k = 0; k < bpp; ++k)
+         {
+            color[x * bpp + k] = (k < 3) ? itr[k] : 0xFF;
+            alpha[x * bpp + k] = itr[3];
+         }
+      }
+   }
 
-   while (i < length)
+   inline void deinterleave_row(const unsigned char* src, unsigned char* const planes[],
+                                const unsigned int bpp, const unsigned int width)
    {
-      ( *y) =   16.0 + (  65.481 * (*red) +  128.553 * (*green) +  24.966 * (*blue));
-      (*cb) =  128.0 + ( -37.797 * (*red) +  -74.203 * (*green) + 112.000 * (*blue));
-      (*cr) =  128.0 + ( 112.000 * (*red) +  -93.786 * (*green) -  18.214 * (*blue));
+      // Byte k of each pixel goes to planes[k].
+      unsigned int x = 0;
 
-      ++i;
-      ++red; ++green; ++blue;
-      ++y;   ++cb;    ++cr;
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_ssse3 <= active_simd_level())
+         x = deinterleave_row_ssse3(src,planes,bpp,width);
+      #endif
+
+      for (const unsigned char* itr = src + x * bpp; x < width; ++x, itr += bpp)
+      {
+         for (unsigned int k = 0; k < bpp; ++k)
+         {
+            planes[k][x] = itr[k];
+         }
+      }
    }
-}
 
-inline void ycbcr_to_rgb(const unsigned int& length, double* y,   double* cb,    double* cr,
-                                                     double* red, double* green, double* blue)
-{
-   unsigned int i = 0;
+   inline void interleave_row(const unsigned char* const planes[], unsigned char* dst,
+                              const unsigned int bpp, const unsigned int width)
+   {
+      unsigned int x = 0;
 
-   while (i < length)
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_ssse3 <= active_simd_level())
+         x = interleave_row_ssse3(planes,dst,bpp,width);
+      #endif
+
+      for (unsigned char* itr = dst + x * bpp; x < width; ++x, itr += bpp)
+      {
+         for (unsigned int k = 0; k < bpp; ++k)
+         {
+            itr[k] = planes[k][x];
+         }
+      }
+   }
+
+   /*
+      Conversions between the first three bytes of 3 or 4 byte pixels
+      and three separate channel arrays, byte k going to planes[k]. To
+      bytes, each value is scaled, biased, optionally clamped to 0-255,
+      then truncated to its low byte, a fourth pixel byte being kept.
+   */
+
+   inline void bytes_to_planes(const unsigned char* src, const unsigned int bpp, const unsigned int width,
+                               unsigned char* const planes[3])
    {
-      double y_  =  (*y) -  16.0;
-      double cb_ = (*cb) - 128.0;
-      double cr_ = (*cr) - 128.0;
+      unsigned int x = 0;
 
-        (*red) = 0.000456621 * y_                    + 0.00625893 * cr_;
-      (*green) = 0.000456621 * y_ - 0.00153632 * cb_ - 0.00318811 * cr_;
-       (*blue) = 0.000456621 * y_                    + 0.00791071 * cb_;
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_ssse3 <= active_simd_level())
+         x = bytes_to_planes_ssse3(src,bpp,width,planes);
+      #endif
 
-      ++i;
-      ++red; ++green; ++blue;
-      ++y;   ++cb;    ++cr;
+      for (const unsigned char* itr = src + x * bpp; x < width; ++x, itr += bpp)
+      {
+         planes[0][x] = itr[0];
+         planes[1][x] = itr[1];
+         planes[2][x] = itr[2];
+      }
    }
-}
 
-inline void subsample(const unsigned int& width,
-                      const unsigned int& height,
-                      const double* source,
-                      unsigned int& w,
-                      unsigned int& h,
-                      double** dest)
-{
-   /*  Single channel.  */
+   template <typename T>
+   inline void bytes_to_planes(const unsigned char* src, const unsigned int bpp, const unsigned int width,
+                               T* const planes[3], const T scale)
+   {
+      unsigned int x = 0;
 
-   w = 0;
-   h = 0;
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         x = bytes_to_planes_avx2(src,bpp,width,planes,scale);
+      else if (simd_sse41 <= active_simd_level())
+         x = bytes_to_planes_sse41(src,bpp,width,planes,scale);
+      #endif
 
-   bool odd_width = false;
-   bool odd_height = false;
+      for (const unsigned char* itr = src + x * bpp; x < width; ++x, itr += bpp)
+      {
+         planes[0][x] = itr[0] * scale;
+         planes[1][x] = itr[1] * scale;
+         planes[2][x] = itr[2] * scale;
+      }
+   }
 
-   if (0 == (width % 2))
-      w = width / 2;
-   else
+   inline void planes_to_bytes(const unsigned char* const planes[3], unsigned char* dst,
+                               const unsigned int bpp, const unsigned int width)
    {
-      w = 1 + (width / 2);
-      odd_width = true;
+      unsigned int x = 0;
+
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_ssse3 <= active_simd_level())
+         x = planes_to_bytes_ssse3(planes,dst,bpp,width);
+      #endif
+
+      for (unsigned char* itr = dst + x * bpp; x < width; ++x, itr += bpp)
+      {
+         itr[0] = planes[0][x];
+         itr[1] = planes[1][x];
+         itr[2] = planes[2][x];
+      }
    }
 
-   if (0 == (height % 2))
-      h = height / 2;
-   else
+   template <typename T>
+   inline void planes_to_bytes(const T* const planes[3], unsigned char* dst,
+                               const unsigned int bpp, const unsigned int width,
+                               const T scale, const T bias, const bool clamp)
    {
-      h = 1 + (height / 2);
-      odd_height = true;
+      unsigned int x = 0;
+
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_avx2 <= active_simd_level())
+         x = planes_to_bytes_avx2(planes,dst,bpp,width,scale,bias,clamp);
+      else if (simd_sse41 <= active_simd_level())
+         x = planes_to_bytes_sse41(planes,dst,bpp,width,scale,bias,clamp);
+      #endif
+
+      for (unsigned char* itr = dst + x * bpp; x < width; ++x, itr += bpp)
+      {
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            T v = planes[c][x] * scale + bias;
+
+            if (clamp)
+            {
+               v = (v > T(0)) ? std::min(v,T(255)) : T(0);
+            }
+
+            itr[c] = static_cast<unsigned char>(static_cast<int>(v) & 0xFF);
+         }
+      }
    }
 
-   unsigned int horizontal_upper = (odd_width)  ? w - 1 : w;
-   unsigned int vertical_upper   = (odd_height) ? h - 1 : h;
+   inline ycbcr_coefficients make_ycbcr_coefficients(const double kr, const double kb,
+                                                     const unsigned int red, const unsigned int green, const unsigned int blue)
+   {
+      // red, green and blue are the byte positions of the colours within a pixel.
+      const double scale = 32768.0 / 255.0;
 
-   *dest = new double[w * h];
+      ycbcr_coefficients k;
 
-   double* s_itr = *dest;
-   const double* itr1 = source;
-   const double* itr2 = source + width;
+      k.luma[red ] = static_cast<int>(std::floor(219.0 * kr * scale + 0.5));
+      k.luma[blue] = static_cast<int>(std::floor(219.0 * kb * scale + 0.5));
+      k.luma[green] = static_cast<int>(std::floor(219.0 * scale + 0.5)) - k.luma[red] - k.luma[blue];
 
-   for (unsigned int j = 0; j < vertical_upper; ++j)
+      k.cb[blue ] = static_cast<int>(std::floor(112.0 * scale + 0.5));
+      k.cb[red  ] = -static_cast<int>(std::floor(112.0 * kr / (1.0 - kb) * scale + 0.5));
+      k.cb[green] = -k.cb[blue] - k.cb[red];
+
+      k.cr[red  ] = static_cast<int>(std::floor(112.0 * scale + 0.5));
+      k.cr[blue ] = -static_cast<int>(std::floor(112.0 * kb / (1.0 - kr) * scale + 0.5));
+      k.cr[green] = -k.cr[red] - k.cr[blue];
+
+      return k;
+   }
+
+   inline void ycbcr_row_pair(const unsigned char* row0, const unsigned char* row1,
+                              const unsigned int bpp, const unsigned int width,
+                              unsigned char* luma0, unsigned char* luma1,
+                              unsigned char* cb, unsigned char* cr,
+                              const ycbcr_coefficients& k, const bool paired)
    {
-      for (unsigned int i = 0; i < horizontal_upper; ++i, ++s_itr)
+      /*
+         Luma of row0 (and of row1 when luma1 is given), and chroma of the
+         sum of both rows, row1 being row0 again for a single row. Paired
+         chroma also sums horizontal pixel pairs, the last pixel of an
+         odd width being doubled.
+      */
+
+      const int chroma_shift = paired ? 17 : 16;
+      const int luma_bias    = (16 << 15) + (1 << 14);
+      const int chroma_bias  = (128 << chroma_shift) + (1 << (chroma_shift - 1));
+
+      unsigned int x = 0;
+
+      #ifdef BITMAP_IMAGE_X86_SIMD
+      if (simd_sse41 <= active_simd_level())
+         x = ycbcr_row_pair_sse41(row0,row1,bpp,width,luma0,luma1,cb,cr,k,paired);
+      #endif
+
+      for ( ; x < width; x += (paired ? 2 : 1))
       {
-          (*s_itr)  = *(itr1++);
-          (*s_itr) += *(itr1++);
-          (*s_itr) += *(itr2++);
-          (*s_itr) += *(itr2++);
-          (*s_itr) /=  4.0;
+         const unsigned char* a0 = row0 + x * bpp;
+         const unsigned char* a1 = row1 + x * bpp;
+
+         int sum[3] = { 0, 0, 0 };
+
+         luma0[x] = static_cast<unsigned char>((k.luma[0] * a0[0] + k.luma[1] * a0[1] + k.luma[2] * a0[2] + luma_bias) >> 15);
+
+         if (luma1)
+         {
+            luma1[x] = static_cast<unsigned char>((k.luma[0] * a1[0] + k.luma[1] * a1[1] + k.luma[2] * a1[2] + luma_bias) >> 15);
+         }
+
+         for (unsigned int c = 0; c < 3; ++c)
+         {
+            sum[c] = a0[c] + a1[c];
+         }
+
+         if (paired)
+         {
+            const bool         last = ((x + 1) == width);
+            const unsigned int next = last ? 0 : bpp;
+
+            if (!last)
+            {
+               luma0[x + 1] = static_cast<unsigned char>((k.luma[0] * a0[next] + k.luma[1] * a0[next + 1] + k.luma[2] * a0[next + 2] + luma_bias) >> 15);
+
+               if (luma1)
+               {
+                  luma1[x + 1] = static_cast<unsigned char>((k.luma[0] * a1[next] + k.luma[1] * a1[next + 1] + k.luma[2] * a1[next + 2] + luma_bias) >> 15);
+               }
+            }
+
+            for (unsigned int c = 0; c < 3; ++c)
+            {
+               sum[c] += a0[next + c] + a1[next + c];
+            }
+         }
+
+         const std::size_t i = paired ? (x / 2) : x;
+
+         cb[i] = static_cast<unsigned char>((k.cb[0] * sum[0] + k.cb[1] * sum[1] + k.cb[2] * sum[2] + chroma_bias) >> chroma_shift);
+         cr[i] = static_cast<unsigned char>((k.cr[0] * sum[0] + k.cr[1] * sum[1] + k.cr[2] * sum[2] + chroma_bias) >> chroma_shift);
       }
+   }
 
-      if (odd_width)
+   class thread_pool
+   {
+   public:
+
+      /*
+         A fixed set of worker threads executing batches of indexed
+         tasks. The thread submitting a batch works on it as well, and
+         while waiting for tasks claimed by other threads it executes
+         whatever else is queued. Tasks may therefore submit nested
+         batches, as a recursive traversal does, without deadlocking or
+         leaving threads idle.
+      */
+
+      explicit thread_pool(const unsigned int workers)
+      : stop_(false)
       {
-         (*(s_itr++)) = ( (*itr1++) + (*itr2++) ) / 2.0;
+         for (unsigned int i = 0; i < workers; ++i)
+         {
+            threads_.push_back(std::thread(&thread_pool::worker,this));
+         }
       }
 
-      itr1 += width;
+     ~thread_pool()
+      {
+         {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+         }
 
-      if (j != (vertical_upper -1))
+         condition_.notify_all();
+
+         for (std::size_t i = 0; i < threads_.size(); ++i)
+         {
+            threads_[i].join();
+         }
+      }
+
+      inline unsigned int worker_count() const
       {
-         itr2 += width;
+         return static_cast<unsigned int>(threads_.size());
+      }
+
+      inline void run(const unsigned int tasks,
+                      const unsigned int helpers,
+                      const std::function<void(unsigned int)>& task)
+      {
+         // Runs task(0) .. task(tasks - 1) on the calling thread and up to helpers other threads.
+         std::shared_ptr<batch> work = std::make_shared<batch>(tasks,task);
+
+         const unsigned int requested = std::min(std::min(helpers,worker_count()),tasks - 1);
+
+         if (requested > 0)
+         {
+            {
+               std::lock_guard<std::mutex> lock(mutex_);
+
+               for (unsigned int i = 0; i < requested; ++i)
+               {
+                  queue_.push_back(work);
+               }
+            }
+
+            condition_.notify_all();
+         }
+
+         execute(*work);
+
+         std::unique_lock<std::mutex> lock(mutex_);
+
+         while (work->completed_ != work->count_)
+         {
+            if (queue_.empty())
+            {
+               condition_.wait(lock);
+               continue;
+            }
+
+            std::shared_ptr<batch> other = queue_.front();
+            queue_.pop_front();
+
+            lock.unlock();
+            execute(*other);
+            lock.lock();
+         }
+      }
+
+   private:
+
+      thread_pool(const thread_pool&);
+      thread_pool& operator=(const thread_pool&);
+
+      struct batch
+      {
+         batch(const unsigned int tasks, const std::function<void(unsigned int)>& task)
+         : task_(task),
+           next_(0),
+           count_(tasks),
+           completed_(0)
+         {}
+
+         std::function<void(unsigned int)> task_;
+         std::atomic<unsigned int> next_;
+         unsigned int              count_;
+         unsigned int              completed_;
+      };
+
+      inline void execute(batch& work)
+      {
+         unsigned int completed = 0;
+
+         for (unsigned int i = work.next_++; i < work.count_; i = work.next_++)
+         {
+            work.task_(i);
+            ++completed;
+         }
+
+         if (0 == completed)
+            return;
+
+         bool finished = false;
+
+         {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            work.completed_ += completed;
+
+            finished = (work.completed_ == work.count_);
+         }
+
+         if (finished)
+         {
+            condition_.notify_all();
+         }
+      }
+
+      void worker()
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+
+         for ( ; ; )
+         {
+            while (!stop_ && queue_.empty())
+            {
+               condition_.wait(lock);
+            }
+
+            if (queue_.empty())
+               return;
+
+            std::shared_ptr<batch> work = queue_.front();
+            queue_.pop_front();
+
+            lock.unlock();
+            execute(*work);
+            lock.lock();
+         }
       }
+
+      std::vector<std::thread>            threads_;
+      std::deque<std::shared_ptr<batch> > queue_;
+      std::mutex                          mutex_;
+      std::condition_variable             condition_;
+      bool                                stop_;
+   };
+
+   struct parallel_settings
+   {
+      parallel_settings()
+      : threads(std::max(1U,std::thread::hardware_concurrency())),
+        grain(1 << 16)
+      {}
+
+      std::mutex                   mutex;
+      std::unique_ptr<thread_pool> pool;
+      unsigned int                 threads;
+      std::size_t                  grain;
+   };
+
+   inline parallel_settings& parallel_state()
+   {
+      static parallel_settings settings;
+      return settings;
    }
 
-   if (odd_height)
+   /*
+      Whole-image operations are split into bands of rows holding at
+      least grain pixels each and run on up to thread_count() threads,
+      the calling thread included. Every band writes a disjoint set of
+      rows so the results do not depend on either setting. Neither may
+      be changed while an operation is in progress.
+   */
+
+   inline void set_thread_count(const unsigned int threads)
    {
-      for (unsigned int i = 0; i < horizontal_upper; ++i, ++s_itr)
+      parallel_settings& settings = parallel_state();
+
+      std::lock_guard<std::mutex> lock(settings.mutex);
+
+      settings.threads = std::max(1U,threads);
+      settings.pool.reset();
+   }
+
+   inline unsigned int thread_count()
+   {
+      return parallel_state().threads;
+   }
+
+   inline void set_grain_size(const std::size_t pixels)
+   {
+      parallel_state().grain = std::max<std::size_t>(1,pixels);
+   }
+
+   inline std::size_t grain_size()
+   {
+      return parallel_state().grain;
+   }
+
+   inline thread_pool& shared_thread_pool()
+   {
+      parallel_settings& settings = parallel_state();
+
+      std::lock_guard<std::mutex> lock(settings.mutex);
+
+      if (!settings.pool)
       {
-         (*s_itr) += (*(itr1++));
-         (*s_itr) += (*(itr1++));
-         (*s_itr) /= 2.0;
+         settings.pool.reset(new thread_pool(settings.threads - 1));
       }
 
-      if (odd_width)
+      return *settings.pool;
+   }
+
+   inline unsigned int band_rows(const unsigned int rows, const unsigned int row_width)
+   {
+      // Rows per band of parallel_rows, all of them when the bands would run serially.
+      const std::size_t  pixels = std::max<std::size_t>(1,row_width);
+      const unsigned int count  = static_cast<unsigned int>(std::max<std::size_t>(1,(grain_size() + pixels - 1) / pixels));
+
+      if ((((rows + count - 1) / count) <= 1) || (thread_count() <= 1))
+         return std::max(1U,rows);
+
+      return count;
+   }
+
+   template <typename Function>
+   inline void parallel_rows(const unsigned int rows, const unsigned int row_width, const Function& function)
+   {
+      // Calls function(first_row, last_row) for consecutive bands covering [0,rows).
+      const unsigned int band_rows = bitmap_details::band_rows(rows,row_width);
+      const unsigned int bands     = (rows + band_rows - 1) / band_rows;
+
+      if (bands <= 1)
       {
-         (*(s_itr++)) = (*itr1);
+         if (rows > 0)
+         {
+            function(0U,rows);
+         }
+
+         return;
       }
+
+      shared_thread_pool().run(bands,thread_count() - 1,
+                               [&](const unsigned int band)
+                               {
+                                  const unsigned int first_row = band * band_rows;
+                                  function(first_row,std::min(rows,first_row + band_rows));
+                               });
+   }
+
+   template <typename Function>
+   inline void parallel_for_each_row(const unsigned int rows, const unsigned int row_width, const Function& function)
+   {
+      // Calls function(y) for every row of [0,rows), bands of rows possibly concurrently.
+      parallel_rows(rows,row_width,
+                    [&](const unsigned int first_row, const unsigned int last_row)
+                    {
+                       for (unsigned int y = first_row; y < last_row; ++y)
+                       {
+                          function(y);
+                       }
+                    });
+   }
+
+   inline void parallel_region_ssd(const unsigned char* image1, const std::size_t row_increment1, const unsigned int bpp1,
+                                   const unsigned char* image2, const std::size_t row_increment2, const unsigned int bpp2,
+                                   const unsigned int width, const unsigned int height,
+                                   unsigned long long sums[4])
+   {
+      // As region_ssd, the integer band sums add up identically in any order.
+      std::mutex merge_mutex;
+
+      parallel_rows(height,width,
+                    [&](const unsigned int first_row, const unsigned int last_row)
+                    {
+                       unsigned long long band_sums[4] = { 0, 0, 0, 0 };
+
+                       region_ssd(image1 + first_row * row_increment1,row_increment1,bpp1,
+                                  image2 + first_row * row_increment2,row_increment2,bpp2,
+                                  width,last_row - first_row,band_sums);
+
+                       std::lock_guard<std::mutex> lock(merge_mutex);
+
+                       for (std::size_t i = 0; i < 4; ++i)
+                       {
+                          sums[i] += band_sums[i];
+                       }
+                    });
    }
 }
 
-inline void upsample(const unsigned int& width,
-                     const unsigned int& height,
-                     const double* source,
-                     unsigned int& w,
-                     unsigned int& h,
-                     double** dest)
+class bitmap_image
 {
-   /* Single channel. */
+public:
+
+   enum channel_mode {
+                        rgb_mode = 0,
+                        bgr_mode = 1
+                     };
+
+   enum color_plane {
+                       blue_plane  = 0,
+                       green_plane = 1,
+                       red_plane   = 2,
+                       alpha_plane = 3
+                    };
+
+   enum pixel_format {
+                        bgr_format  = 0, // 24-bit
+                        bgrx_format = 1, // 32-bit, fourth byte unused
+                        bgra_format = 2  // 32-bit with alpha
+                     };
+
+   enum load_mode {
+                     stream_load = 0,
+                     mapped_load = 1
+                  };
+
+   struct color_histogram
+   {
+      /*
+         Per-value counts of the colour channels, indexed by color_plane,
+         and of the luma that convert_to_grayscale would produce.
+      */
+
+      unsigned int channel[3][256];
+      unsigned int luma[256];
+   };
+
+   enum border_mode {
+                       border_clamp   = 0, // repeat the edge pixel
+                       border_reflect = 1, // mirror, the edge pixel included
+                       border_wrap    = 2, // tile the image
+                       border_zero    = 3  // outside pixels are zero
+                    };
+
+   enum resample_filter {
+                           bilinear_filter = 0,
+                           bicubic_filter  = 1,
+                           lanczos_filter  = 2
+                        };
+
+   enum ycbcr_standard {
+                          ycbcr_bt601 = 0,
+                          ycbcr_bt709 = 1
+                       };
+
+   enum chroma_subsampling {
+                              chroma_444 = 0, // full resolution chroma
+                              chroma_422 = 1, // half width
+                              chroma_420 = 2  // half width, half height
+                           };
+
+   class image_view
+   {
+   public:
+
+      /*
+         A rectangle of pixels owned by someone else, addressed by its
+         first pixel and the row increment of the buffer it lies in.
+         Copying a view copies the reference, never the pixels, and a
+         view must not outlive the image it was taken from.
+      */
+
+      image_view()
+      : data_(0),
+        width_(0),
+        height_(0),
+        row_increment_(0),
+        bytes_per_pixel_(3),
+        pixel_format_(bgr_format),
+        channel_mode_(bgr_mode)
+      {}
+
+      image_view(unsigned char* data,
+                 const unsigned int width, const unsigned int height,
+                 const std::size_t row_increment,
+                 const pixel_format format = bgr_format,
+                 const channel_mode mode   = bgr_mode)
+      : data_(data),
+        width_(width),
+        height_(height),
+        row_increment_(row_increment),
+        bytes_per_pixel_(format_bytes_per_pixel(format)),
+        pixel_format_(format),
+        channel_mode_(mode)
+      {}
+
+      inline unsigned int width() const
+      {
+         return width_;
+      }
+
+      inline unsigned int height() const
+      {
+         return height_;
+      }
+
+      inline std::size_t row_increment() const
+      {
+         return row_increment_;
+      }
+
+      inline unsigned int bytes_per_pixel() const
+      {
+         return bytes_per_pixel_;
+      }
+
+      inline pixel_format format() const
+      {
+         return pixel_format_;
+      }
+
+      inline channel_mode mode() const
+      {
+         return channel_mode_;
+      }
+
+      inline bool empty() const
+      {
+         return (0 == data_) || (0 == width_) || (0 == height_);
+      }
+
+      inline unsigned char* row(const unsigned int y) const
+      {
+         return data_ + y * row_increment_;
+      }
+
+      inline std::size_t row_length() const
+      {
+         return static_cast<std::size_t>(width_) * bytes_per_pixel_;
+      }
+
+      inline image_view sub_view(const unsigned int x,
+                                 const unsigned int y,
+                                 const unsigned int width,
+                                 const unsigned int height) const
+      {
+         // Clipped to this view, a rectangle lying wholly outside gives an empty view.
+         if ((x >= width_) || (y >= height_))
+            return image_view(0,0,0,0,pixel_format_,channel_mode_);
+
+         return image_view(row(y) + x * bytes_per_pixel_,
+                           std::min(width ,width_  - x),
+                           std::min(height,height_ - y),
+                           row_increment_,pixel_format_,channel_mode_);
+      }
+
+      inline bool copy_from(const image_view& source) const
+      {
+         // Converts between 24 and 32-bit pixels as needed, new alpha bytes are opaque.
+         if ((source.width_ != width_) || (source.height_ != height_))
+            return false;
+
+         const bool fill_alpha = (bgra_format == pixel_format_) && (bgra_format != source.pixel_format_);
+
+         bitmap_details::parallel_for_each_row(height_,width_,
+                                               [&](const unsigned int y)
+                                               {
+                                                  convert_pixels(source.row(y),source.bytes_per_pixel_,
+                                                                 row(y),bytes_per_pixel_,
+                                                                 width_,fill_alpha);
+                                               });
+
+         return true;
+      }
+
+      inline void fill(const unsigned char& value) const
+      {
+         bitmap_details::parallel_for_each_row(height_,width_,
+                                               [&](const unsigned int y)
+                                               {
+                                                  std::fill(row(y),row(y) + row_length(),value);
+                                               });
+      }
+
+      inline void fill(const color_plane color, const unsigned char& value) const
+      {
+         const unsigned int color_plane_offset = channel_offset(channel_mode_,color);
+
+         if (color_plane_offset >= bytes_per_pixel_)
+            return;
+
+         bitmap_details::parallel_for_each_row(height_,width_,
+                                               [&](const unsigned int y)
+                                               {
+                                                  unsigned char* itr     = row(y) + color_plane_offset;
+                                                  unsigned char* itr_end = row(y) + row_length();
+
+                                                  for ( ; itr < itr_end; itr += bytes_per_pixel_)
+                                                  {
+                                                     *itr = value;
+                                                  }
+                                               });
+      }
+
+      inline void fill(const unsigned char& red,
+                       const unsigned char& green,
+                       const unsigned char& blue) const
+      {
+         // Written in BGR byte order whatever the channel mode, as set_all_channels.
+         bitmap_details::parallel_for_each_row(height_,width_,
+                                               [&](const unsigned int y)
+                                               {
+                                                  unsigned char* itr     = row(y);
+                                                  unsigned char* itr_end = itr + row_length();
+
+                                                  for ( ; itr < itr_end; itr += bytes_per_pixel_)
+                                                  {
+                                                     *(itr + 0) = blue;
+                                                     *(itr + 1) = green;
+                                                     *(itr + 2) = red;
+                                                  }
+                                               });
+      }
+
+      inline void horizontal_flip() const
+      {
+         if (empty())
+            return;
+
+         bitmap_details::parallel_for_each_row(height_,width_,
+                                               [&](const unsigned int y)
+                                               {
+                                                  unsigned char* itr1 = row(y);
+                                                  unsigned char* itr2 = itr1 + row_length() - bytes_per_pixel_;
+
+                                                  while (itr1 < itr2)
+                                                  {
+                                                     for (unsigned int i = 0; i < bytes_per_pixel_; ++i)
+                                                     {
+                                                        std::swap(*(itr1 + i),*(itr2 + i));
+                                                     }
+
+                                                     itr1 += bytes_per_pixel_;
+                                                     itr2 -= bytes_per_pixel_;
+                                                  }
+                                               });
+      }
+
+      inline void vertical_flip() const
+      {
+         bitmap_details::parallel_rows(height_ / 2,width_,
+                                       [&](const unsigned int first_row, const unsigned int last_row)
+                                       {
+                                          for (unsigned int y = first_row; y < last_row; ++y)
+                                          {
+                                             std::swap_ranges(row(y),row(y) + row_length(),row(height_ - y - 1));
+                                          }
+                                       });
+      }
+
+      inline void convert_to_grayscale() const
+      {
+         if (empty())
+            return;
+
+         bitmap_details::parallel_rows(height_,width_,
+                                       [&](const unsigned int first_row, const unsigned int last_row)
+                                       {
+                                          std::vector<unsigned char> gray(width_);
+
+                                          for (unsigned int y = first_row; y < last_row; ++y)
+                                          {
+                                             bitmap_image::gray_row(row(y),&gray[0],width_,bytes_per_pixel_,channel_mode_);
+                                             bitmap_details::expand_gray_row(&gray[0],row(y),width_,bytes_per_pixel_);
+                                          }
+                                       });
+      }
+
+      inline void alpha_blend(const double& alpha, const image_view& source) const
+      {
+         if (
+              (source.width_  != width_ ) ||
+              (source.height_ != height_) ||
+              (source.bytes_per_pixel_ != bytes_per_pixel_)
+            )
+         {
+            return;
+         }
+
+         if ((alpha < 0.0) || (alpha > 1.0))
+         {
+            return;
+         }
+
+         // 8-bit fixed-point weight, 256 being fully opaque.
+         const int a = static_cast<int>(alpha * 256.0 + 0.5);
+
+         bitmap_details::parallel_for_each_row(height_,width_,
+                                               [&](const unsigned int y)
+                                               {
+                                                  bitmap_details::blend_row(row(y),source.row(y),row_length(),a);
+                                               });
+      }
+
+      inline void alpha_blend(const unsigned char* alpha_mask, const image_view& source) const
+      {
+         // The mask is a packed plane of width * height bytes, 255 selecting the source entirely.
+         if (
+              (source.width_  != width_ ) ||
+              (source.height_ != height_) ||
+              (source.bytes_per_pixel_ != bytes_per_pixel_)
+            )
+         {
+            return;
+         }
+
+         if (empty())
+            return;
+
+         bitmap_details::parallel_rows(height_,width_,
+                                       [&](const unsigned int first_row, const unsigned int last_row)
+                                       {
+                                          std::vector<unsigned char> alpha(row_length());
+
+                                          for (unsigned int y = first_row; y < last_row; ++y)
+                                          {
+                                             bitmap_details::spread_alpha_row(alpha_mask + static_cast<std::size_t>(y) * width_,&alpha[0],width_,bytes_per_pixel_);
+                                             bitmap_details::blend_row(row(y),source.row(y),&alpha[0],row_length());
+                                          }
+                                       });
+      }
+
+      inline void alpha_blend(const image_view& source) const
+      {
+         // Composites a BGRA source using its own alpha, as bitmap_image::alpha_blend.
+         if (
+              (source.width_  != width_ ) ||
+              (source.height_ != height_) ||
+              (bgra_format != source.pixel_format_)
+            )
+         {
+            return;
+         }
+
+         bitmap_details::parallel_rows(height_,width_,
+                                       [&](const unsigned int first_row, const unsigned int last_row)
+                                       {
+                                          std::vector<unsigned char> color(row_length() + 16);
+                                          std::vector<unsigned char> alpha(row_length() + 16);
+
+                                          for (unsigned int y = first_row; y < last_row; ++y)
+                                          {
+                                             bitmap_details::split_bgra_row(source.row(y),&color[0],&alpha[0],width_,bytes_per_pixel_);
+                                             bitmap_details::blend_row(row(y),&color[0],&alpha[0],row_length());
+                                          }
+                                       });
+      }
+
+      inline double psnr(const image_view& view) const
+      {
+         if ((view.width_ != width_) || (view.height_ != height_))
+            return 0.0;
+
+         // Only the colour channels contribute, any alpha bytes are ignored.
+         unsigned long long sums[4] = { 0, 0, 0, 0 };
+
+         bitmap_details::parallel_region_ssd(data_,row_increment_,bytes_per_pixel_,
+                                             view.data_,view.row_increment_,view.bytes_per_pixel_,
+                                             width_,height_,sums);
+
+         return bitmap_details::ssd_to_psnr(sums[0] + sums[1] + sums[2],3.0 * width_ * height_);
+      }
+
+      inline void histogram(color_histogram& hist) const
+      {
+         std::fill(&hist.channel[0][0],&hist.channel[0][0] + 3 * 256,0);
+         std::fill(hist.luma,hist.luma + 256,0);
+
+         if (empty())
+            return;
+
+         const std::size_t stride = 256 + 16;
+
+         std::mutex merge_mutex;
+
+         bitmap_details::parallel_rows(height_,width_,
+                                       [&](const unsigned int first_row, const unsigned int last_row)
+                                       {
+                                          /*
+                                             Table 4 * c + k is copy k of the counts for byte c of a
+                                             pixel, c = 3 being luma. Neighbouring pixels go to
+                                             different copies, so runs of equal values do not wait
+                                             on the previous increment of the same counter. Tables
+                                             are padded so that a gray pixel's four counters are not
+                                             4KB apart, which the CPU would treat as a dependency.
+                                          */
+                                          std::vector<unsigned int> counts(16 * stride,0);
+                                          std::vector<unsigned char> gray(width_);
+
+                                          // Locals, as the counter stores could otherwise alias the members.
+                                          const unsigned int width = width_;
+                                          const unsigned int bpp   = bytes_per_pixel_;
+
+                                          unsigned int* c0 = &counts[ 0 * stride];
+                                          unsigned int* c1 = &counts[ 4 * stride];
+                                          unsigned int* c2 = &counts[ 8 * stride];
+                                          unsigned int* cl = &counts[12 * stride];
+
+                                          for (unsigned int y = first_row; y < last_row; ++y)
+                                          {
+                                             bitmap_image::gray_row(row(y),&gray[0],width_,bytes_per_pixel_,channel_mode_);
+
+                                             const unsigned char* itr = row(y);
+                                             const unsigned char* lum = &gray[0];
+
+                                             unsigned int x = 0;
+
+                                             for ( ; (x + 4) <= width; x += 4, itr += 4 * bpp, lum += 4)
+                                             {
+                                                ++c0[      itr[0          ]]; ++c1[      itr[1          ]]; ++c2[      itr[2          ]]; ++cl[      lum[0]];
+                                                ++c0[1 * stride +  itr[bpp     + 0]]; ++c1[1 * stride +  itr[bpp     + 1]]; ++c2[1 * stride +  itr[bpp     + 2]]; ++cl[1 * stride +  lum[1]];
+                                                ++c0[2 * stride +  itr[2 * bpp + 0]]; ++c1[2 * stride +  itr[2 * bpp + 1]]; ++c2[2 * stride +  itr[2 * bpp + 2]]; ++cl[2 * stride +  lum[2]];
+                                                ++c0[3 * stride +  itr[3 * bpp + 0]]; ++c1[3 * stride +  itr[3 * bpp + 1]]; ++c2[3 * stride +  itr[3 * bpp + 2]]; ++cl[3 * stride +  lum[3]];
+                                             }
+
+                                             for ( ; x < width; ++x, itr += bpp, ++lum)
+                                             {
+                                                ++c0[itr[0]];
+                                                ++c1[itr[1]];
+                                                ++c2[itr[2]];
+                                                ++cl[lum[0]];
+                                             }
+                                          }
+
+                                          std::lock_guard<std::mutex> lock(merge_mutex);
+
+                                          for (unsigned int c = 0; c < 4; ++c)
+                                          {
+                                             unsigned int* h = (3 == c) ? hist.luma : hist.channel[(rgb_mode == channel_mode_) ? (2 - c) : c];
+
+                                             for (unsigned int v = 0; v < 256; ++v)
+                                             {
+                                                const unsigned int* itr = &counts[4 * c * stride + v];
+
+                                                h[v] += itr[0] + itr[stride] + itr[2 * stride] + itr[3 * stride];
+                                             }
+                                          }
+                                       });
+      }
+
+   private:
+
+      unsigned char* data_;
+      unsigned int   width_;
+      unsigned int   height_;
+      std::size_t    row_increment_;
+      unsigned int   bytes_per_pixel_;
+      pixel_format   pixel_format_;
+      channel_mode   channel_mode_;
+   };
+
+   class convolution_kernel
+   {
+   public:
+
+      /*
+         A 1D kernel centred on its middle tap, an even number of
+         weights is padded with a trailing zero. Fixed-point kernels
+         are applied with Q14 weights rounded so that their sum stays
+         exact, floating point ones are applied as given.
+      */
+
+      convolution_kernel()
+      : fixed_point_(true)
+      {
+         set_weights(std::vector<double>(1,1.0));
+      }
+
+      convolution_kernel(const std::vector<double>& weights, const bool fixed_point = true)
+      : fixed_point_(fixed_point)
+      {
+         set_weights(weights);
+      }
+
+      static inline convolution_kernel gaussian(const double& sigma, const bool fixed_point = true)
+      {
+         const unsigned int radius = static_cast<unsigned int>(std::ceil(3.0 * std::max(sigma,0.0)));
+
+         std::vector<double> weights(2 * radius + 1);
+
+         double sum = 0.0;
+
+         for (std::size_t i = 0; i < weights.size(); ++i)
+         {
+            const double x = static_cast<double>(i) - radius;
+
+            weights[i] = (sigma > 0.0) ? std::exp(-(x * x) / (2.0 * sigma * sigma)) : 1.0;
+
+            sum += weights[i];
+         }
+
+         for (std::size_t i = 0; i < weights.size(); ++i)
+         {
+            weights[i] /= sum;
+         }
+
+         return convolution_kernel(weights,fixed_point);
+      }
+
+      static inline convolution_kernel box(const unsigned int radius, const bool fixed_point = true)
+      {
+         return convolution_kernel(std::vector<double>(2 * radius + 1,1.0 / (2 * radius + 1)),fixed_point);
+      }
+
+      inline unsigned int size() const
+      {
+         return static_cast<unsigned int>(float_weights_.size());
+      }
+
+      inline unsigned int radius() const
+      {
+         return size() / 2;
+      }
+
+      inline bool fixed_point() const
+      {
+         return fixed_point_;
+      }
+
+      inline const std::vector<int>& fixed_weights() const
+      {
+         return fixed_weights_;
+      }
+
+      inline const std::vector<float>& float_weights() const
+      {
+         return float_weights_;
+      }
+
+   private:
+
+      inline void set_weights(std::vector<double> weights)
+      {
+         if (weights.empty() || (0 == (weights.size() % 2)))
+         {
+            weights.push_back(0.0);
+         }
+
+         float_weights_.resize(weights.size());
+         fixed_weights_.resize(weights.size());
+
+         double sum       = 0.0;
+         int    fixed_sum = 0;
+
+         for (std::size_t i = 0; i < weights.size(); ++i)
+         {
+            float_weights_[i] = static_cast<float>(weights[i]);
+            fixed_weights_[i] = static_cast<int>(std::floor(weights[i] * 16384.0 + 0.5));
+
+            sum       += weights[i];
+            fixed_sum += fixed_weights_[i];
+         }
+
+         // Rounding error goes to the centre tap, a kernel summing to 1 then preserves flat areas exactly.
+         fixed_weights_[weights.size() / 2] += static_cast<int>(std::floor(sum * 16384.0 + 0.5)) - fixed_sum;
+      }
+
+      std::vector<int>   fixed_weights_;
+      std::vector<float> float_weights_;
+      bool               fixed_point_;
+   };
+
+   bitmap_image()
+   : file_name_(""),
+     data_  (0),
+     length_(0),
+     width_ (0),
+     height_(0),
+     row_increment_(0),
+     row_alignment_(1),
+     bytes_per_pixel_(3),
+     pixel_format_(bgr_format),
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0),
+     allocator_(&default_bitmap_allocator())
+   {}
+
+   bitmap_image(const std::string& filename)
+   : file_name_(filename),
+     data_  (0),
+     length_(0),
+     width_ (0),
+     height_(0),
+     row_increment_(0),
+     row_alignment_(1),
+     bytes_per_pixel_(0),
+     pixel_format_(bgr_format),
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0),
+     allocator_(&default_bitmap_allocator())
+   {
+      load_bitmap();
+   }
+
+   bitmap_image(const std::string& filename, const load_mode mode)
+   : file_name_(filename),
+     data_  (0),
+     length_(0),
+     width_ (0),
+     height_(0),
+     row_increment_(0),
+     row_alignment_(1),
+     bytes_per_pixel_(0),
+     pixel_format_(bgr_format),
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0),
+     allocator_(&default_bitmap_allocator())
+   {
+      /*
+         With mapped_load only top-down files (negative height) are used
+         in place. Bottom-up files, the usual layout, are decoded from the
+         mapping into an allocated buffer, as the image cannot address
+         its rows with a negative stride. mapped() tells the cases apart.
+      */
+
+      if (mapped_load == mode)
+         load_bitmap_mapped();
+      else
+         load_bitmap();
+   }
+
+   bitmap_image(const unsigned int width, const unsigned int height)
+   : file_name_(""),
+     data_  (0),
+     length_(0),
+     width_(width),
+     height_(height),
+     row_increment_(0),
+     row_alignment_(1),
+     bytes_per_pixel_(3),
+     pixel_format_(bgr_format),
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0),
+     allocator_(&default_bitmap_allocator())
+   {
+     create_bitmap();
+   }
+
+   bitmap_image(const unsigned int width, const unsigned int height, const pixel_format format)
+   : file_name_(""),
+     data_  (0),
+     length_(0),
+     width_(width),
+     height_(height),
+     row_increment_(0),
+     row_alignment_(1),
+     bytes_per_pixel_(format_bytes_per_pixel(format)),
+     pixel_format_(format),
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0),
+     allocator_(&default_bitmap_allocator())
+   {
+     create_bitmap();
+   }
+
+   explicit bitmap_image(bitmap_allocator& allocator)
+   : file_name_(""),
+     data_  (0),
+     length_(0),
+     width_ (0),
+     height_(0),
+     row_increment_(0),
+     row_alignment_(1),
+     bytes_per_pixel_(3),
+     pixel_format_(bgr_format),
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0),
+     allocator_(&allocator)
+   {}
+
+   bitmap_image(const unsigned int width, const unsigned int height, bitmap_allocator& allocator)
+   : file_name_(""),
+     data_  (0),
+     length_(0),
+     width_(width),
+     height_(height),
+     row_increment_(0),
+     row_alignment_(1),
+     bytes_per_pixel_(3),
+     pixel_format_(bgr_format),
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0),
+     allocator_(&allocator)
+   {
+     create_bitmap();
+   }
+
+   bitmap_image(const bitmap_image& image)
+   : file_name_(image.file_name_),
+     data_(0),
+     length_(0),
+     width_(image.width_),
+     height_(image.height_),
+     row_increment_(0),
+     row_alignment_(image.row_alignment_),
+     bytes_per_pixel_(image.bytes_per_pixel_),
+     pixel_format_(image.pixel_format_),
+     channel_mode_(image.channel_mode_),
+     mapping_(0),
+     mapping_length_(0),
+     allocator_(image.allocator_)
+   {
+      create_bitmap();
+      std::copy(image.data_, image.data_ + image.length_, data_);
+   }
+
+   bitmap_image(bitmap_image&& image)
+   : file_name_(std::move(image.file_name_)),
+     data_  (image.data_),
+     length_(image.length_),
+     width_ (image.width_),
+     height_(image.height_),
+     row_increment_(image.row_increment_),
+     row_alignment_(image.row_alignment_),
+     bytes_per_pixel_(image.bytes_per_pixel_),
+     pixel_format_(image.pixel_format_),
+     channel_mode_(image.channel_mode_),
+     mapping_(image.mapping_),
+     mapping_length_(image.mapping_length_),
+     allocator_(image.allocator_)
+   {
+      image.data_           = 0;
+      image.length_         = 0;
+      image.width_          = 0;
+      image.height_         = 0;
+      image.row_increment_  = 0;
+      image.mapping_        = 0;
+      image.mapping_length_ = 0;
+   }
+
+  ~bitmap_image()
+   {
+      release_bitmap();
+   }
+
+   bitmap_image& operator=(const bitmap_image& image)
+   {
+      if (this != &image)
+      {
+         // An owned buffer of the same size can be reused as-is.
+         const bool reuse_buffer = (0 != data_) && (0 == mapping_) && (length_ == image.length_);
+
+         file_name_       = image.file_name_;
+         bytes_per_pixel_ = image.bytes_per_pixel_;
+         pixel_format_    = image.pixel_format_;
+         width_           = image.width_;
+         height_          = image.height_;
+         row_increment_   = image.row_increment_;
+         row_alignment_   = image.row_alignment_;
+         channel_mode_    = image.channel_mode_;
+
+         if (!reuse_buffer)
+         {
+            create_bitmap();
+         }
+
+         std::copy(image.data_, image.data_ + image.length_, data_);
+      }
+
+      return *this;
+   }
+
+   bitmap_image& operator=(bitmap_image&& image)
+   {
+      if (this != &image)
+      {
+         release_bitmap();
+
+         file_name_       = std::move(image.file_name_);
+         data_            = image.data_;
+         length_          = image.length_;
+         width_           = image.width_;
+         height_          = image.height_;
+         row_increment_   = image.row_increment_;
+         row_alignment_   = image.row_alignment_;
+         bytes_per_pixel_ = image.bytes_per_pixel_;
+         pixel_format_    = image.pixel_format_;
+         channel_mode_    = image.channel_mode_;
+         mapping_         = image.mapping_;
+         mapping_length_  = image.mapping_length_;
+         allocator_       = image.allocator_;
+
+         image.data_           = 0;
+         image.length_         = 0;
+         image.width_          = 0;
+         image.height_         = 0;
+         image.row_increment_  = 0;
+         image.mapping_        = 0;
+         image.mapping_length_ = 0;
+      }
+
+      return *this;
+   }
+
+   inline void swap(bitmap_image& image)
+   {
+      std::swap(file_name_      ,image.file_name_      );
+      std::swap(data_           ,image.data_           );
+      std::swap(length_         ,image.length_         );
+      std::swap(width_          ,image.width_          );
+      std::swap(height_         ,image.height_         );
+      std::swap(row_increment_  ,image.row_increment_  );
+      std::swap(row_alignment_  ,image.row_alignment_  );
+      std::swap(bytes_per_pixel_,image.bytes_per_pixel_);
+      std::swap(pixel_format_   ,image.pixel_format_   );
+      std::swap(channel_mode_   ,image.channel_mode_   );
+      std::swap(mapping_        ,image.mapping_        );
+      std::swap(mapping_length_ ,image.mapping_length_ );
+      std::swap(allocator_      ,image.allocator_      );
+   }
+
+   inline bool operator!()
+   {
+      return (data_         == 0) ||
+             (length_       == 0) ||
+             (width_        == 0) ||
+             (height_       == 0) ||
+             (row_increment_== 0);
+   }
+
+   inline void clear(const unsigned char v = 0x00)
+   {
+      for_each_row([&](const unsigned int y)
+                   {
+                      std::fill(row(y),row(y) + row_increment_,v);
+                   });
+   }
+
+   inline unsigned char red_channel(const unsigned int x, const unsigned int y) const
+   {
+      return data_[(y * row_increment_) + (x * bytes_per_pixel_ + 2)];
+   }
+
+   inline unsigned char green_channel(const unsigned int x, const unsigned int y) const
+   {
+      return data_[(y * row_increment_) + (x * bytes_per_pixel_ + 1)];
+   }
+
+   inline unsigned char blue_channel (const unsigned int x, const unsigned int y) const
+   {
+      return data_[(y * row_increment_) + (x * bytes_per_pixel_ + 0)];
+   }
+
+   inline void red_channel(const unsigned int x, const unsigned int y, const unsigned char value)
+   {
+      data_[(y * row_increment_) + (x * bytes_per_pixel_ + 2)] = value;
+   }
+
+   inline void green_channel(const unsigned int x, const unsigned int y, const unsigned char value)
+   {
+      data_[(y * row_increment_) + (x * bytes_per_pixel_ + 1)] = value;
+   }
+
+   inline void blue_channel (const unsigned int x, const unsigned int y, const unsigned char value)
+   {
+      data_[(y * row_increment_) + (x * bytes_per_pixel_ + 0)] = value;
+   }
+
+   // Only valid for 32-bit pixel formats.
+   inline unsigned char alpha_channel(const unsigned int x, const unsigned int y) const
+   {
+      return data_[(y * row_increment_) + (x * bytes_per_pixel_ + 3)];
+   }
+
+   inline void alpha_channel(const unsigned int x, const unsigned int y, const unsigned char value)
+   {
+      data_[(y * row_increment_) + (x * bytes_per_pixel_ + 3)] = value;
+   }
+
+   inline unsigned char* row(unsigned int row_index) const
+   {
+      return data_ + (row_index * row_increment_);
+   }
+
+   inline image_view view() const
+   {
+      return image_view(data_,width_,height_,row_increment_,pixel_format_,channel_mode_);
+   }
+
+   inline image_view view(const unsigned int x,
+                          const unsigned int y,
+                          const unsigned int width,
+                          const unsigned int height) const
+   {
+      // Clipped to the image, the pixels are shared rather than copied.
+      return view().sub_view(x,y,width,height);
+   }
+
+   inline void get_pixel(const unsigned int x, const unsigned int y,
+                         unsigned char& red,
+                         unsigned char& green,
+                         unsigned char& blue)
+   {
+      const std::size_t  y_offset = y * row_increment_;
+      const unsigned int x_offset = x * bytes_per_pixel_;
+      blue  = data_[y_offset + x_offset + 0];
+      green = data_[y_offset + x_offset + 1];
+      red   = data_[y_offset + x_offset + 2];
+   }
+
+   inline void set_pixel(const unsigned int x, const unsigned int y,
+                         const unsigned char red,
+                         const unsigned char green,
+                         const unsigned char blue)
+   {
+      const std::size_t  y_offset = y * row_increment_;
+      const unsigned int x_offset = x * bytes_per_pixel_;
+      data_[y_offset + x_offset + 0] = blue;
+      data_[y_offset + x_offset + 1] = green;
+      data_[y_offset + x_offset + 2] = red;
+   }
+
+   inline bool copy_from(const bitmap_image& image)
+   {
+      if (
+           (image.height_ != height_) ||
+           (image.width_  != width_ )
+         )
+      {
+         return false;
+      }
+
+      if (
+           (image.row_increment_   == row_increment_  ) &&
+           (image.pixel_format_    == pixel_format_   )
+         )
+      {
+         std::copy(image.data_,image.data_ + image.length_,data_);
+         return true;
+      }
+
+      return copy_from(image,0,0);
+   }
+
+   inline bool copy_from(const bitmap_image& source_image,
+                         const unsigned int& x_offset,
+                         const unsigned int& y_offset)
+   {
+      if ((x_offset + source_image.width_ ) > width_ ) { return false; }
+      if ((y_offset + source_image.height_) > height_) { return false; }
+
+      return view(x_offset,y_offset,source_image.width_,source_image.height_).copy_from(source_image.view());
+   }
+
+   inline bool region(const unsigned int& x,
+                      const unsigned int& y,
+                      const unsigned int& width,
+                      const unsigned int& height,
+                      bitmap_image& dest_image)
+   {
+      // Copies the rectangle, view(x,y,width,height) refers to it in place.
+      if ((x + width ) > width_ ) { return false; }
+      if ((y + height) > height_) { return false; }
+
+      if (
+           (dest_image.width_  < width_ ) ||
+           (dest_image.height_ < height_)
+         )
+      {
+         dest_image.setwidth_height(width,height);
+      }
+
+      return dest_image.view(0,0,width,height).copy_from(view(x,y,width,height));
+   }
+
+   inline bool set_region(const unsigned int& x,
+                          const unsigned int& y,
+                          const unsigned int& width,
+                          const unsigned int& height,
+                          const unsigned char& value)
+   {
+      if ((x + width) > width_)   { return false; }
+      if ((y + height) > height_) { return false; }
+
+      view(x,y,width,height).fill(value);
+
+      return true;
+   }
+
+   inline bool set_region(const unsigned int& x,
+                          const unsigned int& y,
+                          const unsigned int& width,
+                          const unsigned int& height,
+                          const color_plane color,
+                          const unsigned char& value)
+   {
+      if ((x + width) > width_)   { return false; }
+      if ((y + height) > height_) { return false; }
+
+      if (offset(color) >= bytes_per_pixel_) { return false; }
+
+      view(x,y,width,height).fill(color,value);
+
+      return true;
+   }
+
+   inline bool set_region(const unsigned int& x,
+                          const unsigned int& y,
+                          const unsigned int& width,
+                          const unsigned int& height,
+                          const unsigned char& red,
+                          const unsigned char& green,
+                          const unsigned char& blue)
+   {
+      if ((x +  width) >  width_) { return false; }
+      if ((y + height) > height_) { return false; }
+
+      view(x,y,width,height).fill(red,green,blue);
+
+      return true;
+   }
+
+   void reflective_image(bitmap_image& image)
+   {
+      image.setwidth_height(3 * width_, 3 * height_,true);
+      image.copy_from(*this,width_,height_);
+      vertical_flip();
+      image.copy_from(*this,width_,0);
+      image.copy_from(*this,width_,2 * height_);
+      vertical_flip();
+      horizontal_flip();
+      image.copy_from(*this,0,height_);
+      image.copy_from(*this,2 * width_,height_);
+      horizontal_flip();
+   }
+
+   inline unsigned int width() const
+   {
+      return width_;
+   }
+
+   inline unsigned int height() const
+   {
+      return height_;
+   }
+
+   inline unsigned int bytes_per_pixel() const
+   {
+      return bytes_per_pixel_;
+   }
+
+   inline pixel_format format() const
+   {
+      return pixel_format_;
+   }
+
+   inline bool has_alpha() const
+   {
+      return (bgra_format == pixel_format_);
+   }
+
+   inline void set_pixel_format(const pixel_format format)
+   {
+      /*
+         Converts the pixels in place. Moving to bgra_format makes every
+         pixel opaque, moving to bgr_format drops the fourth byte.
+      */
+
+      if (format == pixel_format_)
+         return;
+
+      const unsigned int bytes_per_pixel = format_bytes_per_pixel(format);
+
+      if ((0 == data_) || (bytes_per_pixel == bytes_per_pixel_))
+      {
+         pixel_format_    = format;
+         bytes_per_pixel_ = bytes_per_pixel;
+
+         if ((0 != data_) && (bgra_format == format))
+         {
+            set_all_ith_channels(3,0xFF);
+         }
+
+         return;
+      }
+
+      bitmap_image image(std::move(*this));
+
+      file_name_       = image.file_name_;
+      width_           = image.width_;
+      height_          = image.height_;
+      bytes_per_pixel_ = bytes_per_pixel;
+      pixel_format_    = format;
+
+      create_bitmap();
+      copy_from(image,0,0);
+   }
+
+   inline std::size_t pixel_count() const
+   {
+      return static_cast<std::size_t>(width_) * height_;
+   }
+
+   inline std::size_t row_increment() const
+   {
+      return row_increment_;
+   }
+
+   inline unsigned int row_alignment() const
+   {
+      return row_alignment_;
+   }
+
+   inline bool set_row_alignment(const unsigned int alignment)
+   {
+      /*
+         Rows start on multiples of the given alignment (1 = packed,
+         4 = BMP compatible, 64 = cache line). The buffer itself is
+         always 64 byte aligned by the allocators.
+      */
+
+      if (
+           (0 == alignment) ||
+           (alignment > bitmap_allocator::buffer_alignment) ||
+           (0 != (alignment & (alignment - 1)))
+         )
+      {
+         return false;
+      }
+
+      if (alignment == row_alignment_)
+         return true;
+
+      if (0 == data_)
+      {
+         row_alignment_ = alignment;
+         return true;
+      }
+
+      bitmap_image image(std::move(*this));
+
+      file_name_     = image.file_name_;
+      width_         = image.width_;
+      height_        = image.height_;
+      row_alignment_ = alignment;
+
+      create_bitmap();
+      copy_from(image,0,0);
+
+      return true;
+   }
+
+   inline bool mapped() const
+   {
+      return (0 != mapping_);
+   }
+
+   inline bitmap_allocator& allocator() const
+   {
+      return *allocator_;
+   }
+
+   inline void set_allocator(bitmap_allocator& allocator)
+   {
+      if (&allocator == allocator_)
+         return;
+
+      if ((0 == data_) || (0 != mapping_))
+      {
+         allocator_ = &allocator;
+         return;
+      }
+
+      unsigned char* data = allocator.allocate(length_);
+
+      std::copy(data_, data_ + length_, data);
+
+      allocator_->deallocate(data_,length_);
+
+      data_      = data;
+      allocator_ = &allocator;
+   }
+
+   inline void setwidth_height(const unsigned int width,
+                               const unsigned int height,
+                               const bool clear = false)
+   {
+      release_bitmap();
+      width_  = width;
+      height_ = height;
+
+      create_bitmap();
+
+      if (clear)
+      {
+         std::fill(data_,data_ + length_,0x00);
+      }
+   }
+
+   void save_image(const std::string& file_name)
+   {
+      std::vector<unsigned char> buffer;
+
+      save_to_buffer(buffer);
+
+      #ifdef BITMAP_IMAGE_POSIX_IO
+      const int fd = ::open(file_name.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+
+      if (fd < 0)
+      {
+         std::cout << "bitmap_image::save_image(): Error - Could not open file "  << file_name << " for writing!" << std::endl;
+         return;
+      }
+
+      const unsigned char* itr = &buffer[0];
+      std::size_t remaining    = buffer.size();
+
+      while (remaining > 0)
+      {
+         const ssize_t written = ::write(fd,itr,remaining);
+
+         if (written < 0)
+         {
+            if (EINTR == errno)
+               continue;
+
+            std::cout << "bitmap_image::save_image(): Error - Failed writing to file "  << file_name << std::endl;
+            break;
+         }
+
+         itr       += written;
+         remaining -= static_cast<std::size_t>(written);
+      }
+
+      ::close(fd);
+      #else
+      std::ofstream stream(file_name.c_str(),std::ios::binary);
+
+      if (!stream)
+      {
+         std::cout << "bitmap_image::save_image(): Error - Could not open file "  << file_name << " for writing!" << std::endl;
+         return;
+      }
+
+      stream.write(reinterpret_cast<const char*>(&buffer[0]),buffer.size());
+      stream.close();
+      #endif
+   }
+
+   void save_to_buffer(std::vector<unsigned char>& buffer)
+   {
+      bitmap_file_header bfh;
+      bitmap_information_header bih;
+
+      const unsigned int row_bytes = width_ * bytes_per_pixel_;
+      const unsigned int padding   = (4 - (row_bytes % 4)) % 4;
+
+      make_header(width_,height_,pixel_format_,bfh,bih);
+
+      buffer.resize(bfh.size);
+
+      write_header(&buffer[0],bfh,bih);
+
+      unsigned char* itr = &buffer[0] + bfh.off_bits;
+
+      for (unsigned int i = 0; i < height_; ++i)
+      {
+         const unsigned char* data_ptr = row(height_ - i - 1);
+
+         std::memcpy(itr,data_ptr,row_bytes);
+         std::fill(itr + row_bytes,itr + row_bytes + padding,0x00);
+
+         itr += row_bytes + padding;
+      }
+   }
+
+   bool load_from_memory(const unsigned char* buffer, const std::size_t length)
+   {
+      bitmap_file_header bfh;
+      bitmap_information_header bih;
+      pixel_format format = bgr_format;
+
+      if (!parse_header(buffer,length,bfh,bih,format))
+         return false;
+
+      unsigned int width       = 0;
+      unsigned int height      = 0;
+      std::size_t  row_padding = 0;
+      bool         top_down    = false;
+
+      if (!read_layout(bih,width,height,row_padding,top_down))
+         return false;
+
+      if (!pixels_available(bfh,length,width,height,format_bytes_per_pixel(format),row_padding))
+      {
+         std::cerr << "bitmap_image::load_from_memory() ERROR: bitmap_image - Truncated pixel data." << std::endl;
+         return false;
+      }
+
+      width_           = width;
+      height_          = height;
+      bytes_per_pixel_ = format_bytes_per_pixel(format);
+      pixel_format_    = format;
+
+      create_bitmap();
+
+      const unsigned char* itr = buffer + bfh.off_bits;
+
+      for (unsigned int i = 0; i < height_; ++i)
+      {
+         unsigned char* data_ptr = top_down ? row(i) : row(height_ - i - 1); // bottom-up files are read in inverted row order
+
+         std::memcpy(data_ptr,itr,row_length());
+
+         itr += row_length() + row_padding;
+      }
+
+      return true;
+   }
+
+   bool load_from_stream(std::istream& stream)
+   {
+      bitmap_file_header bfh;
+      bitmap_information_header bih;
+      pixel_format format = bgr_format;
+
+      if (!read_header(stream,bfh,bih,format))
+         return false;
+
+      unsigned int width       = 0;
+      unsigned int height      = 0;
+      std::size_t  row_padding = 0;
+      bool         top_down    = false;
+
+      if (!read_layout(bih,width,height,row_padding,top_down))
+         return false;
+
+      // The header is checked against the data actually present before anything is allocated.
+      if (!pixels_available(stream_remaining(stream),width,height,format_bytes_per_pixel(format),row_padding))
+      {
+         std::cerr << "bitmap_image::load_from_stream() ERROR: bitmap_image - Truncated pixel data." << std::endl;
+         return false;
+      }
+
+      width_           = width;
+      height_          = height;
+      bytes_per_pixel_ = format_bytes_per_pixel(format);
+      pixel_format_    = format;
+
+      create_bitmap();
+
+      if ((row_length() + row_padding) == row_increment_)
+      {
+         // The row stride matches the file layout - read all rows at once.
+         if (0 != height_)
+         {
+            stream.read(reinterpret_cast<char*>(data_),length_ - row_padding);
+         }
+
+         if (!top_down)
+         {
+            vertical_flip();
+         }
+      }
+      else
+      {
+         for (unsigned int i = 0; i < height_; ++i)
+         {
+            unsigned char* data_ptr = top_down ? row(i) : row(height_ - i - 1); // bottom-up files are read in inverted row order
+
+            stream.read(reinterpret_cast<char*>(data_ptr),row_length());
+            stream.ignore(row_padding);
+         }
+      }
+
+      if (!stream)
+      {
+         std::cerr << "bitmap_image::load_from_stream() ERROR: bitmap_image - Truncated pixel data." << std::endl;
+         return false;
+      }
+
+      return true;
+   }
+
+   inline void set_all_ith_bits_low(const unsigned int bitr_index)
+   {
+      unsigned char mask = static_cast<unsigned char>(~(1 << bitr_index));
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      for (unsigned char* itr = row(y); itr != row(y) + row_increment_; ++itr)
+                      {
+                         *itr &= mask;
+                      }
+                   });
+   }
+
+   inline void set_all_ith_bits_high(const unsigned int bitr_index)
+   {
+      unsigned char mask = static_cast<unsigned char>(1 << bitr_index);
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      for (unsigned char* itr = row(y); itr != row(y) + row_increment_; ++itr)
+                      {
+                         *itr |= mask;
+                      }
+                   });
+   }
+
+   inline void set_all_ith_channels(const unsigned int& channel, const unsigned char& value)
+   {
+      if (channel >= bytes_per_pixel_)
+         return;
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      unsigned char* itr     = row(y) + channel;
+                      unsigned char* itr_end = row(y) + row_length();
+
+                      for ( ; itr < itr_end; itr += bytes_per_pixel_)
+                      {
+                         *itr = value;
+                      }
+                   });
+   }
+
+   inline void set_channel(const color_plane color,const unsigned char& value)
+   {
+      set_all_ith_channels(offset(color),value);
+   }
+
+   inline void ror_channel(const color_plane color, const unsigned int& ror)
+   {
+      const unsigned int color_plane_offset = offset(color);
+
+      if (color_plane_offset >= bytes_per_pixel_)
+         return;
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      unsigned char* itr     = row(y) + color_plane_offset;
+                      unsigned char* itr_end = row(y) + row_length();
+
+                      for ( ; itr < itr_end; itr += bytes_per_pixel_)
+                      {
+                         *itr = static_cast<unsigned char>(((*itr) >> ror) | ((*itr) << (8 - ror)));
+                      }
+                   });
+   }
+
+   inline void set_all_channels(const unsigned char& value)
+   {
+      for_each_row([&](const unsigned int y)
+                   {
+                      for (unsigned char* itr = row(y); itr < (row(y) + row_increment_); )
+                      {
+                         *(itr++) = value;
+                      }
+                   });
+   }
+
+   inline void set_all_channels(const unsigned char& r_value,
+                                const unsigned char& g_value,
+                                const unsigned char& b_value)
+   {
+      for_each_row([&](const unsigned int y)
+                   {
+                      unsigned char* itr     = row(y);
+                      unsigned char* itr_end = itr + row_length();
+
+                      for ( ; itr < itr_end; itr += bytes_per_pixel_)
+                      {
+                         *(itr + 0) = b_value;
+                         *(itr + 1) = g_value;
+                         *(itr + 2) = r_value;
+                      }
+                   });
+   }
+
+   inline void invert_color_planes()
+   {
+      for_each_row([&](const unsigned int y)
+                   {
+                      for (unsigned char* itr = row(y); itr < (row(y) + row_increment_); *itr = ~(*itr), ++itr);
+                   });
+   }
+
+   inline void apply_lut(const unsigned char red_table  [256],
+                         const unsigned char green_table[256],
+                         const unsigned char blue_table [256])
+   {
+      /*
+         Replaces every colour value v by table[v] of its channel in one
+         pass, alpha bytes are left untouched.
+      */
+
+      const bool rgb = (rgb_mode == channel_mode_);
+
+      const unsigned char* table[3] = {
+                                         rgb ? red_table  : blue_table,
+                                         green_table,
+                                         rgb ? blue_table : red_table
+                                      };
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      const unsigned char* t0 = table[0];
+                      const unsigned char* t1 = table[1];
+                      const unsigned char* t2 = table[2];
+
+                      const unsigned int bpp = bytes_per_pixel_;
+
+                      unsigned char* itr     = row(y);
+                      unsigned char* itr_end = itr + row_length();
+
+                      for ( ; itr < itr_end; itr += bpp)
+                      {
+                         itr[0] = t0[itr[0]];
+                         itr[1] = t1[itr[1]];
+                         itr[2] = t2[itr[2]];
+                      }
+                   });
+   }
+
+   inline void apply_lut(const unsigned char table[256])
+   {
+      apply_lut(table,table,table);
+   }
+
+   inline void add_to_color_plane(const color_plane color,const unsigned char& value)
+   {
+      const unsigned int color_plane_offset = offset(color);
+
+      if (color_plane_offset >= bytes_per_pixel_)
+         return;
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      unsigned char* itr     = row(y) + color_plane_offset;
+                      unsigned char* itr_end = row(y) + row_length();
+
+                      for ( ; itr < itr_end; (*itr) += value, itr += bytes_per_pixel_);
+                   });
+   }
+
+   inline void convert_to_grayscale()
+   {
+      view().convert_to_grayscale();
+   }
+
+   inline void convert_to_grayscale(unsigned char* gray) const
+   {
+      /*
+         Writes the luma of every pixel to a packed plane of
+         width * height bytes, leaving the image itself untouched.
+      */
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      gray_row(row(y),gray + static_cast<std::size_t>(y) * width_);
+                   });
+   }
+
+   inline const unsigned char* data()
+   {
+      return data_;
+   }
+
+   inline void bgr_to_rgb()
+   {
+      if ((bgr_mode == channel_mode_) && (3 <= bytes_per_pixel_))
+      {
+         reverse_channels();
+         channel_mode_ = rgb_mode;
+      }
+   }
+
+   inline void rgb_to_bgr()
+   {
+      if ((rgb_mode == channel_mode_) && (3 <= bytes_per_pixel_))
+      {
+         reverse_channels();
+         channel_mode_ = bgr_mode;
+      }
+   }
+
+   inline void reverse()
+   {
+      for (unsigned int y = 0; y < ((height_ + 1) / 2); ++y)
+      {
+         unsigned char* itr1 = row(y);
+         unsigned char* itr2 = row(height_ - y - 1) + row_length() - bytes_per_pixel_;
+
+         // The middle row of an odd height image is only reversed up to its centre.
+         const unsigned char* itr1_end = (row(y) == row(height_ - y - 1)) ?
+                                         itr1 + (width_ / 2) * bytes_per_pixel_ :
+                                         itr1 + row_length();
+
+         while (itr1 < itr1_end)
+         {
+            for (std::size_t i = 0; i < bytes_per_pixel_; ++i)
+            {
+               unsigned char* citr1 = itr1 + i;
+               unsigned char* citr2 = itr2 + i;
+               unsigned char tmp = *citr1;
+               *citr1 = *citr2;
+               *citr2 = tmp;
+            }
+
+            itr1 += bytes_per_pixel_;
+            itr2 -= bytes_per_pixel_;
+         }
+      }
+   }
+
+   inline void horizontal_flip()
+   {
+      view().horizontal_flip();
+   }
+
+   inline void vertical_flip()
+   {
+      view().vertical_flip();
+   }
+
+   inline void export_color_plane(const color_plane color, unsigned char* image)
+   {
+      const unsigned int color_plane_offset = offset(color);
+
+      if (color_plane_offset >= bytes_per_pixel_)
+         return;
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      const unsigned char* itr     = row(y) + color_plane_offset;
+                      const unsigned char* itr_end = row(y) + row_length();
+                            unsigned char* out     = image + static_cast<std::size_t>(y) * width_;
+
+                      for ( ; itr < itr_end; ++out, itr += bytes_per_pixel_)
+                      {
+                         (*out) = (*itr);
+                      }
+                   });
+   }
+
+   inline void export_color_plane(const color_plane color, bitmap_image& image)
+   {
+      if (
+           (width_  != image.width_ ) ||
+           (height_ != image.height_)
+         )
+      {
+         image.setwidth_height(width_,height_);
+      }
+
+      image.clear();
+
+      const unsigned int color_plane_offset = offset(color);
+
+      if (
+           (color_plane_offset >= bytes_per_pixel_) ||
+           (color_plane_offset >= image.bytes_per_pixel_)
+         )
+      {
+         return;
+      }
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      const unsigned char* itr1     = row(y) + color_plane_offset;
+                      const unsigned char* itr1_end = row(y) + row_length();
+                            unsigned char* itr2     = image.row(y) + color_plane_offset;
+
+                      while (itr1 < itr1_end)
+                      {
+                         (*itr2) = (*itr1);
+                         itr1 += bytes_per_pixel_;
+                         itr2 += image.bytes_per_pixel_;
+                      }
+                   });
+   }
+
+   inline void export_response_image(const color_plane color, double* response_image)
+   {
+      const unsigned int color_plane_offset = offset(color);
+
+      if (color_plane_offset >= bytes_per_pixel_)
+         return;
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      const unsigned char* itr     = row(y) + color_plane_offset;
+                      const unsigned char* itr_end = row(y) + row_length();
+                                   double* out     = response_image + static_cast<std::size_t>(y) * width_;
+
+                      for ( ; itr < itr_end; ++out, itr += bytes_per_pixel_)
+                      {
+                         (*out) = (1.0 * (*itr)) / 256.0;
+                      }
+                   });
+   }
+
+   inline void export_gray_scale_response_image(double* response_image)
+   {
+      for_each_row([&](const unsigned int y)
+                   {
+                      const unsigned char* itr     = row(y);
+                      const unsigned char* itr_end = itr + row_length();
+                                   double* out     = response_image + static_cast<std::size_t>(y) * width_;
+
+                      for ( ; itr < itr_end; ++out, itr += bytes_per_pixel_)
+                      {
+                         unsigned char gray_value = static_cast<unsigned char>((0.299 * (*(itr + 2))) +
+                                                                               (0.587 * (*(itr + 1))) +
+                                                                               (0.114 * (*(itr + 0))));
+                         (*out) = (1.0 * gray_value) / 256.0;
+                      }
+                   });
+   }
+
+   inline void export_rgb(double* red, double* green, double* blue) const
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      double* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::bytes_to_planes(row(r),bytes_per_pixel_,width_,planes,1.0 / 256.0);
+                   });
+   }
+
+   inline void export_rgb(float* red, float* green, float* blue) const
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      float* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::bytes_to_planes(row(r),bytes_per_pixel_,width_,planes,1.0f / 256.0f);
+                   });
+   }
+
+   inline void export_rgb(unsigned char* red, unsigned char* green, unsigned char* blue) const
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      unsigned char* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::bytes_to_planes(row(r),bytes_per_pixel_,width_,planes);
+                   });
+   }
+
+   inline void export_ycbcr(double* y, double* cb, double* cr)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const unsigned char* itr     = row(r);
+                      const unsigned char* itr_end = itr + row_length();
+
+                      for (std::size_t i = static_cast<std::size_t>(r) * width_; itr < itr_end; ++i, itr += bytes_per_pixel_)
+                      {
+                         double blue  = (1.0 * (*(itr + 0)));
+                         double green = (1.0 * (*(itr + 1)));
+                         double red   = (1.0 * (*(itr + 2)));
+
+                          y[i] = clamp<double>( 16.0 + (1.0/256.0) * (  65.738 * red + 129.057 * green +  25.064 * blue),1.0,254);
+                         cb[i] = clamp<double>(128.0 + (1.0/256.0) * (- 37.945 * red -  74.494 * green + 112.439 * blue),1.0,254);
+                         cr[i] = clamp<double>(128.0 + (1.0/256.0) * ( 112.439 * red -  94.154 * green -  18.285 * blue),1.0,254);
+                      }
+                   });
+   }
+
+   inline unsigned int chroma_width(const chroma_subsampling subsampling) const
+   {
+      return (chroma_444 == subsampling) ? width_ : (width_ + 1) / 2;
+   }
+
+   inline unsigned int chroma_height(const chroma_subsampling subsampling) const
+   {
+      return (chroma_420 == subsampling) ? (height_ + 1) / 2 : height_;
+   }
+
+   inline void export_ycbcr(unsigned char* y, unsigned char* cb, unsigned char* cr,
+                            const chroma_subsampling subsampling = chroma_420,
+                            const ycbcr_standard standard = ycbcr_bt601,
+                            std::size_t luma_stride = 0, std::size_t chroma_stride = 0) const
+   {
+      /*
+         Limited range 8-bit Y, Cb and Cr planes in Q15 fixed point, the
+         chroma of each 2x2 (4:2:0) or 2x1 (4:2:2) block computed from
+         the block's averaged colour. The planes are width x height and
+         chroma_width x chroma_height, a stride of 0 meaning rows are
+         packed. Odd edges repeat their last pixel.
+      */
+
+      if ((0 == width_) || (0 == height_))
+         return;
+
+      if (0 == luma_stride  ) luma_stride   = width_;
+      if (0 == chroma_stride) chroma_stride = chroma_width(subsampling);
+
+      const bitmap_details::ycbcr_coefficients k =
+         (ycbcr_bt709 == standard) ?
+         bitmap_details::make_ycbcr_coefficients(0.2126,0.0722,offset(red_plane),offset(green_plane),offset(blue_plane)) :
+         bitmap_details::make_ycbcr_coefficients(0.2990,0.1140,offset(red_plane),offset(green_plane),offset(blue_plane)) ;
+
+      const bool paired   = (chroma_444 != subsampling);
+      const bool two_rows = (chroma_420 == subsampling);
+
+      bitmap_details::parallel_rows(chroma_height(subsampling),two_rows ? 2 * width_ : width_,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       for (unsigned int j = first_row; j < last_row; ++j)
+                                       {
+                                          const unsigned int r0 = two_rows ? 2 * j : j;
+                                          const bool         r1 = two_rows && ((r0 + 1) < height_);
+
+                                          bitmap_details::ycbcr_row_pair(row(r0),row(r1 ? r0 + 1 : r0),bytes_per_pixel_,width_,
+                                                                         y + r0 * luma_stride,
+                                                                         r1 ? y + (r0 + 1) * luma_stride : 0,
+                                                                         cb + j * chroma_stride,
+                                                                         cr + j * chroma_stride,
+                                                                         k,paired);
+                                       }
+                                    });
+   }
+
+   inline void export_rgb_normal(double* red, double* green, double* blue) const
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      double* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::bytes_to_planes(row(r),bytes_per_pixel_,width_,planes,1.0);
+                   });
+   }
+
+   inline void export_rgb_normal(float* red, float* green, float* blue) const
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      float* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::bytes_to_planes(row(r),bytes_per_pixel_,width_,planes,1.0f);
+                   });
+   }
+
+   inline void import_rgb(double* red, double* green, double* blue)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      const double* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::planes_to_bytes(planes,row(r),bytes_per_pixel_,width_,256.0,0.0,false);
+                   });
+   }
+
+   inline void import_rgb(float* red, float* green, float* blue)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      const float* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::planes_to_bytes(planes,row(r),bytes_per_pixel_,width_,256.0f,0.0f,false);
+                   });
+   }
+
+   inline void import_rgb(unsigned char* red, unsigned char* green, unsigned char* blue)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      const unsigned char* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::planes_to_bytes(planes,row(r),bytes_per_pixel_,width_);
+                   });
+   }
+
+   inline void import_ycbcr(double* y, double* cb, double* cr)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      unsigned char* itr     = row(r);
+                      unsigned char* itr_end = itr + row_length();
+
+                      for (std::size_t i = static_cast<std::size_t>(r) * width_; itr < itr_end; ++i, itr += bytes_per_pixel_)
+                      {
+                         double y_  =  y[i];
+                         double cb_ = cb[i];
+                         double cr_ = cr[i];
+
+                         *(itr + 0) = static_cast<unsigned char>(clamp((298.082 * y_ + 516.412 * cb_                 ) / 256.0 - 276.836,0.0,255.0));
+                         *(itr + 1) = static_cast<unsigned char>(clamp((298.082 * y_ - 100.291 * cb_ - 208.120 * cr_ ) / 256.0 + 135.576,0.0,255.0));
+                         *(itr + 2) = static_cast<unsigned char>(clamp((298.082 * y_                 + 408.583 * cr_ ) / 256.0 - 222.921,0.0,255.0));
+                      }
+                   });
+   }
+
+   inline void import_rgb_clamped(double* red, double* green, double* blue)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      const double* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::planes_to_bytes(planes,row(r),bytes_per_pixel_,width_,256.0,0.0,true);
+                   });
+   }
+
+   inline void import_rgb_clamped(float* red, float* green, float* blue)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      const float* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::planes_to_bytes(planes,row(r),bytes_per_pixel_,width_,256.0f,0.0f,true);
+                   });
+   }
+
+   inline void import_rgb_normal(double* red, double* green, double* blue)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      const double* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::planes_to_bytes(planes,row(r),bytes_per_pixel_,width_,1.0,0.0,false);
+                   });
+   }
+
+   inline void import_rgb_normal(float* red, float* green, float* blue)
+   {
+      if (bgr_mode != channel_mode_)
+         return;
+
+      for_each_row([&](const unsigned int r)
+                   {
+                      const std::size_t i = static_cast<std::size_t>(r) * width_;
+
+                      const float* const planes[3] = { blue + i, green + i, red + i };
+
+                      bitmap_details::planes_to_bytes(planes,row(r),bytes_per_pixel_,width_,1.0f,0.0f,false);
+                   });
+   }
+
+   inline void convolve(const convolution_kernel& horizontal,
+                        const convolution_kernel& vertical,
+                        const border_mode border = border_clamp)
+   {
+      /*
+         Separable convolution of every channel, alpha included. Each
+         band of rows keeps a ring of 2r + 1 row-filtered rows that the
+         column pass reads, so the working set stays within the cache.
+         The fixed-point path is taken when both kernels are fixed-point.
+      */
+
+      if ((0 == width_) || (0 == height_))
+         return;
+
+      if (horizontal.fixed_point() && vertical.fixed_point())
+         convolve_separable(horizontal.fixed_weights(),vertical.fixed_weights(),border);
+      else
+         convolve_separable(horizontal.float_weights(),vertical.float_weights(),border);
+   }
+
+   inline void convolve(const convolution_kernel& kernel, const border_mode border = border_clamp)
+   {
+      convolve(kernel,kernel,border);
+   }
+
+   inline void gaussian_blur(const double& sigma, const border_mode border = border_clamp)
+   {
+      if (sigma <= 0.0)
+         return;
+
+      convolve(convolution_kernel::gaussian(sigma),border);
+   }
+
+   inline void box_blur(const unsigned int radius, const border_mode border = border_clamp)
+   {
+      /*
+         Mean of the (2r + 1) x (2r + 1) neighbourhood from running sums
+         along the rows and down the columns, the cost per pixel does
+         not depend on the radius.
+      */
+
+      if ((0 == width_) || (0 == height_) || (0 == radius))
+         return;
+
+      std::vector<unsigned char> halo;
+      std::vector<unsigned int>  slot;
+
+      copy_band_halo(radius,border,halo,slot);
+
+      const unsigned long long area = (2ULL * radius + 1) * (2ULL * radius + 1);
+
+      // (s * m) >> 48 equals s / area for every s < 256 * area while area < 2^20.
+      const bool               use_reciprocal = (area < (1ULL << 20));
+      const unsigned long long reciprocal     = ((1ULL << 48) / area) + 1;
+
+      for_each_band([&](const unsigned int first_row, const unsigned int last_row)
+                    {
+                       const std::size_t  length = row_length();
+                       const unsigned int bpp    = bytes_per_pixel_;
+
+                       std::vector<unsigned char>      extended((static_cast<std::size_t>(width_) + 2 * radius) * bpp);
+                       std::vector<unsigned long long> column_sum(length,0);
+
+                       // Row y is kept in slot (y + radius) mod (2r + 1) until it leaves the window.
+                       const std::size_t          window = 2 * static_cast<std::size_t>(radius) + 1;
+                       std::vector<unsigned char> ring(length * window);
+
+                       const auto accumulate_row = [&](const int y, const bool add)
+                       {
+                          unsigned char* slot_row = &ring[((y + radius) % window) * length];
+
+                          if (add)
+                          {
+                             const unsigned char* src = band_source(y,first_row,last_row,border,halo,slot);
+
+                             if (0 == src)
+                                std::fill(slot_row,slot_row + length,0);
+                             else
+                                std::copy(src,src + length,slot_row);
+                          }
+
+                          extend_row(slot_row,radius,border,&extended[0]);
+
+                          for (unsigned int c = 0; c < bpp; ++c)
+                          {
+                             unsigned int sum = 0;
+
+                             for (unsigned int k = 0; k <= 2 * radius; ++k)
+                             {
+                                sum += extended[k * bpp + c];
+                             }
+
+                             for (unsigned int x = 0; x < width_; ++x)
+                             {
+                                if (add)
+                                   column_sum[x * bpp + c] += sum;
+                                else
+                                   column_sum[x * bpp + c] -= sum;
+
+                                if ((x + 1) < width_)
+                                {
+                                   sum += extended[(x + 2 * radius + 1) * bpp + c];
+                                   sum -= extended[x * bpp + c];
+                                }
+                             }
+                          }
+                       };
+
+                       for (int y = static_cast<int>(first_row) - static_cast<int>(radius); y <= static_cast<int>(first_row + radius); ++y)
+                       {
+                          accumulate_row(y,true);
+                       }
+
+                       for (unsigned int y = first_row; y < last_row; ++y)
+                       {
+                          unsigned char* itr = row(y);
+
+                          for (std::size_t i = 0; i < length; ++i)
+                          {
+                             const unsigned long long sum = column_sum[i] + area / 2;
+
+                             itr[i] = static_cast<unsigned char>(use_reciprocal ? ((sum * reciprocal) >> 48) : (sum / area));
+                          }
+
+                          if ((y + 1) < last_row)
+                          {
+                             accumulate_row(static_cast<int>(y) - static_cast<int>(radius),false);
+                             accumulate_row(static_cast<int>(y + radius + 1),true );
+                          }
+                       }
+                    });
+   }
+
+   inline void sharpen(const double& amount, const double& sigma = 1.0, const border_mode border = border_clamp)
+   {
+      // Unsharp mask, v + amount * (v - gaussian(v)).
+      bitmap_image blurred(*this);
+
+      blurred.gaussian_blur(sigma,border);
+
+      const int a = static_cast<int>(std::floor(amount * 256.0 + 0.5));
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      unsigned char*       itr     = row(y);
+                      unsigned char*       itr_end = itr + row_length();
+                      const unsigned char* b_itr   = blurred.row(y);
+
+                      // Only the three colour bytes of a pixel are sharpened, alpha is kept.
+                      for ( ; itr < itr_end; itr += bytes_per_pixel_, b_itr += bytes_per_pixel_)
+                      {
+                         for (unsigned int k = 0; k < 3; ++k)
+                         {
+                            const int v = itr[k] + ((a * (itr[k] - b_itr[k]) + 128) >> 8);
+
+                            itr[k] = static_cast<unsigned char>(std::min(255,std::max(0,v)));
+                         }
+                      }
+                   });
+   }
+
+   inline void sobel(bitmap_image& edges) const
+   {
+      /*
+         Gradient magnitude of the luma, clamped to 255, written to the
+         colour channels of edges. Edge pixels are repeated at the border.
+      */
+
+      if (
+           (width_  != edges.width_ ) ||
+           (height_ != edges.height_)
+         )
+      {
+         edges.setwidth_height(width_,height_);
+      }
+
+      if ((0 == width_) || (0 == height_))
+         return;
+
+      std::vector<unsigned char> gray(static_cast<std::size_t>(width_) * height_);
+
+      convert_to_grayscale(&gray[0]);
+
+      const int w = static_cast<int>(width_);
+
+      edges.for_each_row([&](const unsigned int y)
+                         {
+                            const unsigned char* above = &gray[static_cast<std::size_t>((y > 0) ? y - 1 : y) * width_];
+                            const unsigned char* at    = &gray[static_cast<std::size_t>(y) * width_];
+                            const unsigned char* below = &gray[static_cast<std::size_t>(((y + 1) < height_) ? y + 1 : y) * width_];
+
+                            unsigned char* itr = edges.row(y);
+
+                            for (int x = 0; x < w; ++x, itr += edges.bytes_per_pixel_)
+                            {
+                               const int l = (x > 0) ? x - 1 : x;
+                               const int r = ((x + 1) < w) ? x + 1 : x;
+
+                               const int gx = (above[r] + 2 * at[r] + below[r]) - (above[l] + 2 * at[l] + below[l]);
+                               const int gy = (below[l] + 2 * below[x] + below[r]) - (above[l] + 2 * above[x] + above[r]);
+
+                               const unsigned char magnitude = static_cast<unsigned char>(std::min(255.0,std::sqrt(static_cast<double>(gx * gx + gy * gy)) + 0.5));
+
+                               itr[0] = magnitude;
+                               itr[1] = magnitude;
+                               itr[2] = magnitude;
+                            }
+                         });
+   }
+
+   inline void resize(bitmap_image& dest,
+                      const unsigned int new_width,
+                      const unsigned int new_height,
+                      const resample_filter filter = bicubic_filter) const
+   {
+      /*
+         Resamples to any size, each axis scaled independently. Downscaling
+         widens the filter so that it also antialiases. dest takes on the
+         pixel format of this image, alpha being resampled like colour.
+      */
+
+      if (&dest == this)
+      {
+         const bitmap_image image(*this);
+         image.resize(dest,new_width,new_height,filter);
+         return;
+      }
+
+      dest.bytes_per_pixel_ = bytes_per_pixel_;
+      dest.pixel_format_    = pixel_format_;
+      dest.channel_mode_    = channel_mode_;
+      dest.setwidth_height(new_width,new_height);
+
+      if ((0 == width_) || (0 == height_) || (0 == new_width) || (0 == new_height))
+         return;
+
+      double support = 0.0;
+      double (*kernel)(double) = 0;
+
+      switch (filter)
+      {
+         case bilinear_filter : support = 1.0; kernel = bitmap_details::bilinear_weight; break;
+         case lanczos_filter  : support = 3.0; kernel = bitmap_details::lanczos_weight;  break;
+         default              : support = 2.0; kernel = bitmap_details::bicubic_weight;  break;
+      }
+
+      bitmap_details::resample_table horizontal;
+      bitmap_details::resample_table vertical;
+
+      bitmap_details::build_resample_table(width_ ,new_width ,support,kernel,horizontal);
+      bitmap_details::build_resample_table(height_,new_height,support,kernel,vertical  );
+
+      /*
+         Both passes resample along rows and write their output transposed:
+         the first pass turns each source row into a column of the
+         intermediate, the second turns each intermediate row back into a
+         column of dest. Blocks of lines are transposed together so that
+         the writes stay in runs.
+      */
+
+      const unsigned int bpp   = bytes_per_pixel_;
+      const unsigned int block = 16;
+
+      const std::size_t intermediate_length = static_cast<std::size_t>(height_) + vertical.taps + 2;
+
+      std::vector<unsigned char> intermediate(static_cast<std::size_t>(new_width) * intermediate_length * bpp,0);
+
+      bitmap_details::parallel_rows(height_,width_ + new_width,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       std::vector<unsigned char> line((static_cast<std::size_t>(width_) + horizontal.taps + 2) * bpp,0);
+                                       std::vector<unsigned char> lines(static_cast<std::size_t>(block) * new_width * bpp);
+
+                                       for (unsigned int y0 = first_row; y0 < last_row; y0 += block)
+                                       {
+                                          const unsigned int count = std::min(block,last_row - y0);
+
+                                          for (unsigned int i = 0; i < count; ++i)
+                                          {
+                                             std::copy(row(y0 + i),row(y0 + i) + row_length(),line.begin());
+
+                                             bitmap_details::resample_row(&line[0],&lines[static_cast<std::size_t>(i) * new_width * bpp],bpp,horizontal);
+                                          }
+
+                                          transpose_lines(&lines[0],new_width,count,
+                                                          &intermediate[static_cast<std::size_t>(y0) * bpp],intermediate_length * bpp);
+                                       }
+                                    });
+
+      bitmap_details::parallel_rows(new_width,height_ + new_height,
+                                    [&](const unsigned int first_column, const unsigned int last_column)
+                                    {
+                                       std::vector<unsigned char> lines(static_cast<std::size_t>(block) * new_height * bpp);
+
+                                       for (unsigned int x0 = first_column; x0 < last_column; x0 += block)
+                                       {
+                                          const unsigned int count = std::min(block,last_column - x0);
+
+                                          for (unsigned int i = 0; i < count; ++i)
+                                          {
+                                             bitmap_details::resample_row(&intermediate[(x0 + i) * intermediate_length * bpp],
+                                                                          &lines[static_cast<std::size_t>(i) * new_height * bpp],bpp,vertical);
+                                          }
+
+                                          transpose_lines(&lines[0],new_height,count,
+                                                          dest.row(0) + x0 * bpp,dest.row_increment_);
+                                       }
+                                    });
+   }
+
+   inline void subsample(bitmap_image& dest)
+   {
+      /*
+         Half sub-sample of original image.
+      */
+      const unsigned int w = (width_  + 1) / 2;
+      const unsigned int h = (height_ + 1) / 2;
+
+      dest.bytes_per_pixel_ = bytes_per_pixel_;
+      dest.pixel_format_    = pixel_format_;
+      dest.channel_mode_    = channel_mode_;
+      dest.setwidth_height(w,h);
+
+      dest.for_each_row([&](const unsigned int j)
+                        {
+                           const unsigned char* row2 = ((2 * j + 1) < height_) ? row(2 * j + 1) : 0;
+
+                           bitmap_details::halve_row(row(2 * j),row2,dest.row(j),bytes_per_pixel_,0,w,width_);
+                        });
+   }
+
+   inline void upsample(bitmap_image& dest)
+   {
+      /*
+         2x up-sample of original image.
+      */
+
+      dest.bytes_per_pixel_ = bytes_per_pixel_;
+      dest.pixel_format_    = pixel_format_;
+      dest.channel_mode_    = channel_mode_;
+      dest.setwidth_height(2 * width_ ,2 * height_);
+      dest.clear();
+
+      const unsigned int bpp = bytes_per_pixel_;
+
+      for (unsigned int j = 0; j < height_; ++j)
+      {
+         const unsigned char* s_itr = row(j);
+               unsigned char* itr1  = dest.row(2 * j);
+               unsigned char* itr2  = dest.row(2 * j + 1);
+
+         for (unsigned int i = 0; i < width_; ++i, s_itr += bpp, itr1 += 2 * bpp, itr2 += 2 * bpp)
+         {
+            for (unsigned int k = 0; k < bpp; ++k)
+            {
+               *(itr1 + k) = *(s_itr + k); *(itr1 + bpp + k) = *(s_itr + k);
+               *(itr2 + k) = *(s_itr + k); *(itr2 + bpp + k) = *(s_itr + k);
+            }
+         }
+      }
+   }
+
+   inline void alpha_blend(const double& alpha, const bitmap_image& image)
+   {
+      view().alpha_blend(alpha,image.view());
+   }
+
+   inline void alpha_blend(const unsigned char* alpha_mask, const bitmap_image& image)
+   {
+      /*
+         Blends with a per-pixel weight taken from a packed plane of
+         width * height bytes, 255 selecting the given image entirely.
+      */
+
+      view().alpha_blend(alpha_mask,image.view());
+   }
+
+   inline void alpha_blend(const bitmap_image& image)
+   {
+      /*
+         Composites a 32-bit BGRA image over this one using its own
+         alpha channel. A destination alpha channel accumulates the
+         coverage, i.e. a + d * (1 - a).
+      */
+
+      view().alpha_blend(image.view());
+   }
+
+   inline double psnr(const bitmap_image& image) const
+   {
+      return view().psnr(image.view());
+   }
+
+   inline double psnr(const unsigned int& x,
+                      const unsigned int& y,
+                      const bitmap_image& image) const
+   {
+      if ((x + image.width()) > width_)   { return 0.0; }
+      if ((y + image.height()) > height_) { return 0.0; }
+
+      return view(x,y,image.width(),image.height()).psnr(image.view());
+   }
+
+   inline void histogram(const color_plane color, double hist[256])
+   {
+      std::fill(hist,hist + 256,0.0);
+
+      const unsigned int color_plane_offset = offset(color);
+
+      if (color_plane_offset >= bytes_per_pixel_)
+         return;
+
+      // Each band counts into its own table, merged exactly under the lock.
+      std::mutex merge_mutex;
+
+      for_each_band([&](const unsigned int first_row, const unsigned int last_row)
+                    {
+                       unsigned int counts[256] = { 0 };
+
+                       for (unsigned int y = first_row; y < last_row; ++y)
+                       {
+                          const unsigned char* itr     = row(y) + color_plane_offset;
+                          const unsigned char* itr_end = row(y) + row_length();
+
+                          for ( ; itr < itr_end; itr += bytes_per_pixel_)
+                          {
+                             ++counts[(*itr)];
+                          }
+                       }
+
+                       std::lock_guard<std::mutex> lock(merge_mutex);
+
+                       for (std::size_t i = 0; i < 256; ++i)
+                       {
+                          hist[i] += counts[i];
+                       }
+                    });
+   }
+
+   inline void histogram(color_histogram& hist) const
+   {
+      view().histogram(hist);
+   }
+
+   inline bool joint_histogram(const color_plane color1, const color_plane color2, std::vector<unsigned int>& hist) const
+   {
+      /*
+         Counts co-occurring values of two channels, the pair (v1,v2)
+         landing in hist[256 * v1 + v2].
+      */
+
+      hist.assign(256 * 256,0);
+
+      const unsigned int offset1 = offset(color1);
+      const unsigned int offset2 = offset(color2);
+
+      if ((offset1 >= bytes_per_pixel_) || (offset2 >= bytes_per_pixel_))
+         return false;
+
+      std::mutex merge_mutex;
+
+      for_each_band([&](const unsigned int first_row, const unsigned int last_row)
+                    {
+                       std::vector<unsigned int> counts(256 * 256,0);
+
+                       for (unsigned int y = first_row; y < last_row; ++y)
+                       {
+                          const unsigned char* itr     = row(y);
+                          const unsigned char* itr_end = itr + row_length();
+
+                          for ( ; itr < itr_end; itr += bytes_per_pixel_)
+                          {
+                             ++counts[(itr[offset1] << 8) + itr[offset2]];
+                          }
+                       }
+
+                       std::lock_guard<std::mutex> lock(merge_mutex);
+
+                       for (std::size_t i = 0; i < counts.size(); ++i)
+                       {
+                          hist[i] += counts[i];
+                       }
+                    });
+
+      return true;
+   }
+
+   inline void histogram_normalized(const color_plane color, double hist[256])
+   {
+      histogram(color,hist);
+
+      double* h_itr = hist;
+      const double* h_end = hist + 256;
+      const double pixel_count = static_cast<double>(width_ * height_);
+
+      while (h_end != h_itr)
+      {
+         *(h_itr++) /= pixel_count;
+      }
+   }
+
+   inline unsigned int offset(const color_plane color) const
+   {
+      return channel_offset(channel_mode_,color);
+   }
+
+   static inline unsigned int channel_offset(const channel_mode mode, const color_plane color)
+   {
+      switch (mode)
+      {
+         case rgb_mode : {
+                            switch (color)
+                            {
+                               case red_plane   : return 0;
+                               case green_plane : return 1;
+                               case blue_plane  : return 2;
+                               case alpha_plane : return 3;
+                               default          : return std::numeric_limits<unsigned int>::max();
+                            }
+                         }
+
+         case bgr_mode : {
+                            switch (color)
+                            {
+                               case red_plane   : return 2;
+                               case green_plane : return 1;
+                               case blue_plane  : return 0;
+                               case alpha_plane : return 3;
+                               default          : return std::numeric_limits<unsigned int>::max();
+                            }
+                         }
+
+         default       : return std::numeric_limits<unsigned int>::max();
+      }
+   }
+
+   inline void incremental()
+   {
+      unsigned char current_color = 0;
+
+      for (unsigned int y = 0; y < height_; ++y)
+      {
+         unsigned char* itr     = row(y);
+         unsigned char* itr_end = itr + row_length();
+
+         for ( ; itr < itr_end; itr += bytes_per_pixel_)
+         {
+            *(itr + 0) = (current_color);
+            *(itr + 1) = (current_color);
+            *(itr + 2) = (current_color);
+
+            ++current_color;
+         }
+      }
+   }
+
+private:
+
+   friend class bitmap_reader;
+   friend class bitmap_writer;
+   template <typename T> friend class planar_image;
+
+   struct bitmap_file_header
+   {
+      unsigned short type;
+      unsigned int   size;
+      unsigned short reserved1;
+      unsigned short reserved2;
+      unsigned int   off_bits;
+
+      unsigned int struct_size() const
+      {
+         return sizeof(type)      +
+                sizeof(size)      +
+                sizeof(reserved1) +
+                sizeof(reserved2) +
+                sizeof(off_bits);
+      }
+   };
+
+   struct bitmap_information_header
+   {
+      unsigned int   size;
+      unsigned int   width;
+      unsigned int   height;
+      unsigned short planes;
+      unsigned short bit_count;
+      unsigned int   compression;
+      unsigned int   size_image;
+      unsigned int   x_pels_per_meter;
+      unsigned int   y_pels_per_meter;
+      unsigned int   clr_used;
+      unsigned int   clr_important;
+
+      unsigned int struct_size() const
+      {
+         return sizeof(size)             +
+                sizeof(width)            +
+                sizeof(height)           +
+                sizeof(planes)           +
+                sizeof(bit_count)        +
+                sizeof(compression)      +
+                sizeof(size_image)       +
+                sizeof(x_pels_per_meter) +
+                sizeof(y_pels_per_meter) +
+                sizeof(clr_used)         +
+                sizeof(clr_important);
+      }
+   };
+
+   static inline bool big_endian()
+   {
+      unsigned int v = 0x01;
+
+      return (1 != reinterpret_cast<char*>(&v)[0]);
+   }
+
+   static inline unsigned short flip(const unsigned short& v)
+   {
+      return ((v >> 8) | (v << 8));
+   }
+
+   static inline unsigned int flip(const unsigned int& v)
+   {
+      return (((v & 0xFF000000) >> 0x18) |
+              ((v & 0x000000FF) << 0x18) |
+              ((v & 0x00FF0000) >> 0x08) |
+              ((v & 0x0000FF00) << 0x08));
+   }
+
+   template<typename T>
+   static inline void write_to_buffer(unsigned char*& buffer,const T& t)
+   {
+      std::memcpy(buffer,&t,sizeof(T));
+      buffer += sizeof(T);
+   }
+
+   template<typename T>
+   static inline void read_from_buffer(const unsigned char*& buffer,T& t)
+   {
+      std::memcpy(&t,buffer,sizeof(T));
+      buffer += sizeof(T);
+   }
+
+   static inline void read_bfh(const unsigned char* buffer, bitmap_file_header& bfh)
+   {
+      read_from_buffer(buffer,bfh.type);
+      read_from_buffer(buffer,bfh.size);
+      read_from_buffer(buffer,bfh.reserved1);
+      read_from_buffer(buffer,bfh.reserved2);
+      read_from_buffer(buffer,bfh.off_bits);
+
+      if (big_endian())
+      {
+         bfh.type      = flip(bfh.type);
+         bfh.size      = flip(bfh.size);
+         bfh.reserved1 = flip(bfh.reserved1);
+         bfh.reserved2 = flip(bfh.reserved2);
+         bfh.off_bits  = flip(bfh.off_bits);
+      }
+   }
+
+   static inline void write_bfh(unsigned char* buffer, const bitmap_file_header& bfh)
+   {
+      if (big_endian())
+      {
+         write_to_buffer(buffer,flip(bfh.type     ));
+         write_to_buffer(buffer,flip(bfh.size     ));
+         write_to_buffer(buffer,flip(bfh.reserved1));
+         write_to_buffer(buffer,flip(bfh.reserved2));
+         write_to_buffer(buffer,flip(bfh.off_bits ));
+      }
+      else
+      {
+         write_to_buffer(buffer,bfh.type     );
+         write_to_buffer(buffer,bfh.size     );
+         write_to_buffer(buffer,bfh.reserved1);
+         write_to_buffer(buffer,bfh.reserved2);
+         write_to_buffer(buffer,bfh.off_bits );
+      }
+   }
+
+   static inline void read_bih(const unsigned char* buffer,bitmap_information_header& bih)
+   {
+      read_from_buffer(buffer,bih.size  );
+      read_from_buffer(buffer,bih.width );
+      read_from_buffer(buffer,bih.height);
+      read_from_buffer(buffer,bih.planes);
+      read_from_buffer(buffer,bih.bit_count);
+      read_from_buffer(buffer,bih.compression);
+      read_from_buffer(buffer,bih.size_image);
+      read_from_buffer(buffer,bih.x_pels_per_meter);
+      read_from_buffer(buffer,bih.y_pels_per_meter);
+      read_from_buffer(buffer,bih.clr_used);
+      read_from_buffer(buffer,bih.clr_important);
+
+      if (big_endian())
+      {
+         bih.size        = flip(bih.size     );
+         bih.width       = flip(bih.width    );
+         bih.height      = flip(bih.height   );
+         bih.planes      = flip(bih.planes   );
+         bih.bit_count   = flip(bih.bit_count);
+         bih.compression = flip(bih.compression);
+         bih.size_image  = flip(bih.size_image);
+         bih.x_pels_per_meter = flip(bih.x_pels_per_meter);
+         bih.y_pels_per_meter = flip(bih.y_pels_per_meter);
+         bih.clr_used = flip(bih.clr_used);
+         bih.clr_important = flip(bih.clr_important);
+      }
+   }
+
+   static inline void write_bih(unsigned char* buffer, const bitmap_information_header& bih)
+   {
+      if (big_endian())
+      {
+         write_to_buffer(buffer,flip(bih.size));
+         write_to_buffer(buffer,flip(bih.width));
+         write_to_buffer(buffer,flip(bih.height));
+         write_to_buffer(buffer,flip(bih.planes));
+         write_to_buffer(buffer,flip(bih.bit_count));
+         write_to_buffer(buffer,flip(bih.compression));
+         write_to_buffer(buffer,flip(bih.size_image));
+         write_to_buffer(buffer,flip(bih.x_pels_per_meter));
+         write_to_buffer(buffer,flip(bih.y_pels_per_meter));
+         write_to_buffer(buffer,flip(bih.clr_used));
+         write_to_buffer(buffer,flip(bih.clr_important));
+      }
+      else
+      {
+         write_to_buffer(buffer,bih.size);
+         write_to_buffer(buffer,bih.width);
+         write_to_buffer(buffer,bih.height);
+         write_to_buffer(buffer,bih.planes);
+         write_to_buffer(buffer,bih.bit_count);
+         write_to_buffer(buffer,bih.compression);
+         write_to_buffer(buffer,bih.size_image);
+         write_to_buffer(buffer,bih.x_pels_per_meter);
+         write_to_buffer(buffer,bih.y_pels_per_meter);
+         write_to_buffer(buffer,bih.clr_used);
+         write_to_buffer(buffer,bih.clr_important);
+      }
+   }
+
+   void create_bitmap()
+   {
+      release_bitmap();
+
+      row_increment_ = aligned_row_increment(width_,bytes_per_pixel_,row_alignment_);
+      length_        = row_increment_ * height_;
+
+      data_ = allocator_->allocate(length_);
+   }
+
+   static inline std::size_t aligned_row_increment(const unsigned int width,
+                                                   const unsigned int bytes_per_pixel,
+                                                   const unsigned int alignment)
+   {
+      return ((static_cast<std::size_t>(width) * bytes_per_pixel + alignment - 1) / alignment) * alignment;
+   }
+
+   void release_bitmap()
+   {
+      #ifdef BITMAP_IMAGE_POSIX_IO
+      if (0 != mapping_)
+      {
+         ::munmap(mapping_,mapping_length_);
+
+         mapping_        = 0;
+         mapping_length_ = 0;
+         data_           = 0;
+
+         return;
+      }
+      #endif
+
+      if (0 != data_)
+      {
+         allocator_->deallocate(data_,length_);
+         data_ = 0;
+      }
+   }
+
+   void load_bitmap()
+   {
+      std::ifstream stream(file_name_.c_str(),std::ios::binary);
+
+      if (!stream)
+      {
+         std::cerr << "bitmap_image::load_bitmap() ERROR: bitmap_image - file " << file_name_ << " not found!" << std::endl;
+         return;
+      }
+
+      load_from_stream(stream);
+   }
+
+   void load_bitmap_mapped()
+   {
+      #ifdef BITMAP_IMAGE_POSIX_IO
+      const int fd = ::open(file_name_.c_str(),O_RDONLY);
+
+      if (fd < 0)
+      {
+         std::cerr << "bitmap_image::load_bitmap_mapped() ERROR: bitmap_image - file " << file_name_ << " not found!" << std::endl;
+         return;
+      }
+
+      struct stat file_status;
+
+      if ((0 != ::fstat(fd,&file_status)) || (0 == file_status.st_size))
+      {
+         ::close(fd);
+         std::cerr << "bitmap_image::load_bitmap_mapped() ERROR: bitmap_image - file " << file_name_ << " is empty!" << std::endl;
+         return;
+      }
+
+      const std::size_t mapping_length = static_cast<std::size_t>(file_status.st_size);
+
+      // A private mapping lets the image be modified in place without touching the file.
+      void* address = ::mmap(0,mapping_length,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0);
+
+      ::close(fd);
+
+      if (MAP_FAILED == address)
+      {
+         std::cerr << "bitmap_image::load_bitmap_mapped() ERROR: bitmap_image - failed to map file " << file_name_ << std::endl;
+         return;
+      }
+
+      unsigned char* buffer = static_cast<unsigned char*>(address);
+
+      bitmap_file_header bfh;
+      bitmap_information_header bih;
+      pixel_format format = bgr_format;
+
+      if (!parse_header(buffer,mapping_length,bfh,bih,format))
+      {
+         ::munmap(address,mapping_length);
+         return;
+      }
+
+      unsigned int width       = 0;
+      unsigned int height      = 0;
+      std::size_t  row_padding = 0;
+      bool         top_down    = false;
+
+      if (!read_layout(bih,width,height,row_padding,top_down))
+      {
+         ::munmap(address,mapping_length);
+         return;
+      }
+
+      /*
+         Top-down rows are used in place with the file's 4 byte row
+         stride. The image then spans every row padded, so a file
+         whose last row lacks its padding is copied instead.
+      */
+      const std::size_t file_row_increment = aligned_row_increment(width,format_bytes_per_pixel(format),4);
+
+      const bool in_place = top_down &&
+                            (bfh.off_bits <= mapping_length) &&
+                            ((0 == height) || (((mapping_length - bfh.off_bits) / height) >= file_row_increment));
+
+      if (in_place)
+      {
+         release_bitmap();
+
+         width_           = width;
+         height_          = height;
+         bytes_per_pixel_ = format_bytes_per_pixel(format);
+         pixel_format_    = format;
+         row_alignment_   = 4;
+         mapping_         = buffer;
+         mapping_length_  = mapping_length;
+         data_            = buffer + bfh.off_bits;
+         row_increment_   = aligned_row_increment(width_,bytes_per_pixel_,row_alignment_);
+         length_          = row_increment_ * height_;
+
+         return;
+      }
+
+      ::madvise(address,mapping_length,MADV_SEQUENTIAL);
+
+      load_from_memory(buffer,mapping_length);
+
+      ::munmap(address,mapping_length);
+      #else
+      load_bitmap();
+      #endif
+   }
+
+   enum header_constants {
+                            bi_rgb            =   0,
+                            bi_bitfields      =   3,
+                            bi_alphabitfields =   6,
+                            v4_header_size    = 108,
+                            max_header_size   = 65536,
+                            lcs_srgb          = 0x73524742
+                         };
+
+   static inline unsigned int format_bytes_per_pixel(const pixel_format format)
+   {
+      return (bgr_format == format) ? 3 : 4;
+   }
+
+   static void make_header(const unsigned int width,
+                           const unsigned int height,
+                           const pixel_format format,
+                           bitmap_file_header& bfh,
+                           bitmap_information_header& bih)
+   {
+      const unsigned int bytes_per_pixel = format_bytes_per_pixel(format);
+      const unsigned int row_bytes       = width * bytes_per_pixel;
+      const unsigned int padding         = (4 - (row_bytes % 4)) % 4;
+
+      // Alpha needs channel masks, which only a BITMAPV4HEADER or later can carry.
+      const bool alpha = (bgra_format == format);
+
+      bih.width            = width;
+      bih.height           = height;
+      bih.bit_count        = static_cast<unsigned short>(bytes_per_pixel << 3);
+      bih.clr_important    =  0;
+      bih.clr_used         =  0;
+      bih.compression      = alpha ? bi_bitfields : bi_rgb;
+      bih.planes           =  1;
+      bih.size             = alpha ? static_cast<unsigned int>(v4_header_size) : bih.struct_size();
+      bih.x_pels_per_meter =  0;
+      bih.y_pels_per_meter =  0;
+      bih.size_image       = (row_bytes + padding) * bih.height;
+
+      bfh.type      = 19778;
+      bfh.reserved1 = 0;
+      bfh.reserved2 = 0;
+      bfh.off_bits  = bih.size + bfh.struct_size();
+      bfh.size      = bfh.off_bits + bih.size_image;
+   }
+
+   static void write_header(unsigned char* buffer,
+                            const bitmap_file_header& bfh,
+                            const bitmap_information_header& bih)
+   {
+      write_bfh(buffer,bfh);
+      write_bih(buffer + bfh.struct_size(),bih);
+
+      if (bih.size <= bih.struct_size())
+         return;
+
+      // BITMAPV4HEADER tail: BGRA channel masks, sRGB colour space, no endpoints or gamma.
+      unsigned char* itr = buffer + bfh.struct_size() + bih.struct_size();
+
+      std::fill(itr,itr + (bih.size - bih.struct_size()),0x00);
+
+      const unsigned int fields[] = { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000, lcs_srgb };
+
+      for (std::size_t i = 0; i < (sizeof(fields) / sizeof(fields[0])); ++i)
+      {
+         write_to_buffer(itr,big_endian() ? flip(fields[i]) : fields[i]);
+      }
+   }
+
+   static inline unsigned int read_dword(const unsigned char* buffer)
+   {
+      unsigned int v = 0;
+
+      read_from_buffer(buffer,v);
+
+      return big_endian() ? flip(v) : v;
+   }
+
+   static bool parse_header(const unsigned char* buffer,
+                            const std::size_t length,
+                            bitmap_file_header& bfh,
+                            bitmap_information_header& bih,
+                            pixel_format& format)
+   {
+      if (length < (bfh.struct_size() + bih.struct_size()))
+      {
+         std::cerr << "bitmap_image::parse_header() ERROR: bitmap_image - Truncated header." << std::endl;
+         return false;
+      }
+
+      read_bfh(buffer,bfh);
+      read_bih(buffer + bfh.struct_size(),bih);
+
+      if (bfh.type != 19778)
+      {
+         std::cerr << "bitmap_image::parse_header() ERROR: bitmap_image - Invalid type value " << bfh.type << " expected 19778." << std::endl;
+         return false;
+      }
+
+      if ((bih.bit_count != 24) && (bih.bit_count != 32))
+      {
+         std::cerr << "bitmap_image::parse_header() ERROR: bitmap_image - Invalid bit depth " << bih.bit_count << " expected 24 or 32." << std::endl;
+         return false;
+      }
+
+      if ((bih.size < bih.struct_size()) || (bih.size > length))
+      {
+         std::cerr << "bitmap_image::parse_header() ERROR: bitmap_image - Invalid information header size " << bih.size << std::endl;
+         return false;
+      }
+
+      const bool bitfields = (32 == bih.bit_count) &&
+                             ((bi_bitfields == bih.compression) || (bi_alphabitfields == bih.compression));
+
+      if ((bi_rgb != bih.compression) && !bitfields)
+      {
+         std::cerr << "bitmap_image::parse_header() ERROR: bitmap_image - Unsupported compression " << bih.compression << std::endl;
+         return false;
+      }
+
+      /*
+         The channel masks directly follow the 40 byte header fields,
+         whether as part of a V4/V5 header or as a separate table. A
+         V4/V5 header always holds an alpha mask.
+      */
+      const bool        alpha_mask  = (bih.size >= 56) || (bi_alphabitfields == bih.compression);
+      const std::size_t masks_begin = bfh.struct_size() + bih.struct_size();
+      const std::size_t masks_end   = masks_begin + (bitfields ? (alpha_mask ? 16 : 12) : 0);
+      const std::size_t header_end  = std::max<std::size_t>(bfh.struct_size() + bih.size,masks_end);
+
+      if (length < header_end)
+      {
+         std::cerr << "bitmap_image::parse_header() ERROR: bitmap_image - Truncated header." << std::endl;
+         return false;
+      }
+
+      if (bfh.off_bits < header_end)
+      {
+         std::cerr << "bitmap_image::parse_header() ERROR: bitmap_image - Invalid pixel data offset " << bfh.off_bits << std::endl;
+         return false;
+      }
+
+      if (24 == bih.bit_count)
+         format = bgr_format;
+      else if (!bitfields)
+         format = bgrx_format;
+      else
+      {
+         const unsigned int red_mask   = read_dword(buffer + masks_begin + 0);
+         const unsigned int green_mask = read_dword(buffer + masks_begin + 4);
+         const unsigned int blue_mask  = read_dword(buffer + masks_begin + 8);
+         const unsigned int alpha      = alpha_mask ? read_dword(buffer + masks_begin + 12) : 0;
+
+         if (
+              (0x00FF0000 != red_mask  ) ||
+              (0x0000FF00 != green_mask) ||
+              (0x000000FF != blue_mask ) ||
+              ((0 != alpha) && (0xFF000000 != alpha))
+            )
+         {
+            std::cerr << "bitmap_image::parse_header() ERROR: bitmap_image - Unsupported channel masks, only BGRA byte order is supported." << std::endl;
+            return false;
+         }
+
+         format = (0 != alpha) ? bgra_format : bgrx_format;
+      }
+
+      return true;
+   }
+
+   static bool read_header(std::istream& stream,
+                           bitmap_file_header& bfh,
+                           bitmap_information_header& bih,
+                           pixel_format& format)
+   {
+      // Everything up to the pixel data (extended headers, channel masks) is consumed.
+      std::vector<unsigned char> header(bfh.struct_size() + bih.struct_size());
+
+      stream.read(reinterpret_cast<char*>(&header[0]),header.size());
+
+      std::size_t count = static_cast<std::size_t>(stream.gcount());
+
+      if (count == header.size())
+      {
+         read_bfh(&header[0],bfh);
+
+         if ((bfh.off_bits > count) && (bfh.off_bits <= max_header_size))
+         {
+            header.resize(bfh.off_bits);
+            stream.read(reinterpret_cast<char*>(&header[count]),bfh.off_bits - count);
+            count += static_cast<std::size_t>(stream.gcount());
+         }
+      }
+
+      if (!parse_header(&header[0],count,bfh,bih,format))
+         return false;
+
+      if (bfh.off_bits > count)
+      {
+         stream.ignore(bfh.off_bits - count);
+      }
+
+      return true;
+   }
+
+   static inline bool read_layout(const bitmap_information_header& bih,
+                                  unsigned int& width,
+                                  unsigned int& height,
+                                  std::size_t&  row_padding,
+                                  bool& top_down)
+   {
+      // A negative height denotes a top-down bitmap, INT_MIN has no positive counterpart.
+      if (0x80000000U == bih.height)
+      {
+         std::cerr << "bitmap_image::read_layout() ERROR: bitmap_image - Invalid height." << std::endl;
+         return false;
+      }
+
+      top_down = (0 != (bih.height & 0x80000000U));
+      width    = bih.width;
+      height   = top_down ? (0U - bih.height) : bih.height;
+
+      if (0 != (width & 0x80000000U))
+      {
+         std::cerr << "bitmap_image::read_layout() ERROR: bitmap_image - Invalid width." << std::endl;
+         return false;
+      }
+
+      // Byte offsets within a row are 32-bit, image sizes are checked against the data in 64 bits.
+      if ((static_cast<unsigned long long>(width) * (bih.bit_count >> 3)) > std::numeric_limits<unsigned int>::max())
+      {
+         std::cerr << "bitmap_image::read_layout() ERROR: bitmap_image - Width " << width << " is too large." << std::endl;
+         return false;
+      }
+
+      row_padding = (4 - (((bih.bit_count >> 3) * width) % 4)) % 4;
+
+      return true;
+   }
+
+   static inline bool pixels_available(const unsigned long long available,
+                                       const unsigned int width,
+                                       const unsigned int height,
+                                       const unsigned int bytes_per_pixel,
+                                       const std::size_t row_padding)
+   {
+      /*
+         The last row need not be padded. Sizes are 64-bit and divided
+         rather than multiplied, so no header can make them wrap.
+      */
+      const unsigned long long row_bytes      = bytes_per_pixel * static_cast<unsigned long long>(width);
+      const unsigned long long file_row_bytes = row_bytes + row_padding;
+
+      if (0 == height)
+         return true;
+
+      if (available < row_bytes)
+         return false;
+
+      return (0 == file_row_bytes) || (((available - row_bytes) / file_row_bytes) >= (height - 1));
+   }
+
+   static inline bool pixels_available(const bitmap_file_header& bfh,
+                                       const unsigned long long length,
+                                       const unsigned int width,
+                                       const unsigned int height,
+                                       const unsigned int bytes_per_pixel,
+                                       const std::size_t row_padding)
+   {
+      return (bfh.off_bits <= length) &&
+             pixels_available(length - bfh.off_bits,width,height,bytes_per_pixel,row_padding);
+   }
+
+   static inline unsigned long long stream_remaining(std::istream& stream)
+   {
+      // Bytes left in a seekable stream, or the maximum if its length cannot be told.
+      const std::istream::pos_type position = stream.tellg();
+
+      if (std::istream::pos_type(-1) == position)
+         return std::numeric_limits<unsigned long long>::max();
+
+      stream.seekg(0,std::ios::end);
+
+      const std::istream::pos_type end = stream.tellg();
+
+      stream.seekg(position);
+
+      if ((std::istream::pos_type(-1) == end) || (end < position) || !stream)
+      {
+         stream.clear();
+         stream.seekg(position);
+
+         return std::numeric_limits<unsigned long long>::max();
+      }
+
+      return static_cast<unsigned long long>(end - position);
+   }
+
+   template <typename T>
+   inline void convolve_separable(const std::vector<T>& horizontal,
+                                  const std::vector<T>& vertical,
+                                  const border_mode border)
+   {
+      const unsigned int h_taps   = static_cast<unsigned int>(horizontal.size());
+      const unsigned int h_radius = h_taps / 2;
+      const unsigned int v_taps   = static_cast<unsigned int>(vertical.size());
+      const unsigned int v_radius = v_taps / 2;
+
+      /*
+         Bands filter in place. A band reads each of its own rows before
+         writing it, rows beyond its edges come from the halo copies.
+      */
+      std::vector<unsigned char> halo;
+      std::vector<unsigned int>  slot;
+
+      copy_band_halo(v_radius,border,halo,slot);
+
+      for_each_band([&](const unsigned int first_row, const unsigned int last_row)
+                    {
+                       const std::size_t length = row_length();
+
+                       std::vector<unsigned char> extended((static_cast<std::size_t>(width_) + 2 * h_radius) * bytes_per_pixel_);
+                       std::vector<T>             ring(length * v_taps);
+                       std::vector<const T*>      window(v_taps);
+
+                       // Row y is filtered into ring slot (y + v_radius) mod v_taps.
+                       const auto filter_row = [&](const int y)
+                       {
+                          T* dst = &ring[((y + v_radius) % v_taps) * length];
+
+                          const unsigned char* src = band_source(y,first_row,last_row,border,halo,slot);
+
+                          if (0 == src)
+                          {
+                             std::fill(dst,dst + length,T(0));
+                             return;
+                          }
+
+                          extend_row(src,h_radius,border,&extended[0]);
+
+                          bitmap_details::convolve_row(&extended[0],dst,length,bytes_per_pixel_,&horizontal[0],h_taps);
+                       };
+
+                       for (int y = static_cast<int>(first_row) - static_cast<int>(v_radius); y < static_cast<int>(first_row + v_radius); ++y)
+                       {
+                          filter_row(y);
+                       }
+
+                       for (unsigned int y = first_row; y < last_row; ++y)
+                       {
+                          filter_row(static_cast<int>(y + v_radius));
+
+                          for (unsigned int k = 0; k < v_taps; ++k)
+                          {
+                             window[k] = &ring[((y + k) % v_taps) * length];
+                          }
+
+                          bitmap_details::convolve_column(&window[0],row(y),length,&vertical[0],v_taps);
+                       }
+                    });
+   }
+
+   static inline int border_index(const int i, const unsigned int n, const border_mode border)
+   {
+      // Source index for position i of a line of n pixels, -1 meaning zero.
+      const int size = static_cast<int>(n);
+
+      if ((i >= 0) && (i < size))
+         return i;
+
+      switch (border)
+      {
+         case border_clamp   : return (i < 0) ? 0 : size - 1;
+
+         case border_reflect : {
+                                  const int m = ((i % (2 * size)) + 2 * size) % (2 * size);
+                                  return (m < size) ? m : (2 * size - 1 - m);
+                               }
+
+         case border_wrap    : return ((i % size) + size) % size;
+
+         default             : return -1;
+      }
+   }
+
+   inline void transpose_lines(const unsigned char* lines, const unsigned int length, const unsigned int count,
+                               unsigned char* dest, const std::size_t dest_stride) const
+   {
+      // Pixel i of line j (lines being contiguous) goes to pixel j of dest row i.
+      const unsigned int bpp = bytes_per_pixel_;
+
+      for (unsigned int i = 0; i < length; ++i, dest += dest_stride)
+      {
+         const unsigned char* itr = lines + i * bpp;
+
+         for (unsigned int j = 0; j < count; ++j, itr += static_cast<std::size_t>(length) * bpp)
+         {
+            std::copy(itr,itr + bpp,dest + j * bpp);
+         }
+      }
+   }
+
+   inline void extend_row(const unsigned char* src, const unsigned int radius,
+                          const border_mode border, unsigned char* dst) const
+   {
+      // Copies a row with radius pixels of border on either side.
+      const unsigned int bpp = bytes_per_pixel_;
+
+      std::copy(src,src + row_length(),dst + radius * bpp);
+
+      for (unsigned int i = 0; i < radius; ++i)
+      {
+         const int left  = border_index(static_cast<int>(i) - static_cast<int>(radius),width_,border);
+         const int right = border_index(static_cast<int>(width_ + i),width_,border);
+
+         for (unsigned int c = 0; c < bpp; ++c)
+         {
+            dst[i * bpp + c]                    = (left  < 0) ? 0 : src[left  * bpp + c];
+            dst[(radius + width_ + i) * bpp + c] = (right < 0) ? 0 : src[right * bpp + c];
+         }
+      }
+   }
+
+   template <typename Function>
+   inline void for_each_band(const Function& function) const
+   {
+      // Calls function(first_row, last_row) on disjoint bands of rows, possibly concurrently.
+      bitmap_details::parallel_rows(height_,width_,function);
+   }
+
+   template <typename Function>
+   inline void for_each_row(const Function& function) const
+   {
+      bitmap_details::parallel_for_each_row(height_,width_,function);
+   }
+
+   inline void copy_band_halo(const unsigned int radius, const border_mode border,
+                              std::vector<unsigned char>& halo, std::vector<unsigned int>& slot) const
+   {
+      /*
+         Copies the rows that the bands of for_each_band read outside
+         themselves within radius rows, before any band overwrites them.
+         Row y is at halo[(slot[y] - 1) * row_length()], slot[y] being 0
+         for rows that are not copied.
+      */
+
+      const unsigned int band_rows = bitmap_details::band_rows(height_,width_);
+      const std::size_t  length    = row_length();
+
+      halo.clear();
+      slot.assign(height_,0);
+
+      const auto copy_rows = [&](const int first, const int last)
+      {
+         for (int i = first; i < last; ++i)
+         {
+            const int y = border_index(i,height_,border);
+
+            if ((y >= 0) && (0 == slot[y]))
+            {
+               halo.insert(halo.end(),row(y),row(y) + length);
+               slot[y] = static_cast<unsigned int>(halo.size() / length);
+            }
+         }
+      };
+
+      for (unsigned int first_row = 0; first_row < height_; first_row += band_rows)
+      {
+         const int first = static_cast<int>(first_row);
+         const int last  = static_cast<int>(std::min(height_,first_row + band_rows));
+
+         copy_rows(first - static_cast<int>(radius),first);
+         copy_rows(last,last + static_cast<int>(radius));
+      }
+   }
+
+   inline const unsigned char* band_source(const int y, const unsigned int first_row, const unsigned int last_row,
+                                           const border_mode border, const std::vector<unsigned char>& halo,
+                                           const std::vector<unsigned int>& slot) const
+   {
+      // Unfiltered row y for the band [first_row,last_row), null meaning zero.
+      if ((y >= static_cast<int>(first_row)) && (y < static_cast<int>(last_row)))
+         return row(y);
+
+      const int source_row = border_index(y,height_,border);
+
+      if (source_row < 0)
+         return 0;
+
+      return &halo[(slot[source_row] - 1) * row_length()];
+   }
+
+   inline void reverse_channels()
+   {
+      if (3 > bytes_per_pixel_)
+         return;
+
+      for_each_row([&](const unsigned int y)
+                   {
+                      unsigned char* itr     = row(y);
+                      unsigned char* itr_end = itr + row_length();
+
+                      for ( ; itr < itr_end; itr += bytes_per_pixel_)
+                      {
+                         unsigned char tmp = *(itr + 0);
+
+                         *(itr + 0) = *(itr + 2);
+                         *(itr + 2) = tmp;
+                      }
+                   });
+   }
+
+   static inline void convert_pixels(const unsigned char* src, const unsigned int src_bytes_per_pixel,
+                                           unsigned char* dst, const unsigned int dst_bytes_per_pixel,
+                                     const unsigned int count,
+                                     const bool fill_alpha)
+   {
+      // Copies count pixels between 24 and 32-bit layouts, new alpha bytes are opaque.
+      if ((src_bytes_per_pixel == dst_bytes_per_pixel) && !fill_alpha)
+      {
+         std::copy(src,src + count * src_bytes_per_pixel,dst);
+         return;
+      }
+
+      for (unsigned int i = 0; i < count; ++i, src += src_bytes_per_pixel, dst += dst_bytes_per_pixel)
+      {
+         dst[0] = src[0];
+         dst[1] = src[1];
+         dst[2] = src[2];
+
+         if (4 == dst_bytes_per_pixel)
+         {
+            dst[3] = ((4 == src_bytes_per_pixel) && !fill_alpha) ? src[3] : 0xFF;
+         }
+      }
+   }
+
+   inline void gray_row(const unsigned char* src, unsigned char* gray) const
+   {
+      gray_row(src,gray,width_,bytes_per_pixel_,channel_mode_);
+   }
+
+   static inline void gray_row(const unsigned char* src, unsigned char* gray,
+                               const unsigned int width, const unsigned int bpp,
+                               const channel_mode mode)
+   {
+      const bool rgb = (rgb_mode == mode);
+
+      bitmap_details::gray_row(src,gray,width,bpp,
+                               rgb ? bitmap_details::gray_weight_red  : bitmap_details::gray_weight_blue,
+                               bitmap_details::gray_weight_green,
+                               rgb ? bitmap_details::gray_weight_blue : bitmap_details::gray_weight_red);
+   }
+
+   inline std::size_t row_length() const
+   {
+      return static_cast<std::size_t>(width_) * bytes_per_pixel_;
+   }
+
+   template<typename T>
+   inline T clamp(const T& v, const T& lower_range, const T& upper_range)
+   {
+      if (v < lower_range)
+          return lower_range;
+      else if (v >  upper_range)
+         return upper_range;
+      else
+         return v;
+   }
+
+   std::string    file_name_;
+   unsigned char* data_;
+   std::size_t    length_;
+   unsigned int   width_;
+   unsigned int   height_;
+   std::size_t    row_increment_;
+   unsigned int   row_alignment_;
+   unsigned int   bytes_per_pixel_;
+   pixel_format   pixel_format_;
+   channel_mode   channel_mode_;
+   unsigned char* mapping_;
+   std::size_t    mapping_length_;
+   bitmap_allocator* allocator_;
+};
+
+
+class bitmap_reader
+{
+public:
+
+   /*
+      Streams the scanlines of a 24 or 32-bit bitmap file in top-down order
+      without loading the whole image. Only the rows of the band being
+      read are buffered, bottom-up files are handled by seeking.
+   */
+
+   bitmap_reader(const std::string& file_name)
+   : file_name_(file_name),
+     stream_(file_name.c_str(),std::ios::binary),
+     width_ (0),
+     height_(0),
+     bytes_per_pixel_(0),
+     pixel_format_(bitmap_image::bgr_format),
+     row_padding_ (0),
+     pixel_offset_(0),
+     next_row_(0),
+     top_down_(false),
+     valid_   (false)
+   {
+      if (!stream_)
+      {
+         std::cerr << "bitmap_reader::bitmap_reader() ERROR: bitmap_reader - file " << file_name_ << " not found!" << std::endl;
+         return;
+      }
+
+      bitmap_image::bitmap_file_header bfh;
+      bitmap_image::bitmap_information_header bih;
+
+      if (!bitmap_image::read_header(stream_,bfh,bih,pixel_format_))
+         return;
+
+      if (!bitmap_image::read_layout(bih,width_,height_,row_padding_,top_down_))
+         return;
+
+      bytes_per_pixel_ = bitmap_image::format_bytes_per_pixel(pixel_format_);
+      pixel_offset_    = bfh.off_bits;
+
+      if (!bitmap_image::pixels_available(bitmap_image::stream_remaining(stream_),width_,height_,bytes_per_pixel_,row_padding_))
+      {
+         std::cerr << "bitmap_reader::bitmap_reader() ERROR: bitmap_reader - Truncated pixel data in " << file_name_ << std::endl;
+         return;
+      }
+
+      valid_ = true;
+   }
+
+   inline bool operator!() const
+   {
+      return !valid_;
+   }
+
+   inline unsigned int width() const
+   {
+      return width_;
+   }
+
+   inline unsigned int height() const
+   {
+      return height_;
+   }
+
+   inline unsigned int bytes_per_pixel() const
+   {
+      return bytes_per_pixel_;
+   }
+
+   inline bitmap_image::pixel_format format() const
+   {
+      return pixel_format_;
+   }
+
+   inline std::size_t row_increment() const
+   {
+      return static_cast<std::size_t>(width_) * bytes_per_pixel_;
+   }
+
+   inline unsigned int current_row() const
+   {
+      return next_row_;
+   }
+
+   inline bool end() const
+   {
+      return (next_row_ >= height_);
+   }
+
+   inline void rewind()
+   {
+      next_row_ = 0;
+   }
+
+   inline bool read_row(const unsigned int row_index, unsigned char* row)
+   {
+      if (!read_rows(row_index,1))
+         return false;
+
+      copy_row(1,0,row);
+
+      return true;
+   }
+
+   inline bool next_row(unsigned char* row)
+   {
+      if (!read_row(next_row_,row))
+         return false;
+
+      ++next_row_;
+
+      return true;
+   }
+
+   inline bool read_band(const unsigned int first_row,
+                         const unsigned int row_count,
+                         bitmap_image& band)
+   {
+      if (
+           (band.width () != width_   ) ||
+           (band.height() != row_count) ||
+           (band.format() != pixel_format_)
+         )
+      {
+         band.pixel_format_    = pixel_format_;
+         band.bytes_per_pixel_ = bytes_per_pixel_;
+         band.setwidth_height(width_,row_count);
+      }
+
+      // Rows are delivered in file order, whatever mode the band was last used in.
+      band.channel_mode_ = bitmap_image::bgr_mode;
+
+      if (!read_rows(first_row,row_count))
+         return false;
+
+      for (unsigned int i = 0; i < row_count; ++i)
+      {
+         copy_row(row_count,i,band.row(i));
+      }
+
+      return true;
+   }
+
+   inline unsigned int next_band(const unsigned int row_count, bitmap_image& band)
+   {
+      if (end())
+         return 0;
+
+      const unsigned int rows = std::min(row_count,height_ - next_row_);
+
+      if (!read_band(next_row_,rows,band))
+         return 0;
+
+      next_row_ += rows;
+
+      return rows;
+   }
+
+private:
+
+   bitmap_reader(const bitmap_reader& br);
+   bitmap_reader& operator=(const bitmap_reader& br);
+
+   inline std::size_t file_row_bytes() const
+   {
+      return row_increment() + row_padding_;
+   }
+
+   bool read_rows(const unsigned int first_row, const unsigned int row_count)
+   {
+      if (
+           (!valid_)             ||
+           (0 == row_count)      ||
+           (first_row >= height_) ||
+           (row_count > (height_ - first_row))
+         )
+      {
+         return false;
+      }
+
+      // The requested rows occupy one contiguous block of the file in either storage order.
+      const unsigned int first_file_row = top_down_ ? first_row : (height_ - first_row - row_count);
+      const std::size_t  block_size     = row_count * file_row_bytes() - row_padding_;
+
+      // Rows of a zero width image hold no bytes, there is nothing to read.
+      if (0 == block_size)
+         return true;
+
+      buffer_.resize(block_size);
+
+      stream_.clear();
+      stream_.seekg(static_cast<std::streamoff>(pixel_offset_ + first_file_row * file_row_bytes()),std::ios::beg);
+      stream_.read(reinterpret_cast<char*>(&buffer_[0]),block_size);
+
+      if (!stream_)
+      {
+         std::cerr << "bitmap_reader::read_rows() ERROR: bitmap_reader - Truncated pixel data in " << file_name_ << std::endl;
+         return false;
+      }
+
+      return true;
+   }
+
+   inline void copy_row(const unsigned int row_count, const unsigned int i, unsigned char* dest) const
+   {
+      if (0 == row_increment())
+         return;
+
+      const unsigned char* src = &buffer_[0] + (top_down_ ? i : (row_count - i - 1)) * file_row_bytes();
+
+      std::memcpy(dest,src,row_increment());
+   }
+
+   std::string   file_name_;
+   std::ifstream stream_;
+   unsigned int  width_;
+   unsigned int  height_;
+   unsigned int  bytes_per_pixel_;
+   bitmap_image::pixel_format pixel_format_;
+   std::size_t   row_padding_;
+   std::size_t   pixel_offset_;
+   unsigned int  next_row_;
+   bool          top_down_;
+   bool          valid_;
+   std::vector<unsigned char> buffer_;
+};
+
+class bitmap_writer
+{
+public:
+
+   /*
+      Emits a 24 or 32-bit bitmap file band by band. The headers are
+      written up-front for the final image size, after which bands of
+      rows can be supplied in any order and are written straight to
+      their bottom-up file offsets.
+   */
+
+   bitmap_writer(const std::string& file_name,
+                 const unsigned int width,
+                 const unsigned int height,
+                 const bitmap_image::pixel_format format = bitmap_image::bgr_format)
+   : file_name_(file_name),
+     width_ (width),
+     height_(height),
+     bytes_per_pixel_(bitmap_image::format_bytes_per_pixel(format)),
+     pixel_format_(format),
+     row_padding_ ((4 - ((bytes_per_pixel_ * width) % 4)) % 4),
+     pixel_offset_(0),
+     #ifdef BITMAP_IMAGE_POSIX_IO
+     fd_(-1),
+     #endif
+     valid_(false)
+   {
+      bitmap_image::bitmap_file_header bfh;
+      bitmap_image::bitmap_information_header bih;
+
+      bitmap_image::make_header(width_,height_,pixel_format_,bfh,bih);
+
+      std::vector<unsigned char> header(bfh.off_bits);
+
+      bitmap_image::write_header(&header[0],bfh,bih);
+
+      pixel_offset_ = bfh.off_bits;
+
+      #ifdef BITMAP_IMAGE_POSIX_IO
+      fd_ = ::open(file_name_.c_str(),O_RDWR | O_CREAT | O_TRUNC,0644);
+
+      if (fd_ < 0)
+      {
+         std::cerr << "bitmap_writer::bitmap_writer() ERROR: bitmap_writer - Could not open file " << file_name_ << " for writing!" << std::endl;
+         return;
+      }
+
+      // Size the file up-front so rows that are never written read back as zero.
+      if (0 != ::ftruncate(fd_,static_cast<off_t>(bfh.size)))
+      {
+         std::cerr << "bitmap_writer::bitmap_writer() ERROR: bitmap_writer - Could not resize file " << file_name_ << std::endl;
+         return;
+      }
+      #else
+      stream_.open(file_name_.c_str(),std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+
+      if (!stream_)
+      {
+         std::cerr << "bitmap_writer::bitmap_writer() ERROR: bitmap_writer - Could not open file " << file_name_ << " for writing!" << std::endl;
+         return;
+      }
+      #endif
+
+      valid_ = write_block(0,&header[0],pixel_offset_);
+   }
+
+  ~bitmap_writer()
+   {
+      close();
+   }
+
+   inline bool operator!() const
+   {
+      return !valid_;
+   }
+
+   inline unsigned int width() const
+   {
+      return width_;
+   }
+
+   inline unsigned int height() const
+   {
+      return height_;
+   }
+
+   inline bitmap_image::pixel_format format() const
+   {
+      return pixel_format_;
+   }
+
+   inline bool write_row(const unsigned int row_index, const unsigned char* row)
+   {
+      if ((!valid_) || (row_index >= height_))
+         return false;
+
+      if (0 == file_row_bytes())
+         return true;
+
+      buffer_.resize(file_row_bytes());
+
+      std::memcpy(&buffer_[0],row,bytes_per_pixel_ * width_);
+      std::fill(buffer_.begin() + bytes_per_pixel_ * width_,buffer_.end(),0x00);
+
+      return write_block(row_offset(row_index),&buffer_[0],buffer_.size());
+   }
+
+   inline bool write_band(const unsigned int first_row, const bitmap_image& band)
+   {
+      if (
+           (!valid_)                        ||
+           (band.width() != width_)         ||
+           (first_row >= height_)           ||
+           (band.height() > (height_ - first_row))
+         )
+      {
+         return false;
+      }
+
+      const unsigned int row_count = band.height();
+
+      if ((0 == row_count) || (0 == file_row_bytes()))
+         return true;
+
+      // The band's rows form one contiguous block of the file, last row first.
+      buffer_.resize(row_count * file_row_bytes());
+
+      const bool fill_alpha = (bitmap_image::bgra_format == pixel_format_) &&
+                              (bitmap_image::bgra_format != band.format());
+
+      for (unsigned int i = 0; i < row_count; ++i)
+      {
+         unsigned char* itr = &buffer_[0] + (row_count - i - 1) * file_row_bytes();
+
+         bitmap_image::convert_pixels(band.row(i),band.bytes_per_pixel(),
+                                      itr,bytes_per_pixel_,
+                                      width_,fill_alpha);
+
+         // Files are always BGR ordered.
+         if (bitmap_image::rgb_mode == band.channel_mode_)
+         {
+            for (unsigned char* p = itr; p < (itr + bytes_per_pixel_ * width_); p += bytes_per_pixel_)
+            {
+               std::swap(p[0],p[2]);
+            }
+         }
+
+         std::fill(itr + bytes_per_pixel_ * width_,itr + file_row_bytes(),0x00);
+      }
+
+      return write_block(row_offset(first_row + row_count - 1),&buffer_[0],buffer_.size());
+   }
+
+   inline void close()
+   {
+      #ifdef BITMAP_IMAGE_POSIX_IO
+      if (fd_ >= 0)
+      {
+         ::close(fd_);
+         fd_ = -1;
+      }
+      #else
+      if (stream_.is_open())
+      {
+         stream_.close();
+      }
+      #endif
+
+      valid_ = false;
+   }
+
+private:
+
+   bitmap_writer(const bitmap_writer& bw);
+   bitmap_writer& operator=(const bitmap_writer& bw);
+
+   inline std::size_t file_row_bytes() const
+   {
+      return bytes_per_pixel_ * width_ + row_padding_;
+   }
+
+   inline std::size_t row_offset(const unsigned int row_index) const
+   {
+      return pixel_offset_ + (height_ - row_index - 1) * file_row_bytes();
+   }
+
+   bool write_block(const std::size_t offset, const unsigned char* data, const std::size_t size)
+   {
+      #ifdef BITMAP_IMAGE_POSIX_IO
+      std::size_t written = 0;
+
+      while (written < size)
+      {
+         const ssize_t result = ::pwrite(fd_,data + written,size - written,static_cast<off_t>(offset + written));
+
+         if (result < 0)
+         {
+            if (EINTR == errno)
+               continue;
+
+            std::cerr << "bitmap_writer::write_block() ERROR: bitmap_writer - Failed writing to file " << file_name_ << std::endl;
+            return false;
+         }
+
+         written += static_cast<std::size_t>(result);
+      }
+
+      return true;
+      #else
+      stream_.seekp(static_cast<std::streamoff>(offset),std::ios::beg);
+      stream_.write(reinterpret_cast<const char*>(data),size);
+
+      return !!stream_;
+      #endif
+   }
+
+   std::string  file_name_;
+   unsigned int width_;
+   unsigned int height_;
+   unsigned int bytes_per_pixel_;
+   bitmap_image::pixel_format pixel_format_;
+   std::size_t  row_padding_;
+   std::size_t  pixel_offset_;
+   #ifdef BITMAP_IMAGE_POSIX_IO
+   int          fd_;
+   #else
+   std::fstream stream_;
+   #endif
+   bool         valid_;
+   std::vector<unsigned char> buffer_;
+};
+
+inline void swap(bitmap_image& image1, bitmap_image& image2)
+{
+   image1.swap(image2);
+}
+
+struct rgb_store
+{
+   unsigned char red;
+   unsigned char green;
+   unsigned char blue;
+};
+
+inline void rgb_to_ycbcr(const unsigned int& length, double* red, double* green, double* blue,
+                                                     double* y,   double* cb,    double* cr)
+{
+   unsigned int i = 0;
+
+   while (i < length)
+   {
+      ( *y) =   16.0 + (  65.481 * (*red) +  128.553 * (*green) +  24.966 * (*blue));
+      (*cb) =  128.0 + ( -37.797 * (*red) +  -74.203 * (*green) + 112.000 * (*blue));
+      (*cr) =  128.0 + ( 112.000 * (*red) +  -93.786 * (*green) -  18.214 * (*blue));
+
+      ++i;
+      ++red; ++green; ++blue;
+      ++y;   ++cb;    ++cr;
+   }
+}
+
+inline void ycbcr_to_rgb(const unsigned int& length, double* y,   double* cb,    double* cr,
+                                                     double* red, double* green, double* blue)
+{
+   unsigned int i = 0;
+
+   while (i < length)
+   {
+      double y_  =  (*y) -  16.0;
+      double cb_ = (*cb) - 128.0;
+      double cr_ = (*cr) - 128.0;
+
+        (*red) = 0.000456621 * y_                    + 0.00625893 * cr_;
+      (*green) = 0.000456621 * y_ - 0.00153632 * cb_ - 0.00318811 * cr_;
+       (*blue) = 0.000456621 * y_                    + 0.00791071 * cb_;
+
+      ++i;
+      ++red; ++green; ++blue;
+      ++y;   ++cb;    ++cr;
+   }
+}
+
+inline void subsample(const unsigned int& width,
+                      const unsigned int& height,
+                      const double* source,
+                      unsigned int& w,
+                      unsigned int& h,
+                      double** dest)
+{
+   /*  Single channel.  */
+
+   w = 0;
+   h = 0;
+
+   bool odd_width = false;
+   bool odd_height = false;
+
+   if (0 == (width % 2))
+      w = width / 2;
+   else
+   {
+      w = 1 + (width / 2);
+      odd_width = true;
+   }
+
+   if (0 == (height % 2))
+      h = height / 2;
+   else
+   {
+      h = 1 + (height / 2);
+      odd_height = true;
+   }
+
+   unsigned int horizontal_upper = (odd_width)  ? w - 1 : w;
+   unsigned int vertical_upper   = (odd_height) ? h - 1 : h;
+
+   *dest = new double[w * h];
+
+   double* s_itr = *dest;
+   const double* itr1 = source;
+   const double* itr2 = source + width;
+
+   for (unsigned int j = 0; j < vertical_upper; ++j)
+   {
+      for (unsigned int i = 0; i < horizontal_upper; ++i, ++s_itr)
+      {
+          (*s_itr)  = *(itr1++);
+          (*s_itr) += *(itr1++);
+          (*s_itr) += *(itr2++);
+          (*s_itr) += *(itr2++);
+          (*s_itr) /=  4.0;
+      }
+
+      if (odd_width)
+      {
+         (*(s_itr++)) = ( (*itr1++) + (*itr2++) ) / 2.0;
+      }
+
+      itr1 += width;
+
+      if (j != (vertical_upper -1))
+      {
+         itr2 += width;
+      }
+   }
+
+   if (odd_height)
+   {
+      for (unsigned int i = 0; i < horizontal_upper; ++i, ++s_itr)
+      {
+         (*s_itr) += (*(itr1++));
+         (*s_itr) += (*(itr1++));
+         (*s_itr) /= 2.0;
+      }
+
+      if (odd_width)
+      {
+         (*(s_itr++)) = (*itr1);
+      }
+   }
+}
+
+inline void upsample(const unsigned int& width,
+                     const unsigned int& height,
+                     const double* source,
+                     unsigned int& w,
+                     unsigned int& h,
+                     double** dest)
+{
+   /* Single channel. */
+
+   w = 2 * width;
+   h = 2 * height;
+
+   *dest = new double[w * h];
+
+   const double* s_itr = source;
+         double* itr1  = *dest;
+         double* itr2  = *dest + w;
+
+   for (unsigned int j = 0; j < height; ++j)
+   {
+      for (unsigned int i = 0; i < width; ++i, ++s_itr)
+      {
+          *(itr1++) = (*s_itr);
+          *(itr1++) = (*s_itr);
+          *(itr2++) = (*s_itr);
+          *(itr2++) = (*s_itr);
+      }
+
+      itr1 += w;
+      itr2 += w;
+   }
+}
+
+inline void checkered_pattern(const unsigned int x_width,
+                              const unsigned int y_width,
+                              const unsigned char value,
+                              const bitmap_image::color_plane color,
+                              bitmap_image& image)
+{
+   if (
+        (x_width >= image.width ()) ||
+        (y_width >= image.height()) ||
+        (image.offset(color) >= image.bytes_per_pixel())
+      )
+   {
+      return;
+   }
+
+   bool setter_x = false;
+   bool setter_y = true;
+
+   const unsigned int color_plane_offset = image.offset(color);
+   const unsigned int height = image.height();
+   const unsigned int width  = image.width();
+
+   for (unsigned int y = 0; y < height; ++y)
+   {
+      if (0 == (y % y_width))
+      {
+         setter_y = !setter_y;
+      }
+
+      unsigned char* row = image.row(y) + color_plane_offset;
+
+      for (unsigned int x = 0; x < width; ++x, row += image.bytes_per_pixel())
+      {
+         if (0 == (x % x_width))
+         {
+            setter_x = !setter_x;
+         }
+
+         if (setter_x ^ setter_y)
+         {
+            *row = value;
+         }
+      }
+   }
+}
+
+inline void checkered_pattern(const unsigned int x_width,
+                              const unsigned int y_width,
+                              const unsigned char red,
+                              const unsigned char green,
+                              const unsigned char blue,
+                              bitmap_image& image)
+{
+   if (
+        (x_width >= image.width ()) ||
+        (y_width >= image.height())
+      )
+   {
+      return;
+   }
+
+   bool setter_x = false;
+   bool setter_y = true;
+
+   const unsigned int height = image.height();
+   const unsigned int width  = image.width();
+
+   for (unsigned int y = 0; y < height; ++y)
+   {
+      if (0 == (y % y_width))
+      {
+         setter_y = !setter_y;
+      }
+
+      unsigned char* row = image.row(y);
+
+      for (unsigned int x = 0; x < width; ++x, row += image.bytes_per_pixel())
+      {
+         if (0 == (x % x_width))
+         {
+            setter_x = !setter_x;
+         }
+
+         if (setter_x ^ setter_y)
+         {
+            *(row + 0) = blue;
+            *(row + 1) = green;
+            *(row + 2) = red;
+         }
+      }
+   }
+}
+
+inline void plasma(bitmap_image& image,
+                   const double& x,     const double& y,
+                   const double& width, const double& height,
+                   const double& c1,    const double& c2,
+                   const double& c3,    const double& c4,
+                   const double& roughness = 3.0,
+                   const rgb_store colormap[] = 0)
+{
+   // Note: c1,c2,c3,c4 -> [0.0,1.0]
+
+   double half_width  = ( width / 2.0);
+   double half_height = (height / 2.0);
+
+   if ((width >= 1.0) || (height >= 1.0))
+   {
+      double corner1 = (c1 + c2) / 2.0;
+      double corner2 = (c2 + c3) / 2.0;
+      double corner3 = (c3 + c4) / 2.0;
+      double corner4 = (c4 + c1) / 2.0;
+      double center  = (c1 + c2 + c3 + c4) / 4.0 +
+                       ((1.0 * ::rand() /(1.0 * RAND_MAX))  - 0.5) * // should use a better rng
+                       ((1.0 * half_width + half_height) / (image.width() + image.height()) * roughness);
+
+      center = std::min<double>(std::max<double>(0.0,center),1.0);
+
+      plasma(image, x,                            y, half_width, half_height,      c1, corner1,  center, corner4,roughness,colormap);
+      plasma(image, x + half_width,               y, half_width, half_height, corner1,      c2, corner2,  center,roughness,colormap);
+      plasma(image, x + half_width, y + half_height, half_width, half_height,  center, corner2,      c3, corner3,roughness,colormap);
+      plasma(image, x,              y + half_height, half_width, half_height, corner4,  center, corner3,      c4,roughness,colormap);
+   }
+   else
+   {
+      rgb_store color = colormap[static_cast<unsigned int>(1000.0 * ((c1 + c2 + c3 + c4) / 4.0)) % 1000];
+      image.set_pixel(static_cast<unsigned int>(x),static_cast<unsigned int>(y),color.red,color.green,color.blue);
+   }
+}
+
+inline double psnr_region(const unsigned int& x,     const unsigned int& y,
+                          const unsigned int& width, const unsigned int& height,
+                          const bitmap_image& image1, const bitmap_image& image2)
+{
+   if (
+        (image1.width()  != image2.width ()) ||
+        (image1.height() != image2.height())
+      )
+   {
+      return 0.0;
+   }
+
+   if ((x +  width) >  image1.width()) { return 0.0; }
+   if ((y + height) > image1.height()) { return 0.0; }
+
+   return image1.view(x,y,width,height).psnr(image2.view(x,y,width,height));
+}
+
+struct quality_metrics
+{
+   /*
+      Per-channel values are indexed by color_plane. Only the colour
+      channels enter the totals, alpha is reported separately for
+      32-bit image pairs.
+   */
+
+   double mse [4];
+   double psnr[4];
+   double mse_total;
+   double psnr_total;
+};
+
+inline bool measure_quality(const bitmap_image& image1, const bitmap_image& image2, quality_metrics& metrics)
+{
+   if (
+        (image1.width()  != image2.width ()) ||
+        (image1.height() != image2.height())
+      )
+   {
+      return false;
+   }
+
+   unsigned long long sums[4] = { 0, 0, 0, 0 };
+
+   bitmap_details::parallel_region_ssd(image1.row(0),image1.row_increment(),image1.bytes_per_pixel(),
+                                       image2.row(0),image2.row_increment(),image2.bytes_per_pixel(),
+                                       image1.width(),image1.height(),sums);
+
+   const double samples = static_cast<double>(image1.pixel_count());
+
+   const bitmap_image::color_plane planes[] = {
+                                                 bitmap_image::blue_plane,
+                                                 bitmap_image::green_plane,
+                                                 bitmap_image::red_plane,
+                                                 bitmap_image::alpha_plane
+                                              };
+
+   for (unsigned int i = 0; i < 4; ++i)
+   {
+      const unsigned int offset = image1.offset(planes[i]);
+
+      const bool present = (offset < image1.bytes_per_pixel()) && (offset < image2.bytes_per_pixel());
+
+      metrics.mse [i] = (present && (samples > 0.0)) ? (sums[offset] / samples) : 0.0;
+      metrics.psnr[i] = present ? bitmap_details::ssd_to_psnr(sums[offset],samples) : 0.0;
+   }
+
+   const unsigned long long total = sums[0] + sums[1] + sums[2];
+
+   metrics.mse_total  = (samples > 0.0) ? (total / (3.0 * samples)) : 0.0;
+   metrics.psnr_total = bitmap_details::ssd_to_psnr(total,3.0 * samples);
+
+   return true;
+}
+
+inline double ssim(const bitmap_image& image1, const bitmap_image& image2)
+{
+   /*
+      Mean structural similarity of the luma of both images, over 8x8
+      windows on a 4 pixel grid. Returns 0 for mismatched sizes.
+   */
+
+   if (
+        (image1.width()  != image2.width ()) ||
+        (image1.height() != image2.height()) ||
+        (0 == image1.pixel_count())
+      )
+   {
+      return 0.0;
+   }
+
+   std::vector<unsigned char> plane1(image1.pixel_count());
+   std::vector<unsigned char> plane2(image2.pixel_count());
+
+   image1.convert_to_grayscale(&plane1[0]);
+   image2.convert_to_grayscale(&plane2[0]);
+
+   double result = 0.0;
+   double contrast_structure = 0.0;
+
+   bitmap_details::ssim_plane(&plane1[0],&plane2[0],image1.width(),image1.height(),result,contrast_structure);
+
+   return result;
+}
+
+inline double ms_ssim(const bitmap_image& image1, const bitmap_image& image2)
+{
+   /*
+      Multi-scale SSIM over up to five dyadic scales with the weights
+      of Wang, Simoncelli and Bovik. Scales that would be smaller than
+      an 8x8 window are dropped and the remaining weights renormalised.
+   */
+
+   if (
+        (image1.width()  != image2.width ()) ||
+        (image1.height() != image2.height()) ||
+        (0 == image1.pixel_count())
+      )
+   {
+      return 0.0;
+   }
+
+   static const double weights[] = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+
+   unsigned int width  = image1.width();
+   unsigned int height = image1.height();
+
+   unsigned int scales = 1;
+
+   while ((scales < 5) && ((width >> scales) >= 8) && ((height >> scales) >= 8))
+   {
+      ++scales;
+   }
+
+   double weight_total = 0.0;
+
+   for (unsigned int i = 0; i < scales; ++i)
+   {
+      weight_total += weights[i];
+   }
+
+   std::vector<unsigned char> plane1(image1.pixel_count());
+   std::vector<unsigned char> plane2(image2.pixel_count());
+   std::vector<unsigned char> half;
+
+   image1.convert_to_grayscale(&plane1[0]);
+   image2.convert_to_grayscale(&plane2[0]);
+
+   double result = 1.0;
+
+   for (unsigned int i = 0; i < scales; ++i)
+   {
+      double scale_ssim = 0.0;
+      double scale_cs   = 0.0;
+
+      bitmap_details::ssim_plane(&plane1[0],&plane2[0],width,height,scale_ssim,scale_cs);
+
+      // Luminance only enters at the coarsest scale.
+      const double term = ((i + 1) == scales) ? scale_ssim : scale_cs;
+
+      result *= std::pow(std::max(term,0.0),weights[i] / weight_total);
+
+      if ((i + 1) < scales)
+      {
+         bitmap_details::half_plane(&plane1[0],width,height,half);
+         plane1.swap(half);
+
+         bitmap_details::half_plane(&plane2[0],width,height,half);
+         plane2.swap(half);
+
+         width  /= 2;
+         height /= 2;
+      }
+   }
+
+   return result;
+}
+
+class squared_error_table
+{
+public:
+
+   /*
+      Summed-area table of the per-pixel colour squared error between
+      two equally sized images. Built once in linear time, after which
+      the squared error, MSE and PSNR of any rectangle cost four
+      lookups. Alpha bytes are ignored, as in psnr_region.
+   */
+
+   squared_error_table()
+   : width_ (0),
+     height_(0)
+   {}
+
+   squared_error_table(const bitmap_image& image1, const bitmap_image& image2)
+   : width_ (0),
+     height_(0)
+   {
+      build(image1,image2);
+   }
+
+   inline bool build(const bitmap_image& image1, const bitmap_image& image2)
+   {
+      if (
+           (image1.width()  != image2.width ()) ||
+           (image1.height() != image2.height())
+         )
+      {
+         width_  = 0;
+         height_ = 0;
+         table_.clear();
+
+         return false;
+      }
+
+      width_  = image1.width ();
+      height_ = image1.height();
+
+      const std::size_t stride = static_cast<std::size_t>(width_) + 1;
+
+      table_.assign(stride * (static_cast<std::size_t>(height_) + 1),0);
+
+      if ((0 == width_) || (0 == height_))
+         return true;
+
+      const unsigned int bpp1 = image1.bytes_per_pixel();
+      const unsigned int bpp2 = image2.bytes_per_pixel();
+
+      /*
+         Each band of rows is integrated on its own, in a single pass.
+         The bottom rows of the bands are then made cumulative in order
+         and added to the remaining rows of the band below them.
+      */
+
+      std::vector<unsigned int> band_start;
+      std::mutex                band_mutex;
+
+      bitmap_details::parallel_rows(height_,width_,
+         [&](const unsigned int first_row, const unsigned int last_row)
+         {
+            std::vector<unsigned int> error(static_cast<std::size_t>(width_) * bpp1);
+
+            for (unsigned int y = first_row; y < last_row; ++y)
+            {
+               const unsigned char* itr1 = image1.row(y);
+               const unsigned char* itr2 = image2.row(y);
+
+               std::fill(error.begin(),error.end(),0);
+
+               if (bpp1 == bpp2)
+               {
+                  bitmap_details::accumulate_squares(itr1,itr2,&error[0],error.size());
+               }
+               else
+               {
+                  for (unsigned int x = 0; x < width_; ++x, itr1 += bpp1, itr2 += bpp2)
+                  {
+                     for (unsigned int k = 0; k < 3; ++k)
+                     {
+                        const int d = static_cast<int>(itr1[k]) - static_cast<int>(itr2[k]);
+
+                        error[x * bpp1 + k] = static_cast<unsigned int>(d * d);
+                     }
+                  }
+               }
+
+               const unsigned long long* above = &table_[y * stride];
+                     unsigned long long* itr   = &table_[(y + 1) * stride];
+
+               unsigned long long row_sum = 0;
+
+               for (unsigned int x = 0; x < width_; ++x)
+               {
+                  const unsigned int* e = &error[x * bpp1];
+
+                  row_sum += static_cast<unsigned long long>(e[0]) + e[1] + e[2];
+
+                  itr[x + 1] = row_sum + ((y != first_row) ? above[x + 1] : 0);
+               }
+            }
+
+            std::lock_guard<std::mutex> lock(band_mutex);
+
+            band_start.push_back(first_row);
+         });
+
+      if (band_start.size() < 2)
+         return true;
+
+      std::sort(band_start.begin(),band_start.end());
+
+      band_start.push_back(height_);
+
+      for (std::size_t k = 1; (k + 1) < band_start.size(); ++k)
+      {
+         const unsigned long long* carry = &table_[band_start[k] * stride];
+               unsigned long long* itr   = &table_[band_start[k + 1] * stride];
+
+         for (std::size_t x = 1; x < stride; ++x)
+         {
+            itr[x] += carry[x];
+         }
+      }
+
+      bitmap_details::parallel_rows(height_,width_,
+         [&](const unsigned int first_row, const unsigned int last_row)
+         {
+            for (unsigned int y = first_row; y < last_row; ++y)
+            {
+               // Band k holds rows [band_start[k], band_start[k + 1]), its bottom row is already done.
+               const std::size_t k = std::upper_bound(band_start.begin(),band_start.end(),y) - band_start.begin() - 1;
+
+               if ((0 == k) || ((y + 1) == band_start[k + 1]))
+                  continue;
+
+               const unsigned long long* carry = &table_[band_start[k] * stride];
+                     unsigned long long* itr   = &table_[(y + 1) * stride];
+
+               for (std::size_t x = 1; x < stride; ++x)
+               {
+                  itr[x] += carry[x];
+               }
+            }
+         });
+
+      return true;
+   }
+
+   inline unsigned int width() const
+   {
+      return width_;
+   }
+
+   inline unsigned int height() const
+   {
+      return height_;
+   }
+
+   inline unsigned long long squared_error(const unsigned int& x,     const unsigned int& y,
+                                           const unsigned int& width, const unsigned int& height) const
+   {
+      if (!contains(x,y,width,height))
+         return 0;
+
+      const std::size_t stride = static_cast<std::size_t>(width_) + 1;
+
+      const unsigned long long* top    = &table_[y * stride];
+      const unsigned long long* bottom = &table_[(y + height) * stride];
+
+      return bottom[x + width] - bottom[x] - top[x + width] + top[x];
+   }
+
+   inline double mse(const unsigned int& x,     const unsigned int& y,
+                     const unsigned int& width, const unsigned int& height) const
+   {
+      if (!contains(x,y,width,height) || (0 == width) || (0 == height))
+         return 0.0;
+
+      return squared_error(x,y,width,height) / (3.0 * width * height);
+   }
+
+   inline double psnr(const unsigned int& x,     const unsigned int& y,
+                      const unsigned int& width, const unsigned int& height) const
+   {
+      if (!contains(x,y,width,height))
+         return 0.0;
+
+      return bitmap_details::ssd_to_psnr(squared_error(x,y,width,height),3.0 * width * height);
+   }
+
+   inline double psnr() const
+   {
+      return psnr(0,0,width_,height_);
+   }
+
+private:
+
+   inline bool contains(const unsigned int& x,     const unsigned int& y,
+                        const unsigned int& width, const unsigned int& height) const
+   {
+      return (x <= width_ ) && (width  <= (width_  - x)) &&
+             (y <= height_) && (height <= (height_ - y));
+   }
+
+   unsigned int width_;
+   unsigned int height_;
+   std::vector<unsigned long long> table_;
+};
+
+inline void hierarchical_psnr_r(const double& x,     const double& y,
+                                const double& width, const double& height,
+                                const squared_error_table& table,
+                                      bitmap_image& image2,
+                                const double& threshold,
+                                const rgb_store colormap[])
+{
+   if ((width <= 4.0) || (height <= 4.0))
+   {
+      double psnr = table.psnr(static_cast<unsigned int>(x),
+                               static_cast<unsigned int>(y),
+                               static_cast<unsigned int>(width),
+                               static_cast<unsigned int>(height));
+
+      if (psnr < threshold)
+      {
+         rgb_store c = colormap[static_cast<unsigned int>(1000.0 * (1.0 - (psnr / threshold)))];
+         image2.set_region(static_cast<unsigned int>(x),
+                           static_cast<unsigned int>(y),
+                           static_cast<unsigned int>(width + 1),
+                           static_cast<unsigned int>(height + 1),
+                           c.red,c.green,c.blue);
+      }
+   }
+   else
+   {
+      double half_width  = ( width / 2.0);
+      double half_height = (height / 2.0);
+
+      hierarchical_psnr_r(x             , y              , half_width, half_height,table,image2,threshold,colormap);
+      hierarchical_psnr_r(x + half_width, y              , half_width, half_height,table,image2,threshold,colormap);
+      hierarchical_psnr_r(x + half_width, y + half_height, half_width, half_height,table,image2,threshold,colormap);
+      hierarchical_psnr_r(x             , y + half_height, half_width, half_height,table,image2,threshold,colormap);
+   }
+}
+
+inline void hierarchical_psnr(bitmap_image& image1,bitmap_image& image2, const double threshold, const rgb_store colormap[])
+{
+   if (
+        (image1.width()  != image2.width ()) ||
+        (image1.height() != image2.height())
+      )
+   {
+      return;
+   }
+
+   // Errors are taken before any painting, leaves never see earlier leaves' colours.
+   const squared_error_table table(image1,image2);
+
+   if (table.psnr() < threshold)
+   {
+      hierarchical_psnr_r(0,0, image1.width(), image1.height(),table,image2,threshold,colormap);
+   }
+}
+
+inline unsigned int quadtree_edge(const unsigned int index, const unsigned int extent, const unsigned int depth)
+{
+   // Boundary of tile index along a side of extent pixels split into 2^depth tiles.
+   return static_cast<unsigned int>((static_cast<unsigned long long>(index) * extent) >> depth);
+}
+
+inline void quadtree_squared_error(const bitmap_image& image1, const bitmap_image& image2,
+                                   const unsigned int depth,
+                                   std::vector<std::vector<unsigned long long> >& levels)
+{
+   /*
+      levels[d] holds the colour squared error of the 4^d tiles at
+      depth d in row major order. Only the leaves are measured, every
+      parent is the sum of its four children.
+   */
+
+   const unsigned int width  = image1.width ();
+   const unsigned int height = image1.height();
+   const unsigned int bpp1   = image1.bytes_per_pixel();
+   const unsigned int bpp2   = image2.bytes_per_pixel();
+
+   levels.resize(depth + 1);
+
+   for (unsigned int d = 0; d <= depth; ++d)
+   {
+      levels[d].assign(static_cast<std::size_t>(1) << (2 * d),0);
+   }
+
+   if ((0 == width) || (0 == height))
+      return;
+
+   const unsigned int tiles = 1U << depth;
+
+   bitmap_details::parallel_rows(tiles,static_cast<unsigned int>(std::min<unsigned long long>(
+                                         (static_cast<unsigned long long>(width) * height) >> depth,
+                                         std::numeric_limits<unsigned int>::max())),
+      [&](const unsigned int first_row, const unsigned int last_row)
+      {
+         // Column sums over at most 65536 rows cannot overflow 32 bits.
+         std::vector<unsigned int> column(static_cast<std::size_t>(width) * bpp1);
+
+         for (unsigned int ty = first_row; ty < last_row; ++ty)
+         {
+            unsigned long long* tile_row = &levels[depth][static_cast<std::size_t>(ty) * tiles];
+
+            const unsigned int y_end = quadtree_edge(ty + 1,height,depth);
+
+            for (unsigned int y = quadtree_edge(ty,height,depth); y < y_end; )
+            {
+               std::fill(column.begin(),column.end(),0);
+
+               for (const unsigned int flush = y + std::min(y_end - y,65536U); y < flush; ++y)
+               {
+                  const unsigned char* itr1 = image1.row(y);
+                  const unsigned char* itr2 = image2.row(y);
+
+                  if (bpp1 == bpp2)
+                  {
+                     bitmap_details::accumulate_squares(itr1,itr2,&column[0],column.size());
+                     continue;
+                  }
+
+                  for (unsigned int x = 0; x < width; ++x, itr1 += bpp1, itr2 += bpp2)
+                  {
+                     for (unsigned int k = 0; k < 3; ++k)
+                     {
+                        const int d = static_cast<int>(itr1[k]) - static_cast<int>(itr2[k]);
+
+                        column[x * bpp1 + k] += static_cast<unsigned int>(d * d);
+                     }
+                  }
+               }
+
+               for (unsigned int tx = 0, x = 0; tx < tiles; ++tx)
+               {
+                  unsigned long long sum = 0;
+
+                  for (const unsigned int x_end = quadtree_edge(tx + 1,width,depth); x < x_end; ++x)
+                  {
+                     const unsigned int* c = &column[x * bpp1];
+
+                     sum += static_cast<unsigned long long>(c[0]) + c[1] + c[2];
+                  }
+
+                  tile_row[tx] += sum;
+               }
+            }
+         }
+      });
+
+   for (unsigned int d = depth; d > 0; --d)
+   {
+      const std::size_t child_tiles  = static_cast<std::size_t>(1) << d;
+      const std::size_t parent_tiles = child_tiles / 2;
+
+      const std::vector<unsigned long long>& child  = levels[d];
+            std::vector<unsigned long long>& parent = levels[d - 1];
+
+      for (std::size_t i = 0; i < parent_tiles; ++i)
+      {
+         for (std::size_t j = 0; j < parent_tiles; ++j)
+         {
+            const std::size_t c = (2 * i) * child_tiles + (2 * j);
+
+            parent[i * parent_tiles + j] = child[c] + child[c + 1] + child[c + child_tiles] + child[c + child_tiles + 1];
+         }
+      }
+   }
+}
+
+inline void parallel_hierarchical_psnr(const bitmap_image& image1, bitmap_image& image2,
+                                       const double threshold, const rgb_store colormap[])
+{
+   /*
+      Quadtree variant of hierarchical_psnr. The image is split into an
+      exact partition of tiles down to the same depth, the squared error
+      of every tile is computed once from its leaves, and the tree is
+      then walked from the root with quadrants running as pool tasks.
+      A quadrant whose PSNR reaches the threshold is not descended, so
+      only leaves inside failing quadrants are painted. Painting happens
+      after all errors are known and tiles are disjoint, so the output
+      does not depend on the thread count.
+   */
+
+   if (
+        (image1.width()  != image2.width ()) ||
+        (image1.height() != image2.height()) ||
+        (threshold <= 0.0)
+      )
+   {
+      return;
+   }
+
+   const unsigned int width  = image1.width ();
+   const unsigned int height = image1.height();
+
+   // Depth at which hierarchical_psnr reaches a side of 4 pixels or less.
+   unsigned int depth = 0;
+
+   while (
+           ((4ULL << depth) < width ) &&
+           ((4ULL << depth) < height)
+         )
+   {
+      ++depth;
+   }
+
+   std::vector<std::vector<unsigned long long> > levels;
+
+   quadtree_squared_error(image1,image2,depth,levels);
+
+   std::function<void(unsigned int, unsigned int, unsigned int)> visit =
+      [&](const unsigned int d, const unsigned int i, const unsigned int j)
+      {
+         const unsigned int x0 = quadtree_edge(j    ,width ,d);
+         const unsigned int x1 = quadtree_edge(j + 1,width ,d);
+         const unsigned int y0 = quadtree_edge(i    ,height,d);
+         const unsigned int y1 = quadtree_edge(i + 1,height,d);
+
+         const double pixels = static_cast<double>(x1 - x0) * (y1 - y0);
+
+         if (0.0 == pixels)
+            return;
+
+         const double psnr = bitmap_details::ssd_to_psnr(levels[d][(static_cast<std::size_t>(i) << d) + j],3.0 * pixels);
+
+         if (psnr >= threshold)
+            return;
+
+         if (d == depth)
+         {
+            const unsigned int index = std::min(999U,static_cast<unsigned int>(1000.0 * (1.0 - (psnr / threshold))));
+
+            image2.set_region(x0,y0,x1 - x0,y1 - y0,colormap[index].red,colormap[index].green,colormap[index].blue);
+
+            return;
+         }
+
+         const std::function<void(unsigned int)> quadrant =
+            [&](const unsigned int k)
+            {
+               visit(d + 1,2 * i + (k >> 1),2 * j + (k & 1));
+            };
+
+         if ((pixels >= bitmap_details::grain_size()) && (bitmap_details::thread_count() > 1))
+         {
+            bitmap_details::shared_thread_pool().run(4,bitmap_details::thread_count() - 1,quadrant);
+         }
+         else
+         {
+            for (unsigned int k = 0; k < 4; ++k)
+            {
+               quadrant(k);
+            }
+         }
+      };
+
+   visit(0,0,0);
+}
+
+class lookup_table
+{
+public:
+
+   /*
+      Per-channel 256 entry tables mapping colour values, indexed by
+      color_plane. Each transform is applied to the outputs of the
+      table built so far, so a chain such as
+
+         lookup_table().gamma(1.0 / 2.2).contrast(1.2).add(10).apply(image);
+
+      changes the image exactly as the separate passes would, in a
+      single pass over the pixels.
+   */
+
+   lookup_table()
+   {
+      for (unsigned int c = 0; c < 3; ++c)
+      {
+         for (unsigned int v = 0; v < 256; ++v)
+         {
+            table_[c][v] = static_cast<unsigned char>(v);
+         }
+      }
+   }
+
+   explicit lookup_table(const unsigned char table[256])
+   {
+      for (unsigned int c = 0; c < 3; ++c)
+      {
+         std::copy(table,table + 256,table_[c]);
+      }
+   }
+
+   inline const unsigned char* table(const bitmap_image::color_plane color) const
+   {
+      return table_[color];
+   }
+
+   inline lookup_table& set(const bitmap_image::color_plane color, const unsigned char table[256])
+   {
+      std::copy(table,table + 256,table_[color]);
+      return *this;
+   }
+
+   inline lookup_table& then(const lookup_table& next)
+   {
+      for (unsigned int c = 0; c < 3; ++c)
+      {
+         for (unsigned int v = 0; v < 256; ++v)
+         {
+            table_[c][v] = next.table_[c][table_[c][v]];
+         }
+      }
+
+      return *this;
+   }
+
+   inline lookup_table& then(const unsigned char table[256])
+   {
+      return then(lookup_table(table));
+   }
+
+   inline lookup_table& gamma(const double& gamma)
+   {
+      // v -> 255 * (v / 255)^gamma
+      unsigned char table[256];
+
+      for (unsigned int v = 0; v < 256; ++v)
+      {
+         table[v] = to_value(255.0 * std::pow(v / 255.0,gamma));
+      }
+
+      return then(table);
+   }
+
+   inline lookup_table& contrast(const double& factor, const double& pivot = 127.5)
+   {
+      // Scales the distance from pivot by factor.
+      unsigned char table[256];
+
+      for (unsigned int v = 0; v < 256; ++v)
+      {
+         table[v] = to_value(pivot + factor * (v - pivot));
+      }
+
+      return then(table);
+   }
+
+   inline lookup_table& add(const int& value)
+   {
+      // Saturating, unlike add_to_color_plane.
+      unsigned char table[256];
+
+      for (int v = 0; v < 256; ++v)
+      {
+         table[v] = static_cast<unsigned char>(std::min(255,std::max(0,v + value)));
+      }
+
+      return then(table);
+   }
+
+   inline lookup_table& add(const bitmap_image::color_plane color, const int& value)
+   {
+      lookup_table next;
+
+      for (int v = 0; v < 256; ++v)
+      {
+         next.table_[color][v] = static_cast<unsigned char>(std::min(255,std::max(0,v + value)));
+      }
+
+      return then(next);
+   }
+
+   inline lookup_table& invert()
+   {
+      unsigned char table[256];
+
+      for (unsigned int v = 0; v < 256; ++v)
+      {
+         table[v] = static_cast<unsigned char>(255 - v);
+      }
+
+      return then(table);
+   }
+
+   inline lookup_table& equalize(const unsigned int hist[256])
+   {
+      // Maps every channel through the same cumulative distribution, e.g. that of the luma.
+      unsigned char table[256];
+
+      equalization_table(hist,table);
+
+      return then(table);
+   }
+
+   inline lookup_table& equalize(const bitmap_image::color_histogram& hist)
+   {
+      // Equalises each channel by its own distribution.
+      lookup_table next;
+
+      for (unsigned int c = 0; c < 3; ++c)
+      {
+         equalization_table(hist.channel[c],next.table_[c]);
+      }
+
+      return then(next);
+   }
+
+   inline void apply(bitmap_image& image) const
+   {
+      image.apply_lut(table_[bitmap_image::red_plane  ],
+                      table_[bitmap_image::green_plane],
+                      table_[bitmap_image::blue_plane ]);
+   }
+
+private:
+
+   static inline unsigned char to_value(const double& v)
+   {
+      if (v <= 0.0)
+         return 0;
+      else if (v >= 255.0)
+         return 255;
+      else
+         return static_cast<unsigned char>(v + 0.5);
+   }
+
+   static inline void equalization_table(const unsigned int hist[256], unsigned char table[256])
+   {
+      unsigned long long total = 0;
+
+      for (unsigned int v = 0; v < 256; ++v)
+      {
+         total += hist[v];
+      }
+
+      // The lowest value present maps to 0, cumulative counts above it spread over 0..255.
+      unsigned long long first = 0;
+
+      for (unsigned int v = 0; v < 256; ++v)
+      {
+         if (hist[v])
+         {
+            first = hist[v];
+            break;
+         }
+      }
+
+      unsigned long long cumulative = 0;
+
+      for (unsigned int v = 0; v < 256; ++v)
+      {
+         cumulative += hist[v];
+
+         if (total == first)
+            table[v] = static_cast<unsigned char>(v);
+         else if (cumulative < first)
+            table[v] = 0;
+         else
+            table[v] = static_cast<unsigned char>((255 * (cumulative - first) + (total - first) / 2) / (total - first));
+      }
+   }
+
+   unsigned char table_[3][256];
+};
+
+class image_pyramid
+{
+public:
+
+   /*
+      Every half sized level of an image, as made by repeated calls to
+      bitmap_image::subsample, down to 1x1. Level 0 is a copy of the
+      image. All levels share one allocation and are built in a single
+      pass: the image is walked in column strips, and each new row of a
+      level completes rows of the levels below it while its inputs are
+      still in cache.
+   */
+
+   struct view
+   {
+      unsigned char* data;
+      unsigned int   width;
+      unsigned int   height;
+      std::size_t    row_increment;
+
+      inline unsigned char* row(const unsigned int y) const
+      {
+         return data + (y * row_increment);
+      }
+   };
+
+   image_pyramid()
+   : bytes_per_pixel_(3),
+     pixel_format_(bitmap_image::bgr_format)
+   {}
+
+   explicit image_pyramid(const bitmap_image& image)
+   : bytes_per_pixel_(3),
+     pixel_format_(bitmap_image::bgr_format)
+   {
+      build(image);
+   }
+
+   image_pyramid(const image_pyramid& pyramid)
+   : bytes_per_pixel_(pyramid.bytes_per_pixel_),
+     pixel_format_   (pyramid.pixel_format_   ),
+     data_           (pyramid.data_           ),
+     levels_         (pyramid.levels_         )
+   {
+      rebase(pyramid);
+   }
+
+   image_pyramid& operator=(const image_pyramid& pyramid)
+   {
+      if (this != &pyramid)
+      {
+         bytes_per_pixel_ = pyramid.bytes_per_pixel_;
+         pixel_format_    = pyramid.pixel_format_;
+         data_            = pyramid.data_;
+         levels_          = pyramid.levels_;
+
+         rebase(pyramid);
+      }
+
+      return *this;
+   }
+
+   inline void build(const bitmap_image& image)
+   {
+      bytes_per_pixel_ = image.bytes_per_pixel();
+      pixel_format_    = image.format();
+
+      levels_.clear();
+      data_.clear();
+
+      if ((0 == image.width()) || (0 == image.height()))
+         return;
+
+      std::size_t length = 0;
+
+      unsigned int w = image.width ();
+      unsigned int h = image.height();
+
+      for ( ; ; )
+      {
+         view level;
+
+         level.data          = 0;
+         level.width         = w;
+         level.height        = h;
+         level.row_increment = static_cast<std::size_t>(w) * bytes_per_pixel_;
+
+         levels_.push_back(level);
+
+         length += level.row_increment * h;
+
+         if ((1 == w) && (1 == h))
+            break;
+
+         w = (w + 1) / 2;
+         h = (h + 1) / 2;
+      }
+
+      data_.resize(length);
+
+      length = 0;
+
+      for (std::size_t i = 0; i < levels_.size(); ++i)
+      {
+         levels_[i].data = &data_[length];
+         length += levels_[i].row_increment * levels_[i].height;
+      }
+
+      /*
+         A strip 2^strip_levels pixels wide at level 0 maps onto whole
+         strips down to level strip_levels, so strips are independent
+         until then. The few remaining levels are finished as one strip.
+      */
+
+      const unsigned int last_level   = static_cast<unsigned int>(levels_.size() - 1);
+      const unsigned int strip_levels = std::min(8U,last_level);
+      const unsigned int strip_width  = 1U << strip_levels;
+      const unsigned int strips       = (image.width() + strip_width - 1) / strip_width;
+
+      const auto build_strip = [&](const unsigned int strip)
+                               {
+                                  const unsigned int first = strip * strip_width;
+                                  const unsigned int last  = std::min(image.width(),first + strip_width);
+                                  const std::size_t  span  = static_cast<std::size_t>(last - first) * bytes_per_pixel_;
+
+                                  for (unsigned int y = 0; y < image.height(); ++y)
+                                  {
+                                     const unsigned char* itr = image.row(y) + first * bytes_per_pixel_;
+
+                                     std::copy(itr,itr + span,levels_[0].row(y) + first * bytes_per_pixel_);
+
+                                     reduce(0,y,first,last,strip_levels);
+                                  }
+                               };
+
+      const std::size_t pixels = static_cast<std::size_t>(image.width()) * image.height();
+
+      if ((strips > 1) && (bitmap_details::thread_count() > 1) && (pixels >= bitmap_details::grain_size()))
+      {
+         bitmap_details::shared_thread_pool().run(strips,bitmap_details::thread_count() - 1,build_strip);
+      }
+      else
+      {
+         for (unsigned int strip = 0; strip < strips; ++strip)
+         {
+            build_strip(strip);
+         }
+      }
+
+      for (unsigned int y = 0; y < levels_[strip_levels].height; ++y)
+      {
+         reduce(strip_levels,y,0,levels_[strip_levels].width,last_level);
+      }
+   }
+
+   inline std::size_t levels() const
+   {
+      return levels_.size();
+   }
+
+   inline const view& level(const std::size_t index) const
+   {
+      return levels_[index];
+   }
+
+   inline unsigned int bytes_per_pixel() const
+   {
+      return bytes_per_pixel_;
+   }
+
+   inline bitmap_image::pixel_format format() const
+   {
+      return pixel_format_;
+   }
+
+   inline bool export_level(const std::size_t index, bitmap_image& image) const
+   {
+      if (index >= levels_.size())
+         return false;
+
+      const view& level = levels_[index];
+
+      image.set_pixel_format(pixel_format_);
+      image.setwidth_height(level.width,level.height);
+
+      for (unsigned int y = 0; y < level.height; ++y)
+      {
+         std::copy(level.row(y),level.row(y) + level.row_increment,image.row(y));
+      }
+
+      return true;
+   }
+
+private:
+
+   inline void reduce(const unsigned int index, const unsigned int y,
+                      const unsigned int first, const unsigned int last,
+                      const unsigned int last_level)
+   {
+      // Row y of level index, columns [first,last), has just been written.
+      if (index == last_level)
+         return;
+
+      const view& level = levels_[index    ];
+      const view& below = levels_[index + 1];
+
+      if ((0 == (y % 2)) && ((y + 1) < level.height))
+         return;
+
+      const unsigned int j = y / 2;
+
+      const unsigned char* row2 = ((2 * j + 1) < level.height) ? level.row(2 * j + 1) : 0;
+
+      bitmap_details::halve_row(level.row(2 * j),row2,below.row(j),bytes_per_pixel_,
+                                first / 2,(last + 1) / 2,level.width);
+
+      reduce(index + 1,j,first / 2,(last + 1) / 2,last_level);
+   }
+
+   inline void rebase(const image_pyramid& pyramid)
+   {
+      for (std::size_t i = 0; i < levels_.size(); ++i)
+      {
+         levels_[i].data = &data_[0] + (pyramid.levels_[i].data - &pyramid.data_[0]);
+      }
+   }
+
+   unsigned int               bytes_per_pixel_;
+   bitmap_image::pixel_format pixel_format_;
+   std::vector<unsigned char> data_;
+   std::vector<view>          levels_;
+};
+
+template <typename T>
+class planar_image
+{
+public:
+
+   /*
+      Channels stored as separate planes, T being unsigned char, float
+      or double. Plane k holds byte k of each pixel of the image it was
+      made from: blue, green, red (red first in rgb_mode), then alpha
+      or the unused byte of 32-bit formats. The pixel format and channel
+      mode of that image are kept and restored by to_image. Every row
+      of every plane starts on a 64 byte boundary. Floating point
+      planes hold the same 0-255 values, which are rounded and clamped
+      on the way back to a bitmap_image.
+   */
+
+   template <typename U>
+   struct plane_view
+   {
+      U*           data;
+      unsigned int width;
+      unsigned int height;
+      std::size_t  stride;
+
+      inline U* row(const unsigned int y) const
+      {
+         return data + (y * stride);
+      }
+
+      inline U& operator()(const unsigned int x, const unsigned int y) const
+      {
+         return data[y * stride + x];
+      }
+   };
+
+   typedef plane_view<T>       view;
+   typedef plane_view<const T> const_view;
+
+   explicit planar_image(bitmap_allocator& allocator = default_bitmap_allocator())
+   : width_    (0),
+     height_   (0),
+     channels_ (0),
+     stride_   (0),
+     data_     (0),
+     pixel_format_(bitmap_image::bgr_format),
+     channel_mode_(bitmap_image::bgr_mode),
+     allocator_(&allocator)
+   {}
+
+   planar_image(const unsigned int width, const unsigned int height, const unsigned int channels = 3,
+                bitmap_allocator& allocator = default_bitmap_allocator())
+   : width_    (0),
+     height_   (0),
+     channels_ (0),
+     stride_   (0),
+     data_     (0),
+     pixel_format_(bitmap_image::bgr_format),
+     channel_mode_(bitmap_image::bgr_mode),
+     allocator_(&allocator)
+   {
+      create(width,height,channels);
+   }
+
+   explicit planar_image(const bitmap_image& image, bitmap_allocator& allocator = default_bitmap_allocator())
+   : width_    (0),
+     height_   (0),
+     channels_ (0),
+     stride_   (0),
+     data_     (0),
+     pixel_format_(bitmap_image::bgr_format),
+     channel_mode_(bitmap_image::bgr_mode),
+     allocator_(&allocator)
+   {
+      from_image(image);
+   }
+
+   planar_image(const planar_image& image)
+   : width_    (0),
+     height_   (0),
+     channels_ (0),
+     stride_   (0),
+     data_     (0),
+     pixel_format_(image.pixel_format_),
+     channel_mode_(image.channel_mode_),
+     allocator_(image.allocator_)
+   {
+      create(image.width_,image.height_,image.channels_);
+
+      pixel_format_ = image.pixel_format_;
+      channel_mode_ = image.channel_mode_;
+
+      if (data_)
+      {
+         std::memcpy(data_,image.data_,length());
+      }
+   }
+
+   planar_image(planar_image&& image)
+   : width_    (image.width_    ),
+     height_   (image.height_   ),
+     channels_ (image.channels_ ),
+     stride_   (image.stride_   ),
+     data_     (image.data_     ),
+     pixel_format_(image.pixel_format_),
+     channel_mode_(image.channel_mode_),
+     allocator_(image.allocator_)
+   {
+      image.width_    = 0;
+      image.height_   = 0;
+      image.channels_ = 0;
+      image.stride_   = 0;
+      image.data_     = 0;
+   }
+
+  ~planar_image()
+   {
+      release();
+   }
+
+   planar_image& operator=(const planar_image& image)
+   {
+      if (this != &image)
+      {
+         create(image.width_,image.height_,image.channels_);
+
+         pixel_format_ = image.pixel_format_;
+         channel_mode_ = image.channel_mode_;
+
+         if (data_)
+         {
+            std::memcpy(data_,image.data_,length());
+         }
+      }
+
+      return *this;
+   }
+
+   planar_image& operator=(planar_image&& image)
+   {
+      if (this != &image)
+      {
+         release();
+
+         std::swap(width_    ,image.width_    );
+         std::swap(height_   ,image.height_   );
+         std::swap(channels_ ,image.channels_ );
+         std::swap(stride_   ,image.stride_   );
+         std::swap(data_     ,image.data_     );
+         std::swap(pixel_format_,image.pixel_format_);
+         std::swap(channel_mode_,image.channel_mode_);
+         std::swap(allocator_,image.allocator_);
+      }
+
+      return *this;
+   }
+
+   inline void create(const unsigned int width, const unsigned int height, const unsigned int channels)
+   {
+      // Contents are undefined unless the dimensions are unchanged, the planes are taken as BGR(A).
+      pixel_format_ = (4 == channels) ? bitmap_image::bgra_format : bitmap_image::bgr_format;
+      channel_mode_ = bitmap_image::bgr_mode;
+
+      const std::size_t alignment = bitmap_allocator::buffer_alignment;
+
+      const std::size_t stride = ((static_cast<std::size_t>(width) * sizeof(T) + alignment - 1) / alignment) * (alignment / sizeof(T));
+
+      if ((width == width_) && (height == height_) && (channels == channels_) && (stride == stride_))
+         return;
+
+      release();
+
+      width_    = width;
+      height_   = height;
+      channels_ = channels;
+      stride_   = stride;
+
+      if (length())
+      {
+         data_ = reinterpret_cast<T*>(allocator_->allocate(length()));
+      }
+   }
+
+   inline unsigned int width() const
+   {
+      return width_;
+   }
+
+   inline unsigned int height() const
+   {
+      return height_;
+   }
+
+   inline unsigned int channels() const
+   {
+      return channels_;
+   }
+
+   inline std::size_t stride() const
+   {
+      return stride_;
+   }
+
+   inline T* row(const unsigned int channel, const unsigned int y)
+   {
+      return plane(channel) + (y * stride_);
+   }
+
+   inline const T* row(const unsigned int channel, const unsigned int y) const
+   {
+      return plane(channel) + (y * stride_);
+   }
+
+   inline view channel(const unsigned int index)
+   {
+      view v;
+
+      v.data   = plane(index);
+      v.width  = width_;
+      v.height = height_;
+      v.stride = stride_;
+
+      return v;
+   }
+
+   inline const_view channel(const unsigned int index) const
+   {
+      const_view v;
+
+      v.data   = plane(index);
+      v.width  = width_;
+      v.height = height_;
+      v.stride = stride_;
+
+      return v;
+   }
+
+   inline void from_image(const bitmap_image& image)
+   {
+      const unsigned int bpp = image.bytes_per_pixel();
+
+      create(image.width(),image.height(),bpp);
+
+      pixel_format_ = image.pixel_format_;
+      channel_mode_ = image.channel_mode_;
+
+      if (0 == data_)
+         return;
+
+      bitmap_details::parallel_rows(height_,width_,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       std::vector<unsigned char> bytes;
+
+                                       for (unsigned int y = first_row; y < last_row; ++y)
+                                       {
+                                          T* planes[4] = { 0, 0, 0, 0 };
+
+                                          for (unsigned int k = 0; k < channels_; ++k)
+                                          {
+                                             planes[k] = row(k,y);
+                                          }
+
+                                          import_row(image.row(y),planes,bpp,width_,bytes);
+                                       }
+                                    });
+   }
+
+   inline bool to_image(bitmap_image& image) const
+   {
+      /*
+         Three planes make a bgr_format image, four the 32-bit format of
+         the source image, bgra_format if there was none. The channel
+         mode of the source is restored as well.
+      */
+
+      if ((3 != channels_) && (4 != channels_))
+         return false;
+
+      image.set_pixel_format(pixel_format_);
+
+      if ((image.width() != width_) || (image.height() != height_))
+      {
+         image.setwidth_height(width_,height_);
+      }
+
+      bitmap_details::parallel_rows(height_,width_,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       std::vector<unsigned char> bytes;
+
+                                       for (unsigned int y = first_row; y < last_row; ++y)
+                                       {
+                                          const T* planes[4] = { 0, 0, 0, 0 };
+
+                                          for (unsigned int k = 0; k < channels_; ++k)
+                                          {
+                                             planes[k] = row(k,y);
+                                          }
+
+                                          export_row(planes,image.row(y),channels_,width_,bytes);
+                                       }
+                                    });
+
+      // The bytes are written as stored, so the mode is set rather than converted to.
+      image.channel_mode_ = channel_mode_;
 
-   w = 2 * width;
-   h = 2 * height;
+      return true;
+   }
 
-   *dest = new double[w * h];
+private:
 
-   const double* s_itr = source;
-         double* itr1  = *dest;
-         double* itr2  = *dest + w;
+   inline std::size_t length() const
+   {
+      return stride_ * height_ * channels_ * sizeof(T);
+   }
 
-   for (unsigned int j = 0; j < height; ++j)
+   inline T* plane(const unsigned int index) const
    {
-      for (unsigned int i = 0; i < width; ++i, ++s_itr)
+      return data_ + (index * stride_ * height_);
+   }
+
+   inline void release()
+   {
+      if (data_)
       {
-          *(itr1++) = (*s_itr);
-          *(itr1++) = (*s_itr);
-          *(itr2++) = (*s_itr);
-          *(itr2++) = (*s_itr);
+         allocator_->deallocate(reinterpret_cast<unsigned char*>(data_),length());
+         data_ = 0;
       }
 
-      itr1 += w;
-      itr2 += w;
+      width_    = 0;
+      height_   = 0;
+      channels_ = 0;
+      stride_   = 0;
    }
-}
 
-inline void checkered_pattern(const unsigned int x_width,
-                              const unsigned int y_width,
-                              const unsigned char value,
-                              const bitmap_image::color_plane color,
-                              bitmap_image& image)
-{
-   if (
-        (x_width >= image.width ()) ||
-        (y_width >= image.height())
-      )
+   static inline unsigned char to_byte(const unsigned char value)
    {
-      return;
+      return value;
    }
 
-   bool setter_x = false;
-   bool setter_y = true;
+   static inline unsigned char to_byte(const float value)
+   {
+      return (!(value > 0.0f)) ? 0 : ((value >= 255.0f) ? 255 : static_cast<unsigned char>(value + 0.5f));
+   }
 
-   const unsigned int color_plane_offset = image.offset(color);
-   const unsigned int height = image.height();
-   const unsigned int width  = image.width();
+   static inline unsigned char to_byte(const double value)
+   {
+      return (!(value > 0.0)) ? 0 : ((value >= 255.0) ? 255 : static_cast<unsigned char>(value + 0.5));
+   }
 
-   for (unsigned int y = 0; y < height; ++y)
+   static inline void import_row(const unsigned char* src, unsigned char* const planes[],
+                                 const unsigned int bpp, const unsigned int width,
+                                 std::vector<unsigned char>&)
    {
-      if (0 == (y % y_width))
-      {
-         setter_y = !setter_y;
-      }
+      bitmap_details::deinterleave_row(src,planes,bpp,width);
+   }
 
-      unsigned char* row = image.row(y) + color_plane_offset;
+   template <typename U>
+   static inline void import_row(const unsigned char* src, U* const planes[],
+                                 const unsigned int bpp, const unsigned int width,
+                                 std::vector<unsigned char>&)
+   {
+      bitmap_details::bytes_to_planes(src,bpp,width,planes,U(1));
 
-      for (unsigned int x = 0; x < width; ++x, row += image.bytes_per_pixel())
+      for (unsigned int k = 3; k < bpp; ++k)
       {
-         if (0 == (x % x_width))
+         for (unsigned int x = 0; x < width; ++x)
          {
-            setter_x = !setter_x;
+            planes[k][x] = static_cast<U>(src[x * bpp + k]);
          }
+      }
+   }
 
-         if (setter_x ^ setter_y)
+   static inline void export_row(const unsigned char* const planes[], unsigned char* dst,
+                                 const unsigned int bpp, const unsigned int width,
+                                 std::vector<unsigned char>&)
+   {
+      bitmap_details::interleave_row(planes,dst,bpp,width);
+   }
+
+   template <typename U>
+   static inline void export_row(const U* const planes[], unsigned char* dst,
+                                 const unsigned int bpp, const unsigned int width,
+                                 std::vector<unsigned char>&)
+   {
+      // Adding one half before clamping and truncating rounds as to_byte does.
+      bitmap_details::planes_to_bytes(planes,dst,bpp,width,U(1),U(0.5),true);
+
+      for (unsigned int k = 3; k < bpp; ++k)
+      {
+         for (unsigned int x = 0; x < width; ++x)
          {
-            *row = value;
+            dst[x * bpp + k] = to_byte(planes[k][x]);
          }
       }
    }
-}
 
-inline void checkered_pattern(const unsigned int x_width,
-                              const unsigned int y_width,
-                              const unsigned char red,
-                              const unsigned char green,
-                              const unsigned char blue,
-                              bitmap_image& image)
+   unsigned int      width_;
+   unsigned int      height_;
+   unsigned int      channels_;
+   std::size_t       stride_;
+   T*                data_;
+   bitmap_image::pixel_format pixel_format_;
+   bitmap_image::channel_mode channel_mode_;
+   bitmap_allocator* allocator_;
+};
+
+/*
+   Pixel layouts known at compile time, for basic_bitmap_image. Offsets
+   are byte positions within a pixel, alpha_offset being -1 for formats
+   without alpha.
+*/
+
+struct bgr24_format
 {
-   if (
-        (x_width >= image.width ()) ||
-        (y_width >= image.height())
-      )
+   enum {
+           bytes_per_pixel = 3,
+           blue_offset     = 0,
+           green_offset    = 1,
+           red_offset      = 2,
+           alpha_offset    = -1
+        };
+
+   static inline bitmap_image::pixel_format pixel_format() { return bitmap_image::bgr_format; }
+   static inline bitmap_image::channel_mode channel_mode() { return bitmap_image::bgr_mode;   }
+};
+
+struct rgb24_format
+{
+   enum {
+           bytes_per_pixel = 3,
+           red_offset      = 0,
+           green_offset    = 1,
+           blue_offset     = 2,
+           alpha_offset    = -1
+        };
+
+   static inline bitmap_image::pixel_format pixel_format() { return bitmap_image::bgr_format; }
+   static inline bitmap_image::channel_mode channel_mode() { return bitmap_image::rgb_mode;   }
+};
+
+struct bgra32_format
+{
+   enum {
+           bytes_per_pixel = 4,
+           blue_offset     = 0,
+           green_offset    = 1,
+           red_offset      = 2,
+           alpha_offset    = 3
+        };
+
+   static inline bitmap_image::pixel_format pixel_format() { return bitmap_image::bgra_format; }
+   static inline bitmap_image::channel_mode channel_mode() { return bitmap_image::bgr_mode;    }
+};
+
+struct rgba32_format
+{
+   enum {
+           bytes_per_pixel = 4,
+           red_offset      = 0,
+           green_offset    = 1,
+           blue_offset     = 2,
+           alpha_offset    = 3
+        };
+
+   static inline bitmap_image::pixel_format pixel_format() { return bitmap_image::bgra_format; }
+   static inline bitmap_image::channel_mode channel_mode() { return bitmap_image::rgb_mode;    }
+};
+
+template <typename Format>
+class basic_bitmap_image
+{
+public:
+
+   /*
+      A bitmap_image whose pixel layout is fixed by Format, so per pixel
+      loops here have a constant stride and constant channel offsets.
+      The wrapped image is converted to Format on construction. It is
+      exposed read-only through image(), and writable only through
+      view(), which cannot change the layout.
+   */
+
+   typedef Format format_type;
+
+   enum { bytes_per_pixel = Format::bytes_per_pixel };
+
+   basic_bitmap_image()
    {
-      return;
+      adopt();
    }
 
-   bool setter_x = false;
-   bool setter_y = true;
+   basic_bitmap_image(const unsigned int width, const unsigned int height)
+   : image_(width,height,Format::pixel_format())
+   {
+      adopt();
+   }
 
-   const unsigned int height = image.height();
-   const unsigned int width  = image.width();
+   explicit basic_bitmap_image(const std::string& file_name)
+   : image_(file_name)
+   {
+      adopt();
+   }
 
-   for (unsigned int y = 0; y < height; ++y)
+   explicit basic_bitmap_image(const bitmap_image& image)
+   : image_(image)
    {
-      if (0 == (y % y_width))
-      {
-         setter_y = !setter_y;
-      }
+      adopt();
+   }
 
-      unsigned char* row = image.row(y);
+   inline bool operator!()
+   {
+      return !image_;
+   }
 
-      for (unsigned int x = 0; x < width; ++x, row += image.bytes_per_pixel())
-      {
-         if (0 == (x % x_width))
-         {
-            setter_x = !setter_x;
-         }
+   inline const bitmap_image& image() const
+   {
+      return image_;
+   }
 
-         if (setter_x ^ setter_y)
-         {
-            *(row + 0) = blue;
-            *(row + 1) = green;
-            *(row + 2) = red;
-         }
-      }
+   inline bitmap_image::image_view view() const
+   {
+      return image_.view();
    }
-}
 
-inline void plasma(bitmap_image& image,
-                   const double& x,     const double& y,
-                   const double& width, const double& height,
-                   const double& c1,    const double& c2,
-                   const double& c3,    const double& c4,
-                   const double& roughness = 3.0,
-                   const rgb_store colormap[] = 0)
-{
-   // Note: c1,c2,c3,c4 -> [0.0,1.0]
+   inline unsigned int width() const
+   {
+      return image_.width();
+   }
 
-   double half_width  = ( width / 2.0);
-   double half_height = (height / 2.0);
+   inline unsigned int height() const
+   {
+      return image_.height();
+   }
 
-   if ((width >= 1.0) || (height >= 1.0))
+   inline unsigned char* row(const unsigned int y) const
    {
-      double corner1 = (c1 + c2) / 2.0;
-      double corner2 = (c2 + c3) / 2.0;
-      double corner3 = (c3 + c4) / 2.0;
-      double corner4 = (c4 + c1) / 2.0;
-      double center  = (c1 + c2 + c3 + c4) / 4.0 +
-                       ((1.0 * ::rand() /(1.0 * RAND_MAX))  - 0.5) * // should use a better rng
-                       ((1.0 * half_width + half_height) / (image.width() + image.height()) * roughness);
+      return image_.row(y);
+   }
 
-      center = std::min<double>(std::max<double>(0.0,center),1.0);
+   inline unsigned char* pixel(const unsigned int x, const unsigned int y) const
+   {
+      return image_.row(y) + x * bytes_per_pixel;
+   }
 
-      plasma(image, x,                            y, half_width, half_height,      c1, corner1,  center, corner4,roughness,colormap);
-      plasma(image, x + half_width,               y, half_width, half_height, corner1,      c2, corner2,  center,roughness,colormap);
-      plasma(image, x + half_width, y + half_height, half_width, half_height,  center, corner2,      c3, corner3,roughness,colormap);
-      plasma(image, x,              y + half_height, half_width, half_height, corner4,  center, corner3,      c4,roughness,colormap);
+   inline void get_pixel(const unsigned int x, const unsigned int y,
+                         unsigned char& red, unsigned char& green, unsigned char& blue) const
+   {
+      const unsigned char* itr = pixel(x,y);
+
+      red   = itr[Format::red_offset  ];
+      green = itr[Format::green_offset];
+      blue  = itr[Format::blue_offset ];
    }
-   else
+
+   inline void set_pixel(const unsigned int x, const unsigned int y,
+                         const unsigned char red, const unsigned char green, const unsigned char blue)
    {
-      rgb_store color = colormap[static_cast<unsigned int>(1000.0 * ((c1 + c2 + c3 + c4) / 4.0)) % 1000];
-      image.set_pixel(static_cast<unsigned int>(x),static_cast<unsigned int>(y),color.red,color.green,color.blue);
+      unsigned char* itr = pixel(x,y);
+
+      itr[Format::red_offset  ] = red;
+      itr[Format::green_offset] = green;
+      itr[Format::blue_offset ] = blue;
    }
-}
 
-inline double psnr_region(const unsigned int& x,     const unsigned int& y,
-                          const unsigned int& width, const unsigned int& height,
-                          const bitmap_image& image1, const bitmap_image& image2)
-{
-   if (
-        (image1.width()  != image2.width ()) ||
-        (image1.height() != image2.height())
-      )
+   inline unsigned char alpha(const unsigned int x, const unsigned int y) const
    {
-      return 0.0;
+      static_assert(Format::alpha_offset >= 0,"pixel format has no alpha channel");
+
+      return pixel(x,y)[Format::alpha_offset];
    }
 
-   if ((x +  width) >  image1.width()) { return 0.0; }
-   if ((y + height) > image1.height()) { return 0.0; }
+   inline void alpha(const unsigned int x, const unsigned int y, const unsigned char value)
+   {
+      static_assert(Format::alpha_offset >= 0,"pixel format has no alpha channel");
 
-   double mse = 0.0;
+      pixel(x,y)[Format::alpha_offset] = value;
+   }
 
-   for (unsigned int r = 0; r < height; ++r)
+   template <typename Function>
+   inline void for_each_pixel(const Function& function)
    {
-      const unsigned char* itr1     = image1.row(r + y) + x * image1.bytes_per_pixel();
-      const unsigned char* itr1_end = itr1 + (width * image1.bytes_per_pixel());
-      const unsigned char* itr2     = image2.row(r + y) + x * image2.bytes_per_pixel();
+      // function(unsigned char* pixel) is called from the pool's threads, one row band each.
+      const unsigned int w = width();
+
+      bitmap_details::parallel_rows(height(),w,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       for (unsigned int y = first_row; y < last_row; ++y)
+                                       {
+                                          unsigned char* itr = row(y);
+
+                                          for (unsigned int x = 0; x < w; ++x, itr += bytes_per_pixel)
+                                          {
+                                             function(itr);
+                                          }
+                                       }
+                                    });
+   }
 
-      while (itr1 != itr1_end)
-      {
-         double v = (static_cast<double>(*itr1) - static_cast<double>(*itr2));
-         mse += v * v;
-         ++itr1;
-         ++itr2;
-      }
+   inline void set_all_channels(const unsigned char red, const unsigned char green, const unsigned char blue)
+   {
+      for_each_pixel([=](unsigned char* itr)
+                     {
+                        itr[Format::red_offset  ] = red;
+                        itr[Format::green_offset] = green;
+                        itr[Format::blue_offset ] = blue;
+                     });
    }
 
-   if (mse <= 0.0000001)
+   inline void invert_color_planes()
    {
-      return 1000000.0;
+      for_each_pixel([](unsigned char* itr)
+                     {
+                        itr[Format::red_offset  ] = static_cast<unsigned char>(~itr[Format::red_offset  ]);
+                        itr[Format::green_offset] = static_cast<unsigned char>(~itr[Format::green_offset]);
+                        itr[Format::blue_offset ] = static_cast<unsigned char>(~itr[Format::blue_offset ]);
+                     });
    }
-   else
+
+   inline void convert_to_grayscale()
    {
-      mse /= (3.0 * width * height);
-      return 20.0 * std::log10(255.0 / std::sqrt(mse));
+      // The runtime version already runs SIMD kernels, which beat a typed scalar loop.
+      image_.convert_to_grayscale();
    }
-}
 
-inline void hierarchical_psnr_r(const double& x,     const double& y,
-                                const double& width, const double& height,
-                                const bitmap_image& image1,
-                                      bitmap_image& image2,
-                                const double& threshold,
-                                const rgb_store colormap[])
-{
-   if ((width <= 4.0) || (height <= 4.0))
+   inline void horizontal_flip()
    {
-      double psnr = psnr_region(static_cast<unsigned int>(x),
-                                static_cast<unsigned int>(y),
-                                static_cast<unsigned int>(width),
-                                static_cast<unsigned int>(height),
-                                image1,image2);
+      const unsigned int w = width();
 
-      if (psnr < threshold)
-      {
-         rgb_store c = colormap[static_cast<unsigned int>(1000.0 * (1.0 - (psnr / threshold)))];
-         image2.set_region(static_cast<unsigned int>(x),
-                           static_cast<unsigned int>(y),
-                           static_cast<unsigned int>(width + 1),
-                           static_cast<unsigned int>(height + 1),
-                           c.red,c.green,c.blue);
-      }
+      if (0 == w)
+         return;
+
+      bitmap_details::parallel_rows(height(),w,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       for (unsigned int y = first_row; y < last_row; ++y)
+                                       {
+                                          unsigned char* itr1 = row(y);
+                                          unsigned char* itr2 = itr1 + (w - 1) * bytes_per_pixel;
+
+                                          for ( ; itr1 < itr2; itr1 += bytes_per_pixel, itr2 -= bytes_per_pixel)
+                                          {
+                                             std::swap_ranges(itr1,itr1 + bytes_per_pixel,itr2);
+                                          }
+                                       }
+                                    });
    }
-   else
+
+   inline void reverse()
    {
-      double half_width  = ( width / 2.0);
-      double half_height = (height / 2.0);
+      // Rotates by 180 degrees, pairs of rows swapping from both ends.
+      const unsigned int w = width();
+      const unsigned int h = height();
+
+      if (0 == w)
+         return;
 
-      hierarchical_psnr_r(x             , y              , half_width, half_height,image1,image2,threshold,colormap);
-      hierarchical_psnr_r(x + half_width, y              , half_width, half_height,image1,image2,threshold,colormap);
-      hierarchical_psnr_r(x + half_width, y + half_height, half_width, half_height,image1,image2,threshold,colormap);
-      hierarchical_psnr_r(x             , y + half_height, half_width, half_height,image1,image2,threshold,colormap);
+      bitmap_details::parallel_rows((h + 1) / 2,w,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       for (unsigned int y = first_row; y < last_row; ++y)
+                                       {
+                                          unsigned char* itr1 = row(y);
+                                          unsigned char* itr2 = row(h - y - 1) + (w - 1) * bytes_per_pixel;
+
+                                          // The middle row of an odd height image is only reversed up to its centre.
+                                          const unsigned char* itr1_end = itr1 + ((y == (h - y - 1)) ? (w / 2) : w) * bytes_per_pixel;
+
+                                          for ( ; itr1 < itr1_end; itr1 += bytes_per_pixel, itr2 -= bytes_per_pixel)
+                                          {
+                                             std::swap_ranges(itr1,itr1 + bytes_per_pixel,itr2);
+                                          }
+                                       }
+                                    });
    }
-}
 
-inline void hierarchical_psnr(bitmap_image& image1,bitmap_image& image2, const double threshold, const rgb_store colormap[])
-{
-   if (
-        (image1.width()  != image2.width ()) ||
-        (image1.height() != image2.height())
-      )
+   inline void subsample(basic_bitmap_image& dest) const
    {
-      return;
+      /*
+         Half sub-sample, as bitmap_image::subsample. The averaging
+         kernels are shared with it and get the pixel size as a
+         constant.
+      */
+
+      const unsigned int w = (width () + 1) / 2;
+      const unsigned int h = (height() + 1) / 2;
+
+      dest.image_.setwidth_height(w,h);
+
+      bitmap_details::parallel_rows(h,w,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       for (unsigned int j = first_row; j < last_row; ++j)
+                                       {
+                                          const unsigned char* row2 = ((2 * j + 1) < height()) ? row(2 * j + 1) : 0;
+
+                                          bitmap_details::halve_row(row(2 * j),row2,dest.row(j),bytes_per_pixel,0,w,width());
+                                       }
+                                    });
+   }
+
+   inline void upsample(basic_bitmap_image& dest) const
+   {
+      // 2x up-sample, each pixel becomes a 2x2 block.
+      const unsigned int w = width();
+
+      dest.image_.setwidth_height(2 * w,2 * height());
+
+      bitmap_details::parallel_rows(height(),2 * w,
+                                    [&](const unsigned int first_row, const unsigned int last_row)
+                                    {
+                                       for (unsigned int j = first_row; j < last_row; ++j)
+                                       {
+                                          const unsigned char* s_itr = row(j);
+                                                unsigned char* itr1  = dest.row(2 * j);
+                                                unsigned char* itr2  = dest.row(2 * j + 1);
+
+                                          for (unsigned int i = 0; i < w; ++i, s_itr += bytes_per_pixel, itr1 += 2 * bytes_per_pixel, itr2 += 2 * bytes_per_pixel)
+                                          {
+                                             std::memcpy(itr1                  ,s_itr,bytes_per_pixel);
+                                             std::memcpy(itr1 + bytes_per_pixel,s_itr,bytes_per_pixel);
+                                             std::memcpy(itr2                  ,s_itr,bytes_per_pixel);
+                                             std::memcpy(itr2 + bytes_per_pixel,s_itr,bytes_per_pixel);
+                                          }
+                                       }
+                                    });
+   }
+
+   inline void save_image(const std::string& file_name)
+   {
+      // Files are always BGR ordered.
+      if (bitmap_image::rgb_mode == Format::channel_mode())
+      {
+         bitmap_image image(image_);
+
+         image.rgb_to_bgr();
+         image.save_image(file_name);
+      }
+      else
+         image_.save_image(file_name);
    }
 
-   double psnr = psnr_region(0,0,image1.width(),image1.height(),image1,image2);
+private:
 
-   if (psnr < threshold)
+   inline void adopt()
    {
-      hierarchical_psnr_r(0,0, image1.width(), image1.height(),image1,image2,threshold,colormap);
+      image_.set_pixel_format(Format::pixel_format());
+
+      if (bitmap_image::rgb_mode == Format::channel_mode())
+         image_.bgr_to_rgb();
+      else
+         image_.rgb_to_bgr();
    }
-}
+
+   bitmap_image image_;
+};
+
+typedef basic_bitmap_image<bgr24_format > bgr24_image;
+typedef basic_bitmap_image<rgb24_format > rgb24_image;
+typedef basic_bitmap_image<bgra32_format> bgra32_image;
+typedef basic_bitmap_image<rgba32_format> rgba32_image;
 
 class image_drawer
 {
@@ -17,10 +17,13 @@
 */
 
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "bitmap_image.hpp"
 
@@ -490,6 +493,861 @@ void test18()
    image.save_image("test18_color_maps.bmp");
 }
 
+void test19()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name,bitmap_image::mapped_load);
+
+   if (!image)
+   {
+      printf("test19() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   image.horizontal_flip();
+   image.save_image("test19_mapped_horiz_flip.bmp");
+}
+
+void test20()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test20() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   std::vector<unsigned char> buffer;
+   image.save_to_buffer(buffer);
+
+   bitmap_image memory_image;
+
+   if (!memory_image.load_from_memory(&buffer[0],buffer.size()))
+   {
+      printf("test20() - Error - Failed to load image from memory\n");
+      return;
+   }
+
+   memory_image.save_image("test20_memory_image.bmp");
+}
+
+void test21()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_reader reader(file_name);
+
+   if (!reader)
+   {
+      printf("test21() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_writer writer("test21_streamed_grayscale_image.bmp",reader.width(),reader.height());
+
+   if (!writer)
+   {
+      printf("test21() - Error - Failed to create output image\n");
+      return;
+   }
+
+   bitmap_image band;
+
+   while (!reader.end())
+   {
+      const unsigned int first_row = reader.current_row();
+
+      if (0 == reader.next_band(64,band))
+         break;
+
+      band.convert_to_grayscale();
+      writer.write_band(first_row,band);
+   }
+}
+
+void test22()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test22() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   image.set_pixel_format(bitmap_image::bgra_format);
+
+   const unsigned int height = image.height();
+   const unsigned int width  = image.width();
+
+   for (unsigned int y = 0; y < height; ++y)
+   {
+      for (unsigned int x = 0; x < width; ++x)
+      {
+         image.alpha_channel(x,y,static_cast<unsigned char>((255 * x) / width));
+      }
+   }
+
+   image.save_image("test22_alpha_gradient_image.bmp");
+
+   bitmap_image alpha_image("test22_alpha_gradient_image.bmp");
+
+   if (!alpha_image || !alpha_image.has_alpha())
+   {
+      printf("test22() - Error - Failed to reload 32-bit image\n");
+   }
+}
+
+void test23()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test23() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   std::vector<unsigned char> gray(image.pixel_count());
+
+   image.convert_to_grayscale(&gray[0]);
+
+   bitmap_image gray_image(image.width(),image.height());
+
+   gray_image.import_rgb(&gray[0],&gray[0],&gray[0]);
+
+   gray_image.save_image("test23_gray_plane_image.bmp");
+}
+
+void test24()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test24() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image flipped_image(image);
+
+   flipped_image.vertical_flip();
+
+   const unsigned int height = image.height();
+   const unsigned int width  = image.width();
+
+   std::vector<unsigned char> mask(image.pixel_count());
+
+   for (unsigned int y = 0; y < height; ++y)
+   {
+      for (unsigned int x = 0; x < width; ++x)
+      {
+         mask[y * width + x] = static_cast<unsigned char>((255 * x) / width);
+      }
+   }
+
+   image.alpha_blend(&mask[0],flipped_image);
+
+   image.save_image("test24_mask_blended_image.bmp");
+}
+
+void test25()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test25() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image subsampled_image;
+   bitmap_image upsampled_image;
+
+   image.subsample(subsampled_image);
+   subsampled_image.upsample(upsampled_image);
+
+   bitmap_image resampled_image(image.width(),image.height());
+
+   upsampled_image.region(0,0,image.width(),image.height(),resampled_image);
+
+   quality_metrics metrics;
+
+   if (!measure_quality(image,resampled_image,metrics))
+   {
+      printf("test25() - Error - Failed to measure quality\n");
+      return;
+   }
+
+   printf("test25() - PSNR: %6.3f (R: %6.3f G: %6.3f B: %6.3f) SSIM: %5.3f MS-SSIM: %5.3f\n",
+          metrics.psnr_total,
+          metrics.psnr[bitmap_image::red_plane  ],
+          metrics.psnr[bitmap_image::green_plane],
+          metrics.psnr[bitmap_image::blue_plane ],
+          ssim   (image,resampled_image),
+          ms_ssim(image,resampled_image));
+}
+
+void test26()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test26() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image serial_image(image);
+
+   bitmap_details::set_thread_count(1);
+
+   serial_image.invert_color_planes();
+   serial_image.add_to_color_plane(bitmap_image::red_plane,64);
+   serial_image.convert_to_grayscale();
+
+   bitmap_image parallel_image(image);
+
+   bitmap_details::set_thread_count(4);
+   bitmap_details::set_grain_size(image.width());
+
+   parallel_image.invert_color_planes();
+   parallel_image.add_to_color_plane(bitmap_image::red_plane,64);
+   parallel_image.convert_to_grayscale();
+
+   bitmap_details::set_thread_count(std::thread::hardware_concurrency());
+   bitmap_details::set_grain_size(1 << 16);
+
+   if (serial_image.psnr(parallel_image) < 1000000.0)
+   {
+      printf("test26() - Error - Parallel result differs from serial result\n");
+      return;
+   }
+
+   parallel_image.save_image("test26_parallel_gray_image.bmp");
+}
+
+void test27()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test27() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image subsampled_image;
+   bitmap_image upsampled_image;
+
+   image.subsample(subsampled_image);
+   subsampled_image.upsample(upsampled_image);
+
+   bitmap_image difference_image(image.width(),image.height());
+
+   upsampled_image.region(0,0,image.width(),image.height(),difference_image);
+
+   parallel_hierarchical_psnr(image,difference_image,40.0,jet_colormap);
+
+   difference_image.save_image("test27_hierarchical_psnr_image.bmp");
+}
+
+void test28()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test28() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image subsampled_image;
+   bitmap_image upsampled_image;
+
+   image.subsample(subsampled_image);
+   subsampled_image.upsample(upsampled_image);
+
+   bitmap_image resampled_image(image.width(),image.height());
+
+   upsampled_image.region(0,0,image.width(),image.height(),resampled_image);
+
+   const squared_error_table table(image,resampled_image);
+
+   const unsigned int window = std::min(8U,std::min(image.width(),image.height()));
+
+   double       worst_psnr = 1000000.0;
+   unsigned int worst_x    = 0;
+   unsigned int worst_y    = 0;
+
+   for (unsigned int y = 0; (y + window) <= image.height(); ++y)
+   {
+      for (unsigned int x = 0; (x + window) <= image.width(); ++x)
+      {
+         const double psnr = table.psnr(x,y,window,window);
+
+         if (psnr < worst_psnr)
+         {
+            worst_psnr = psnr;
+            worst_x    = x;
+            worst_y    = y;
+         }
+      }
+   }
+
+   printf("test28() - PSNR: %6.3f Worst %ux%u window: (%u,%u) %6.3f\n",
+          table.psnr(),
+          window,window,
+          worst_x,worst_y,
+          worst_psnr);
+}
+
+void test29()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test29() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image::color_histogram hist;
+
+   image.histogram(hist);
+
+   unsigned int median_luma = 0;
+
+   for (unsigned int count = 0; median_luma < 256; ++median_luma)
+   {
+      count += hist.luma[median_luma];
+
+      if ((2 * count) >= image.pixel_count())
+         break;
+   }
+
+   std::vector<unsigned int> joint_hist;
+
+   image.joint_histogram(bitmap_image::red_plane,bitmap_image::green_plane,joint_hist);
+
+   unsigned int red_dominant = 0;
+
+   for (unsigned int r = 0; r < 256; ++r)
+   {
+      for (unsigned int g = 0; g < r; ++g)
+      {
+         red_dominant += joint_hist[256 * r + g];
+      }
+   }
+
+   printf("test29() - Median luma: %u Red > Green: %u of %lu pixels\n",
+          median_luma,
+          red_dominant,
+          static_cast<unsigned long>(image.pixel_count()));
+}
+
+void test30()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test30() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image::color_histogram hist;
+
+   image.histogram(hist);
+
+   bitmap_image equalized_image(image);
+
+   lookup_table().equalize(hist.luma).apply(equalized_image);
+
+   equalized_image.save_image("test30_equalized_image.bmp");
+
+   lookup_table().gamma(1.0 / 2.2).contrast(1.25).add(bitmap_image::blue_plane,-16).apply(image);
+
+   image.save_image("test30_graded_image.bmp");
+}
+
+void test31()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test31() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image blurred_image(image);
+
+   blurred_image.gaussian_blur(1.5);
+   blurred_image.save_image("test31_gaussian_blurred_image.bmp");
+
+   bitmap_image box_blurred_image(image);
+
+   box_blurred_image.box_blur(2,bitmap_image::border_reflect);
+   box_blurred_image.save_image("test31_box_blurred_image.bmp");
+
+   bitmap_image sharpened_image(image);
+
+   sharpened_image.sharpen(1.0);
+   sharpened_image.save_image("test31_sharpened_image.bmp");
+
+   bitmap_image edge_image;
+
+   image.sobel(edge_image);
+   edge_image.save_image("test31_sobel_edge_image.bmp");
+}
+
+void test32()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test32() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image thumbnail;
+
+   image.resize(thumbnail,image.width() / 5,image.height() / 5,bitmap_image::lanczos_filter);
+   thumbnail.save_image("test32_lanczos_thumbnail.bmp");
+
+   bitmap_image enlarged_image;
+
+   thumbnail.resize(enlarged_image,image.width(),image.height(),bitmap_image::bicubic_filter);
+   enlarged_image.save_image("test32_bicubic_enlarged_image.bmp");
+
+   bitmap_image stretched_image;
+
+   image.resize(stretched_image,(3 * image.width()) / 2,image.height() / 2,bitmap_image::bilinear_filter);
+   stretched_image.save_image("test32_bilinear_stretched_image.bmp");
+}
+
+void test33()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test33() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   image_pyramid pyramid(image);
+
+   for (std::size_t i = 1; i < pyramid.levels(); ++i)
+   {
+      bitmap_image level_image;
+
+      pyramid.export_level(i,level_image);
+
+      level_image.save_image("test33_pyramid_level_" + std::to_string(i) + ".bmp");
+   }
+
+   const image_pyramid::view& top = pyramid.level(pyramid.levels() - 1);
+
+   printf("test33() - levels: %d  1x1 level: (%d,%d,%d)\n",
+          static_cast<int>(pyramid.levels()),
+          top.data[2], top.data[1], top.data[0]);
+}
+
+void test34()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test34() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   planar_image<float> planes(image);
+
+   planar_image<float>::view red   = planes.channel(bitmap_image::red_plane  );
+   planar_image<float>::view green = planes.channel(bitmap_image::green_plane);
+
+   for (unsigned int y = 0; y < planes.height(); ++y)
+   {
+      float* red_itr   = red  .row(y);
+      float* green_itr = green.row(y);
+
+      for (unsigned int x = 0; x < planes.width(); ++x)
+      {
+         const float average = 0.5f * (red_itr[x] + green_itr[x]);
+
+         red_itr  [x] = average;
+         green_itr[x] = average;
+      }
+   }
+
+   bitmap_image planar_result;
+
+   planes.to_image(planar_result);
+   planar_result.save_image("test34_red_green_merged_image.bmp");
+
+   const planar_image<unsigned char> byte_planes(image);
+
+   bitmap_image blue_image(image.width(),image.height());
+
+   planar_image<unsigned char>::const_view blue = byte_planes.channel(bitmap_image::blue_plane);
+
+   for (unsigned int y = 0; y < blue.height; ++y)
+   {
+      for (unsigned int x = 0; x < blue.width; ++x)
+      {
+         blue_image.set_pixel(x,y,blue(x,y),blue(x,y),blue(x,y));
+      }
+   }
+
+   blue_image.save_image("test34_blue_plane_image.bmp");
+}
+
+void test35()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test35() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   const std::size_t pixels = image.pixel_count();
+
+   std::vector<float> red  (pixels);
+   std::vector<float> green(pixels);
+   std::vector<float> blue (pixels);
+
+   image.export_rgb(&red[0],&green[0],&blue[0]);
+
+   for (std::size_t i = 0; i < pixels; ++i)
+   {
+      red  [i] *= 1.25f;
+      green[i] *= 1.25f;
+      blue [i] *= 1.25f;
+   }
+
+   bitmap_image brightened_image(image);
+
+   brightened_image.import_rgb_clamped(&red[0],&green[0],&blue[0]);
+   brightened_image.save_image("test35_brightened_image.bmp");
+
+   std::vector<double> red_normal  (pixels);
+   std::vector<double> green_normal(pixels);
+   std::vector<double> blue_normal (pixels);
+
+   image.export_rgb_normal(&red_normal[0],&green_normal[0],&blue_normal[0]);
+
+   bitmap_image round_trip_image(image.width(),image.height());
+
+   round_trip_image.import_rgb_normal(&red_normal[0],&green_normal[0],&blue_normal[0]);
+
+   printf("test35() - round trip PSNR: %8.4f\n",round_trip_image.psnr(image));
+}
+
+void test36()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test36() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   const unsigned int chroma_width  = image.chroma_width (bitmap_image::chroma_420);
+   const unsigned int chroma_height = image.chroma_height(bitmap_image::chroma_420);
+
+   std::vector<unsigned char> luma(static_cast<std::size_t>(image.width()) * image.height());
+   std::vector<unsigned char> cb  (static_cast<std::size_t>(chroma_width) * chroma_height);
+   std::vector<unsigned char> cr  (cb.size());
+
+   image.export_ycbcr(&luma[0],&cb[0],&cr[0],bitmap_image::chroma_420,bitmap_image::ycbcr_bt709);
+
+   bitmap_image luma_image(image.width(),image.height());
+   bitmap_image chroma_image(chroma_width,chroma_height);
+
+   for (unsigned int y = 0; y < image.height(); ++y)
+   {
+      for (unsigned int x = 0; x < image.width(); ++x)
+      {
+         const unsigned char value = luma[y * image.width() + x];
+
+         luma_image.set_pixel(x,y,value,value,value);
+      }
+   }
+
+   for (unsigned int y = 0; y < chroma_height; ++y)
+   {
+      for (unsigned int x = 0; x < chroma_width; ++x)
+      {
+         chroma_image.set_pixel(x,y,cr[y * chroma_width + x],128,cb[y * chroma_width + x]);
+      }
+   }
+
+   luma_image.save_image("test36_bt709_luma_image.bmp");
+   chroma_image.save_image("test36_bt709_420_chroma_image.bmp");
+}
+
+void test37()
+{
+   std::string file_name("image.bmp");
+
+   rgb24_image image(file_name);
+
+   if (!image)
+   {
+      printf("test37() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   image.for_each_pixel([](unsigned char* pixel)
+                        {
+                           // Swap red and blue, the offsets are compile-time constants.
+                           std::swap(pixel[rgb24_format::red_offset],pixel[rgb24_format::blue_offset]);
+                        });
+
+   image.horizontal_flip();
+   image.save_image("test37_rgb24_swapped_flipped_image.bmp");
+
+   rgb24_image half_image;
+
+   image.reverse();
+   image.subsample(half_image);
+   half_image.save_image("test37_rgb24_reversed_half_image.bmp");
+
+   bgra32_image translucent_image(image.image());
+
+   for (unsigned int y = 0; y < translucent_image.height(); ++y)
+   {
+      for (unsigned int x = 0; x < translucent_image.width(); ++x)
+      {
+         translucent_image.alpha(x,y,static_cast<unsigned char>((255 * x) / translucent_image.width()));
+      }
+   }
+
+   translucent_image.save_image("test37_bgra32_alpha_ramp_image.bmp");
+}
+
+void test38()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test38() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   const unsigned int tile_width  = image.width () / 2;
+   const unsigned int tile_height = image.height() / 2;
+
+   // Each quadrant is processed in place through a view, nothing is copied.
+   const bitmap_image::image_view tile[] =
+                                  {
+                                    image.view(         0,          0,tile_width,tile_height),
+                                    image.view(tile_width,          0,tile_width,tile_height),
+                                    image.view(         0,tile_height,tile_width,tile_height),
+                                    image.view(tile_width,tile_height,tile_width,tile_height)
+                                  };
+
+   tile[0].horizontal_flip();
+   tile[1].vertical_flip();
+   tile[2].convert_to_grayscale();
+   tile[3].alpha_blend(0.5,tile[0]);
+
+   bitmap_image::color_histogram hist;
+
+   tile[2].histogram(hist);
+
+   unsigned int gray_levels = 0;
+
+   for (std::size_t i = 0; i < 256; ++i)
+   {
+      if (hist.luma[i]) ++gray_levels;
+   }
+
+   printf("test38() - Tile PSNR: %8.4f  Gray tile levels: %u\n",
+          tile[3].psnr(tile[0]),
+          gray_levels);
+
+   image.view(tile_width / 2,tile_height / 2,tile_width,tile_height).fill(0xFF,0xFF,0x00);
+
+   image.save_image("test38_view_tiles_image.bmp");
+}
+
+void test39()
+{
+   bitmap_image image(4,4);
+   image.clear();
+
+   std::vector<unsigned char> buffer;
+   image.save_to_buffer(buffer);
+
+   // Patches the width and height fields of the information header, little-endian.
+   struct header_patch
+   {
+      static void apply(std::vector<unsigned char>& header, const unsigned int width, const unsigned int height)
+      {
+         for (std::size_t i = 0; i < 4; ++i)
+         {
+            header[18 + i] = static_cast<unsigned char>(width  >> (8 * i));
+            header[22 + i] = static_cast<unsigned char>(height >> (8 * i));
+         }
+      }
+   };
+
+   const unsigned int dimensions[][2] = {
+                                           { 2863311530U, 0x80000000U },  // wraps a 64-bit size check
+                                           {          4U, 0x80000000U },  // height of INT_MIN
+                                           { 2863311530U,          2U },  // negative width
+                                           {     60000U,       60000U },  // valid, but no pixel data present
+                                           {     70000U,       70000U }   // beyond 16 bits, no pixel data present
+                                        };
+
+   std::size_t rejected = 0;
+   std::size_t attempts = 0;
+
+   bitmap_image loaded_image;
+
+   // A truncated header in memory and in a stream.
+   ++attempts; if (!loaded_image.load_from_memory(&buffer[0],30)) ++rejected;
+
+   {
+      std::istringstream stream(std::string(buffer.begin(),buffer.begin() + 30));
+      ++attempts; if (!loaded_image.load_from_stream(stream)) ++rejected;
+   }
+
+   for (std::size_t i = 0; i < sizeof(dimensions) / sizeof(dimensions[0]); ++i)
+   {
+      std::vector<unsigned char> header(buffer.begin(),buffer.begin() + 54);
+      header.resize(118,0x00);
+
+      header_patch::apply(header,dimensions[i][0],dimensions[i][1]);
+
+      ++attempts; if (!loaded_image.load_from_memory(&header[0],header.size())) ++rejected;
+
+      std::istringstream stream(std::string(header.begin(),header.end()));
+      ++attempts; if (!loaded_image.load_from_stream(stream)) ++rejected;
+   }
+
+   printf("test39() - Rejected %d of %d malformed headers\n",
+          static_cast<int>(rejected),
+          static_cast<int>(attempts));
+}
+
+void test40()
+{
+   std::string file_name("image.bmp");
+
+   bitmap_image image(file_name);
+
+   if (!image)
+   {
+      printf("test40() - Error - Failed to open '%s'\n",file_name.c_str());
+      return;
+   }
+
+   bitmap_image bgrx_image(image);
+   bgrx_image.set_pixel_format(bitmap_image::bgrx_format);
+
+   bitmap_image rgb_image(image);
+   rgb_image.bgr_to_rgb();
+
+   const bitmap_image* sources[] = { &bgrx_image, &rgb_image };
+
+   for (std::size_t i = 0; i < 2; ++i)
+   {
+      const bitmap_image& source = *sources[i];
+
+      bitmap_image result;
+
+      planar_image<float>(source).to_image(result);
+
+      bool identical = (result.format() == source.format()) &&
+                       (result.view().mode() == source.view().mode());
+
+      for (unsigned int y = 0; identical && (y < source.height()); ++y)
+      {
+         identical = std::equal(source.row(y),source.row(y) + source.width() * source.bytes_per_pixel(),result.row(y));
+      }
+
+      printf("test40() - %s round trip: %s\n",
+             (0 == i) ? "bgrx" : "rgb ",
+             identical ? "identical" : "differs");
+   }
+}
+
+void test41()
+{
+   bitmap_image image(5,3);
+   image.set_pixel_format(bitmap_image::bgra_format);
+
+   for (unsigned int y = 0; y < image.height(); ++y)
+   {
+      for (unsigned int x = 0; x < image.width(); ++x)
+      {
+         image.set_pixel(x,y,static_cast<unsigned char>(50 * x),static_cast<unsigned char>(80 * y),0x7F);
+         image.alpha_channel(x,y,static_cast<unsigned char>(40 * (x + y)));
+      }
+   }
+
+   bitmap_image upsampled_image;
+   image.upsample(upsampled_image);
+
+   std::vector<unsigned char> buffer;
+   upsampled_image.save_to_buffer(buffer);
+
+   bitmap_image loaded_image;
+
+   const bool identical = loaded_image.load_from_memory(&buffer[0],buffer.size()) &&
+                          (loaded_image.format() == bitmap_image::bgra_format)      &&
+                          (loaded_image.alpha_channel(9,5) == image.alpha_channel(4,2));
+
+   printf("test41() - BGRA upsample round trip: %s\n",identical ? "identical" : "differs");
+}
+
 int main()
 {
    test01();
@@ -510,6 +1368,29 @@ int main()
    test16();
    test17();
    test18();
+   test19();
+   test20();
+   test21();
+   test22();
+   test23();
+   test24();
+   test25();
+   test26();
+   test27();
+   test28();
+   test29();
+   test30();
+   test31();
+   test32();
+   test33();
+   test34();
+   test35();
+   test36();
+   test37();
+   test38();
+   test39();
+   test40();
+   test41();
    return 0;
 }
 